@@ -26,11 +26,36 @@ paxmarksh() {
 	local dodefault=""
 	[[ "${flags//[!z]}" ]] && dodefault="yes"
 
+	# Probe for the tools once, not for every file
+	local paxctl="" paxctlng_pt="" paxctlng_xt="" scanelf="" setfattr=""
+	type -p paxctl > /dev/null && paxctl="yes"
+	if type -p paxctl-ng > /dev/null; then
+		paxctl-ng -L && paxctlng_pt="yes"
+		paxctl-ng -l && paxctlng_xt="yes"
+	fi
+	type -p scanelf > /dev/null && scanelf="yes"
+	type -p setfattr > /dev/null && setfattr="yes"
+
+	# The paxmark builtin, see --enable-bashbuiltin, does the paxctl-ng
+	# steps below in this shell rather than forking for every file.  Only
+	# the files it could not mark are left for the other tools.
+	local builtin=""
+	[[ $(type -t paxmark) == "builtin" ]] || enable -f paxmark.so paxmark > /dev/null 2>&1
+	[[ $(type -t paxmark) == "builtin" ]] && builtin="yes"
+
+	local todo
+
 	if has PT ${PAX_MARKINGS}; then
-		for f in "$@"; do
+		todo=( "$@" )
+		if [[ ${builtin} == "yes" ]]; then
+			paxmark -L -a todo "${flags}" "$@"
+			paxctlng_pt=""
+		fi
+
+		for f in "${todo[@]}"; do
 
 			#First try paxctl -> this might try to create/convert program headers
-			if type -p paxctl > /dev/null; then
+			if [[ ${paxctl} == "yes" ]]; then
 				# First, try modifying the existing PAX_FLAGS header
 				paxctl -q${flags} "${f}" >/dev/null 2>&1 && continue
 				# Second, try creating a PT_PAX header (works on ET_EXEC)
@@ -41,7 +66,7 @@ paxmarksh() {
 			fi
 
 			#Next try paxctl-ng -> this will not create/convert any program headers
-			if type -p paxctl-ng > /dev/null && paxctl-ng -L ; then
+			if [[ ${paxctlng_pt} == "yes" ]]; then
 				flags="${flags//z}"
 				[[ ${dodefault} == "yes" ]] && paxctl-ng -L -z "${f}" >/dev/null 2>&1
 				[[ "${flags}" ]] || continue
@@ -49,7 +74,7 @@ paxmarksh() {
 			fi
 
 			#Finally fall back on scanelf
-			if type -p scanelf > /dev/null && [[ ${PAX_MARKINGS} != "none" ]]; then
+			if [[ ${scanelf} == "yes" ]] && [[ ${PAX_MARKINGS} != "none" ]]; then
 				scanelf -Xxz ${flags} "$f" >/dev/null 2>&1
 			#We failed to set PT_PAX flags
 			elif [[ ${PAX_MARKINGS} != "none" ]]; then
@@ -59,18 +84,24 @@ paxmarksh() {
 	fi
 
 	if has XT ${PAX_MARKINGS}; then
+		todo=( "$@" )
+		if [[ ${builtin} == "yes" ]]; then
+			paxmark -l -a todo "${flags}" "$@"
+			paxctlng_xt=""
+		fi
+
 		flags="${flags//z}"
-		for f in "$@"; do
+		for f in "${todo[@]}"; do
 
 			#First try paxctl-ng
-			if type -p paxctl-ng > /dev/null && paxctl-ng -l ; then
+			if [[ ${paxctlng_xt} == "yes" ]]; then
 				[[ ${dodefault} == "yes" ]] && paxctl-ng -d "${f}" >/dev/null 2>&1
 				[[ "${flags}" ]] || continue
 				paxctl-ng -l -${flags} "${f}" >/dev/null 2>&1 && continue
 			fi
 
 			#Next try setfattr
-			if type -p setfattr > /dev/null; then
+			if [[ ${setfattr} == "yes" ]]; then
 				[[ "${flags//[!Ee]}" ]] || flags+="e" # bug 447150
 				[[ ${dodefault} == "yes" ]] && setfattr -x "user.pax.flags" "${f}" >/dev/null 2>&1
 				setfattr -n "user.pax.flags" -v "${flags}" "${f}" >/dev/null 2>&1 && continue
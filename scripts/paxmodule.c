@@ -17,15 +17,33 @@
 */
 
 #include <Python.h>
+#if PY_MAJOR_VERSION < 3
+ #include <structseq.h>
+#endif
 
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/vfs.h>
+#include <time.h>
+
+#include <stddef.h>
 
 #ifdef PTPAX
  #include <gelf.h>
+#else
+ #include <elf.h>
 #endif
 
 #ifdef NEED_PAX_DECLS
@@ -51,21 +69,94 @@
 
 #define FLAGS_SIZE	6
 
+#define LOCK_WAIT		10000		/* ms to wait for a file being marked elsewhere */
+#define LOCK_BACKOFF_MIN	1
+#define LOCK_BACKOFF_MAX	100
+#define XT_TRIES		3		/* merges into an XATTR_PAX written by path meanwhile */
+
+// As for ioprio_set(2), glibc has no wrapper
+#define IOPRIO_CLASS_RT		1
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_WHO_PROCESS	1
+
+/* The calls made once per file take their arguments as a vector where
+ * the interpreter has METH_FASTCALL, 3.7 on, rather than packed into a
+ * tuple and parsed against a format string.  PAX_ARGS is their parameter
+ * list either way, and get_args(PAX_PASS, ...) unpacks it.
+ */
+#if PY_VERSION_HEX >= 0x03070000
+ #define PAX_FASTCALL
+ #define PAX_ARGS	PyObject *const *args, Py_ssize_t nargs
+ #define PAX_PASS	args, nargs
+ #define PAX_METH	METH_FASTCALL
+ #define PAX_FUNC(f)	(PyCFunction)(void (*)(void))(f)
+#else
+ #define PAX_ARGS	PyObject *args
+ #define PAX_PASS	args
+ #define PAX_METH	METH_VARARGS
+ #define PAX_FUNC(f)	(f)
+#endif
+
+#if PY_MAJOR_VERSION >= 3
+ #define PAX_INT(v)	PyLong_FromLong(v)
+#else
+ #define PAX_INT(v)	PyInt_FromLong(v)
+#endif
+
 
-static PyObject * pax_getflags(PyObject *, PyObject *);
-static PyObject * pax_setbinflags(PyObject *, PyObject *);
-static PyObject * pax_setstrflags(PyObject *, PyObject *);
+static PyObject * pax_getflags(PyObject *, PAX_ARGS);
+static PyObject * pax_getptxtflags(PyObject *, PAX_ARGS);
+static PyObject * pax_setbinflags(PyObject *, PAX_ARGS);
+static PyObject * pax_setstrflags(PyObject *, PAX_ARGS);
+static PyObject * pax_getflags_from_buffer(PyObject *, PyObject *);
+static PyObject * pax_setbinflags_in_buffer(PyObject *, PyObject *);
+static PyObject * pax_setstrflags_in_buffer(PyObject *, PyObject *);
+#ifdef XTPAX
+static PyObject * pax_deletextpax(PyObject *, PAX_ARGS);
+#endif
+static PyObject * pax_needed(PyObject *, PyObject *);
+static PyObject * pax_scan(PyObject *, PyObject *);
+static PyObject * pax_mismatches(PyObject *, PyObject *);
+static PyObject * pax_setioprio(PyObject *, PyObject *);
+static PyObject * pax_setnocache(PyObject *, PyObject *);
+static PyObject * pax_setsysroot(PyObject *, PyObject *);
+
+static int nocache_open(const char *);
+static int sysroot_open(const char *, int);
+#ifdef PTPAX
+static uint16_t nocache_get_pt_flags(int, const char **);
+static int set_pt_flags_foreign(int, uint16_t, const char **);
+#endif
 #ifdef XTPAX
-static PyObject * pax_deletextpax(PyObject *, PyObject *);
+#define XTCAP_SET	1	/* XATTR_PAX is not known to fail to be written */
+static int xtcap(int);
+static void xtcap_failed(int, int);
+static int xtpath_remove(const char *);
+#ifndef PTPAX
+static int xtpath_flags(const char *, uint16_t *);
+static int setflags_xtpath(const char *, uint16_t);
+#endif
 #endif
 
 static PyMethodDef PaxMethods[] = {
-	{"getflags",     pax_getflags,    METH_VARARGS, "Get the pax flags as a string."},
-	{"setbinflags",  pax_setbinflags, METH_VARARGS, "Set the pax flags using binary."},
-	{"setstrflags",  pax_setstrflags, METH_VARARGS, "Set the pax flags using string."},
+	{"getflags",     PAX_FUNC(pax_getflags),     PAX_METH, "Get the pax flags as a string."},
+	{"getptxtflags", PAX_FUNC(pax_getptxtflags), PAX_METH, "Get the PT_PAX and XATTR_PAX flags as strings, None if missing."},
+	{"setbinflags",  PAX_FUNC(pax_setbinflags),  PAX_METH, "Set the pax flags using binary, return the number of markings changed."},
+	{"setstrflags",  PAX_FUNC(pax_setstrflags),  PAX_METH, "Set the pax flags using string, return the number of markings changed."},
+	{"getflags_from_buffer",  pax_getflags_from_buffer,  METH_VARARGS, "Get the PT_PAX flags of an ELF image in a buffer."},
+	{"setbinflags_in_buffer", pax_setbinflags_in_buffer, METH_VARARGS, "Set the PT_PAX flags in a writable buffer using binary, return 1 if changed."},
+	{"setstrflags_in_buffer", pax_setstrflags_in_buffer, METH_VARARGS, "Set the PT_PAX flags in a writable buffer using string, return 1 if changed."},
 #ifdef XTPAX
-	{"deletextpax",  pax_deletextpax, METH_VARARGS, "Delete the XATTR_PAX field."},
+	{"deletextpax",  PAX_FUNC(pax_deletextpax),  PAX_METH, "Delete the XATTR_PAX field, return 1 if it was there."},
 #endif
+	{"needed",       pax_needed,      METH_VARARGS, "Iterate over the NEEDED.ELF.2 records in a vdb, optionally only the matching ones."},
+	{"scan",         pax_scan,        METH_VARARGS, "Walk trees of files in native threads, iterate over lists of what was found."},
+	{"mismatches",   pax_mismatches,  METH_VARARGS, "Find the edges whose nodes have different pax flags."},
+	{"setioprio",    pax_setioprio,   METH_VARARGS, "Set the I/O scheduling class and level of the process."},
+	{"setnocache",   pax_setnocache,  METH_VARARGS, "Read the flags without leaving the files in the page cache, return the old setting."},
+	{"setsysroot",   pax_setsysroot,  METH_VARARGS, "Resolve every path inside the root of an image, or not with None, return the old root."},
 	{NULL, NULL, 0, NULL}
 };
 
@@ -85,6 +176,17 @@ static PyMethodDef PaxMethods[] = {
 
 static PyObject *PaxError;
 
+static PyTypeObject NeededType;
+static PyTypeObject ScanType;
+static PyTypeObject ScanRecordType;
+static PyStructSequence_Desc scan_record_desc;
+
+#if PY_MAJOR_VERSION >= 3
+static PyTypeObject ChannelType;
+static struct PyModuleDef aiomoduledef;
+static void aio_atfork_child(void);
+#endif
+
 PyMODINIT_FUNC
 #if PY_MAJOR_VERSION >= 3
 PyInit_pax(void)
@@ -93,6 +195,9 @@ initpax(void)
 #endif
 {
 	PyObject *m;
+#if PY_MAJOR_VERSION >= 3
+	PyObject *aio;
+#endif
 
 #if PY_MAJOR_VERSION >= 3
 	m = PyModule_Create(&moduledef);
@@ -107,10 +212,50 @@ initpax(void)
 		return;
 #endif
 
+	if (PyType_Ready(&NeededType) < 0)
+#if PY_MAJOR_VERSION >= 3
+		return NULL;
+#else
+		return;
+#endif
+
+	if (PyType_Ready(&ScanType) < 0)
+#if PY_MAJOR_VERSION >= 3
+		return NULL;
+#else
+		return;
+#endif
+
+#if PY_MAJOR_VERSION >= 3
+	if (PyStructSequence_InitType2(&ScanRecordType, &scan_record_desc) < 0)
+		return NULL;
+#else
+	PyStructSequence_InitType(&ScanRecordType, &scan_record_desc);
+#endif
+	Py_INCREF(&ScanRecordType);
+	PyModule_AddObject(m, "ScanRecord", (PyObject *) &ScanRecordType);
+
 	PaxError = PyErr_NewException("pax.PaxError", NULL, NULL);
 	Py_INCREF(PaxError);
 	PyModule_AddObject(m, "PaxError", PaxError);
 
+	PyModule_AddIntConstant(m, "IOPRIO_CLASS_RT", IOPRIO_CLASS_RT);
+	PyModule_AddIntConstant(m, "IOPRIO_CLASS_BE", IOPRIO_CLASS_BE);
+	PyModule_AddIntConstant(m, "IOPRIO_CLASS_IDLE", IOPRIO_CLASS_IDLE);
+
+#if PY_MAJOR_VERSION >= 3
+	if (PyType_Ready(&ChannelType) < 0)
+		return NULL;
+
+	// Register pax.aio in sys.modules too, so "import pax.aio" works
+	if ((aio = PyModule_Create(&aiomoduledef)) == NULL)
+		return NULL;
+	PyDict_SetItemString(PyImport_GetModuleDict(), "pax.aio", aio);
+	PyModule_AddObject(m, "aio", aio);
+
+	pthread_atfork(NULL, NULL, aio_atfork_child);
+#endif
+
 #if PY_MAJOR_VERSION >= 3
 	return m;
 #else
@@ -121,7 +266,7 @@ initpax(void)
 
 #ifdef PTPAX
 uint16_t
-get_pt_flags(int fd)
+get_pt_flags(int fd, const char **err)
 {
 	Elf *elf;
 	GElf_Phdr phdr;
@@ -131,20 +276,20 @@ get_pt_flags(int fd)
 
 	if(elf_version(EV_CURRENT) == EV_NONE)
 	{
-		PyErr_SetString(PaxError, "get_pt_flags: library out of date");
+		*err = "get_pt_flags: library out of date";
 		return pt_flags;
 	}
 
 	if((elf = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL)
 	{
-		PyErr_SetString(PaxError, "get_pt_flags: elf_begin() failed");
+		*err = "get_pt_flags: elf_begin() failed";
 		return pt_flags;
 	}
 
 	if(elf_kind(elf) != ELF_K_ELF)
 	{
 		elf_end(elf);
-		PyErr_SetString(PaxError, "get_pt_flags: elf_kind() failed: this is not an elf file.");
+		*err = "get_pt_flags: elf_kind() failed: this is not an elf file.";
 		return pt_flags;
 	}
 
@@ -154,7 +299,8 @@ get_pt_flags(int fd)
 	{
 		if(gelf_getphdr(elf, i, &phdr) != &phdr)
 		{
-			PyErr_SetString(PaxError, "get_pt_flags: gelf_getphdr() failed: could not get phdr.");
+			elf_end(elf);
+			*err = "get_pt_flags: gelf_getphdr() failed: could not get phdr.";
 			return pt_flags;
 		}
 
@@ -281,27 +427,229 @@ bin2string(uint16_t flags, char *buf)
 }
 
 
+/* There are only 3^5 flag strings, so each is made once, interned, and
+ * handed out again, rather than a new string built on every call.
+ */
+static PyObject *flag_strings[243];
+
 static PyObject *
-pax_getflags(PyObject *self, PyObject *args)
+flags_str(uint16_t flags)
 {
-	const char *f_name;
-	int fd, flags_found;
-	uint16_t flags;
 	char buf[FLAGS_SIZE];
+	int i, n = 0;
 
 	memset(buf, 0, FLAGS_SIZE);
+	bin2string4print(flags, buf);
+
+	for(i = 0; i < 5; i++)
+		n = n * 3 + (buf[i] == '-' ? 0 : buf[i] < 'a' ? 1 : 2);
+
+	if(flag_strings[n] == NULL)
+#if PY_MAJOR_VERSION >= 3
+		flag_strings[n] = PyUnicode_InternFromString(buf);
+#else
+		flag_strings[n] = PyString_InternFromString(buf);
+#endif
+
+	Py_XINCREF(flag_strings[n]);
+	return flag_strings[n];
+}
+
+
+// ( flags as a string, flags ) as getflags() returns them
+static PyObject *
+flags_result(uint16_t flags)
+{
+	PyObject *t, *v;
 
-	if (!PyArg_ParseTuple(args, "s", &f_name))
+	if((t = PyTuple_New(2)) == NULL)
+		return NULL;
+
+	if((v = flags_str(flags)) == NULL)
 	{
-		PyErr_SetString(PaxError, "pax_getflags: PyArg_ParseTuple failed");
+		Py_DECREF(t);
 		return NULL;
 	}
+	PyTuple_SET_ITEM(t, 0, v);
 
-	if((fd = open(f_name, O_RDONLY)) < 0)
+	if((v = PAX_INT(flags)) == NULL)
 	{
-		PyErr_SetString(PaxError, "pax_getflags: open() failed");
+		Py_DECREF(t);
 		return NULL;
 	}
+	PyTuple_SET_ITEM(t, 1, v);
+
+	return t;
+}
+
+
+/* Unpack exactly n arguments into argv, setting PaxError to err if there
+ * are not that many.
+ */
+static int
+get_args(PAX_ARGS, Py_ssize_t n, PyObject **argv, const char *err)
+{
+	Py_ssize_t i;
+
+#ifdef PAX_FASTCALL
+	if(nargs != n)
+	{
+		PyErr_SetString(PaxError, err);
+		return -1;
+	}
+
+	for(i = 0; i < n; i++)
+		argv[i] = args[i];
+#else
+	if(!PyTuple_Check(args) || PyTuple_GET_SIZE(args) != n)
+	{
+		PyErr_SetString(PaxError, err);
+		return -1;
+	}
+
+	for(i = 0; i < n; i++)
+		argv[i] = PyTuple_GET_ITEM(args, i);
+#endif
+
+	return 0;
+}
+
+
+/* A file to work on is given by a path, as str, bytes or any path-like
+ * object, or by an open fd.  An fd is used as it is, neither resolved in
+ * the sysroot nor closed.  A str is used through its own UTF-8 copy where
+ * it has one, which costs nothing after the first call.
+ */
+struct pax_path
+{
+	int fd;				/* -1 when given a path */
+	const char *name;
+	PyObject *bytes;		/* if we had to make name, it lives here */
+};
+
+static int
+get_path(PyObject *o, struct pax_path *p, const char *err)
+{
+	long fd;
+	Py_ssize_t len = -1;
+
+	p->fd = -1;
+	p->name = NULL;
+	p->bytes = NULL;
+
+#if PY_MAJOR_VERSION >= 3
+	if(PyLong_Check(o) && !PyBool_Check(o))
+#else
+	if((PyInt_Check(o) || PyLong_Check(o)) && !PyBool_Check(o))
+#endif
+	{
+		fd = PyLong_AsLong(o);
+		if(fd < 0 || fd > INT_MAX)
+		{
+			PyErr_Clear();
+			PyErr_SetString(PaxError, err);
+			return -1;
+		}
+		p->fd = (int)fd;
+		return 0;
+	}
+
+#if PY_MAJOR_VERSION >= 3
+	if(PyUnicode_CheckExact(o))
+	{
+		if((p->name = PyUnicode_AsUTF8AndSize(o, &len)) == NULL)
+			// Undecodable bytes smuggled in as surrogates, see below
+			PyErr_Clear();
+	}
+	else if(PyBytes_CheckExact(o))
+	{
+		p->name = PyBytes_AS_STRING(o);
+		len = PyBytes_GET_SIZE(o);
+	}
+
+	if(p->name == NULL)
+	{
+		if(!PyUnicode_FSConverter(o, &p->bytes))
+		{
+			PyErr_Clear();
+			PyErr_SetString(PaxError, err);
+			return -1;
+		}
+		p->name = PyBytes_AS_STRING(p->bytes);
+		len = PyBytes_GET_SIZE(p->bytes);
+	}
+#else
+	// A unicode path is encoded as the "s" format did, eg. one from json
+	if(PyUnicode_Check(o) && (o = _PyUnicode_AsDefaultEncodedString(o, NULL)) == NULL)
+		PyErr_Clear();
+
+	if(o != NULL && PyString_Check(o))
+	{
+		p->name = PyString_AS_STRING(o);
+		len = PyString_GET_SIZE(o);
+	}
+	else
+	{
+		PyErr_SetString(PaxError, err);
+		return -1;
+	}
+#endif
+
+	if(strlen(p->name) != (size_t)len)
+	{
+		Py_CLEAR(p->bytes);
+		PyErr_SetString(PaxError, err);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+put_path(struct pax_path *p)
+{
+	Py_CLEAR(p->bytes);
+}
+
+
+// A str argument, eg. the flags for setstrflags()
+static const char *
+get_str(PyObject *o, const char *err)
+{
+	const char *str = NULL;
+
+#if PY_MAJOR_VERSION >= 3
+	if(PyUnicode_Check(o))
+		str = PyUnicode_AsUTF8(o);
+#else
+	if(PyUnicode_Check(o))
+		o = _PyUnicode_AsDefaultEncodedString(o, NULL);
+	if(o != NULL && PyString_Check(o))
+		str = PyString_AS_STRING(o);
+#endif
+
+	if(str == NULL)
+	{
+		PyErr_Clear();
+		PyErr_SetString(PaxError, err);
+	}
+
+	return str;
+}
+
+
+/* The file level operations below are shared by the blocking calls and
+ * by pax.aio, whose worker threads run them without the GIL.  So they
+ * never touch the interpreter: a failure is passed back as a message in
+ * *err and the caller turns it into a PaxError.
+ */
+static int
+getflags_fd(int fd, char *buf, uint16_t *flags, const char **err)
+{
+	uint16_t pt_flags = UINT16_MAX, xt_flags = UINT16_MAX;
+#ifdef PTPAX
+	const char *pt_err = NULL;
+#endif
 
 	/* Since the xattr pax flags are obtained second, they
 	 * will override the PT_PAX flags values.  The pax kernel
@@ -312,40 +660,176 @@ pax_getflags(PyObject *self, PyObject *args)
 	 * other but not both.
 	 */
 
-	flags_found = 0;
-
 #ifdef PTPAX
-	flags = get_pt_flags(fd);
-	if( flags != UINT16_MAX )
-	{
-		flags_found = 1;
-		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
-	}
+	pt_flags = nocache_get_pt_flags(fd, &pt_err);
 #endif
 
 #ifdef XTPAX
-	flags = get_xt_flags(fd);
-	if( flags != UINT16_MAX )
+	xt_flags = get_xt_flags(fd);
+#endif
+
+	// Only a file with no XATTR_PAX falls back on its PT_PAX
+	*flags = xt_flags != UINT16_MAX ? xt_flags : pt_flags;
+
+	if( *flags == UINT16_MAX )
+	{
+		*err = "pax_getflags: no PAX flags found";
+		return -1;
+	}
+
+	memset(buf, 0, FLAGS_SIZE);
+	bin2string4print(*flags, buf);
+
+	return 0;
+}
+
+
+static int
+getflags_file(const char *f_name, char *buf, uint16_t *flags, const char **err)
+{
+	int fd, ret;
+
+#if defined(XTPAX) && !defined(PTPAX)
+	// XATTR_PAX is all there is to read, which needs no open file
+	if(xtpath_flags(f_name, flags) == 0)
 	{
-		flags_found = 1;
+		if(*flags == UINT16_MAX)
+		{
+			*err = "pax_getflags: no PAX flags found";
+			return -1;
+		}
 		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
+		bin2string4print(*flags, buf);
+		return 0;
 	}
 #endif
 
+	if((fd = nocache_open(f_name)) < 0)
+	{
+		*err = "pax_getflags: open() failed";
+		return -1;
+	}
+
+	ret = getflags_fd(fd, buf, flags, err);
+
 	close(fd);
 
-	if( !flags_found )
+	return ret;
+}
+
+
+static PyObject *
+pax_getflags(PyObject *self, PAX_ARGS)
+{
+	PyObject *argv[1];
+	struct pax_path path;
+	const char *err = NULL;
+	int ret;
+	uint16_t flags;
+	char buf[FLAGS_SIZE];
+
+	memset(buf, 0, FLAGS_SIZE);
+
+	if(get_args(PAX_PASS, 1, argv, "pax_getflags: expected a path or an fd") < 0 ||
+	   get_path(argv[0], &path, "pax_getflags: expected a path or an fd") < 0)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	if(path.fd >= 0)
+		ret = getflags_fd(path.fd, buf, &flags, &err);
+	else
+		ret = getflags_file(path.name, buf, &flags, &err);
+	Py_END_ALLOW_THREADS
+
+	put_path(&path);
+
+	if(ret < 0)
 	{
-		PyErr_SetString(PaxError, "pax_getflags: no PAX flags found");
+		PyErr_SetString(PaxError, err);
 		return NULL;
 	}
 	else
-		return Py_BuildValue("si", buf, flags);
+		return flags_result(flags);
 }
 
 
+
+/* Unlike getflags(), which returns the flags the kernel would use, this
+ * returns both markings as they are on disk, so they can be compared.
+ */
+static PyObject *
+pax_getptxtflags(PyObject *self, PAX_ARGS)
+{
+	PyObject *argv[1], *pt, *xt, *t;
+	struct pax_path path;
+#ifdef PTPAX
+	const char *err = NULL;
+#endif
+	int fd, bypath = 0;
+	uint16_t pt_flags = UINT16_MAX, xt_flags = UINT16_MAX;
+
+	if(get_args(PAX_PASS, 1, argv, "pax_getptxtflags: expected a path or an fd") < 0 ||
+	   get_path(argv[0], &path, "pax_getptxtflags: expected a path or an fd") < 0)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+#if defined(XTPAX) && !defined(PTPAX)
+	// XATTR_PAX is all there is to read, which needs no open file
+	bypath = path.fd < 0 && xtpath_flags(path.name, &xt_flags) == 0;
+#endif
+	fd = bypath ? -1 : path.fd >= 0 ? path.fd : nocache_open(path.name);
+	if(fd >= 0)
+	{
+#ifdef PTPAX
+		pt_flags = nocache_get_pt_flags(fd, &err);
+#endif
+#ifdef XTPAX
+		xt_flags = get_xt_flags(fd);
+#endif
+		if(path.fd < 0)
+			close(fd);
+	}
+	Py_END_ALLOW_THREADS
+
+	put_path(&path);
+
+	if(fd < 0 && !bypath)
+	{
+		PyErr_SetString(PaxError, "pax_getptxtflags: open() failed");
+		return NULL;
+	}
+
+	if(pt_flags == UINT16_MAX)
+	{
+		pt = Py_None;
+		Py_INCREF(pt);
+	}
+	else if((pt = flags_str(pt_flags)) == NULL)
+		return NULL;
+
+	if(xt_flags == UINT16_MAX)
+	{
+		xt = Py_None;
+		Py_INCREF(xt);
+	}
+	else if((xt = flags_str(xt_flags)) == NULL)
+	{
+		Py_DECREF(pt);
+		return NULL;
+	}
+
+	if((t = PyTuple_New(2)) == NULL)
+	{
+		Py_DECREF(pt);
+		Py_DECREF(xt);
+		return NULL;
+	}
+	PyTuple_SET_ITEM(t, 0, pt);
+	PyTuple_SET_ITEM(t, 1, xt);
+
+	return t;
+}
+
 uint16_t
 update_flags(uint16_t oflags, uint16_t flags)
 {
@@ -439,30 +923,47 @@ update_flags(uint16_t oflags, uint16_t flags)
 
 
 #ifdef PTPAX
-void
-set_pt_flags(int fd, uint16_t pt_flags)
+static int
+host_msb(void)
+{
+	const uint16_t one = 1;
+
+	return *(const unsigned char *)&one == 0;
+}
+
+
+int
+set_pt_flags(int fd, uint16_t pt_flags, const char **err)
 {
 	Elf *elf;
 	GElf_Phdr phdr;
 	size_t i, phnum;
+	char *ident;
 
 	if(elf_version(EV_CURRENT) == EV_NONE)
 	{
-		PyErr_SetString(PaxError, "set_pt_flags: library out of date");
-		return;
+		*err = "set_pt_flags: library out of date";
+		return -1;
 	}
 
 	if((elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL)) == NULL)
 	{
-		PyErr_SetString(PaxError, "set_pt_flags: elf_begin() failed");
-		return;
+		*err = "set_pt_flags: elf_begin() failed";
+		return -1;
 	}
 
 	if(elf_kind(elf) != ELF_K_ELF)
 	{
 		elf_end(elf);
-		PyErr_SetString(PaxError, "set_pt_flags: elf_kind() failed: this is not an elf file.");
-		return;
+		*err = "set_pt_flags: elf_kind() failed: this is not an elf file.";
+		return -1;
+	}
+
+	// libelf only writes back a converted copy of these through elf_update()
+	if((ident = elf_getident(elf, NULL)) != NULL && (ident[EI_DATA] == ELFDATA2MSB) != host_msb())
+	{
+		elf_end(elf);
+		return set_pt_flags_foreign(fd, pt_flags, err);
 	}
 
 	elf_getphdrnum(elf, &phnum);
@@ -472,8 +973,8 @@ set_pt_flags(int fd, uint16_t pt_flags)
 		if(gelf_getphdr(elf, i, &phdr) != &phdr)
 		{
 			elf_end(elf);
-			PyErr_SetString(PaxError, "set_pt_flags: gelf_getphdr() failed");
-			return;
+			*err = "set_pt_flags: gelf_getphdr() failed";
+			return -1;
 		}
 
 		if(phdr.p_type == PT_PAX_FLAGS)
@@ -483,92 +984,277 @@ set_pt_flags(int fd, uint16_t pt_flags)
 			if(!gelf_update_phdr(elf, i, &phdr))
 			{
 				elf_end(elf);
-				PyErr_SetString(PaxError, "set_pt_flags: gelf_update_phdr() failed");
-				return;
+				*err = "set_pt_flags: gelf_update_phdr() failed";
+				return -1;
 			}
 		}
 	}
 
 	elf_end(elf);
+
+	return 0;
 }
 #endif
 
 
 #ifdef XTPAX
-void
-set_xt_flags(int fd, uint16_t xt_flags)
+/* xflags is XATTR_CREATE where the caller found no XATTR_PAX and
+ * XATTR_REPLACE where it found one.  errno is kept.
+ */
+int
+set_xt_flags(int fd, uint16_t xt_flags, int xflags, const char **err)
 {
 	char buf[FLAGS_SIZE];
+	int e;
 
 	memset(buf, 0, FLAGS_SIZE);
 	bin2string(xt_flags, buf);
 
-	if( fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), 0))
+	if( fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), xflags))
 	{
-		PyErr_SetString(PaxError, "pax_deletextpax: fremovexattr() failed");
-		return;
+		e = errno;
+		xtcap_failed(fd, e);
+		errno = e;
+		*err = "set_xt_flags: fsetxattr() failed";
+		return -1;
 	}
 	else
-		return;
+		return 0;
 }
 #endif
 
 
-static PyObject *
-pax_setbinflags(PyObject *self, PyObject *args)
+/* Merge flags into what is on fd and only write back the markings which
+ * actually change.  Rewriting an identical value is not free: it dirties
+ * the inode, forces an overlayfs copy-up and breaks reflinks.  Return the
+ * number of markings written, or -1 with the reason in *err.
+ */
+static int
+update_file_flags(int fd, uint16_t flags, int rdwr_pt_pax, const char **err)
 {
-	const char *f_name;
-	int fd, iflags, rdwr_pt_pax = 1;
-	uint16_t oflags, nflags, flags;
-
-	if (!PyArg_ParseTuple(args, "si", &f_name, &iflags))
-	{
-		PyErr_SetString(PaxError, "pax_setbinflags: PyArg_ParseTuple failed");
-		return NULL;
-	}
-
-	if((fd = open(f_name, O_RDWR)) < 0)
-	{
-#ifdef PTPAX
-		rdwr_pt_pax = 0;
+	uint16_t oflags, nflags;
+	int changed = 0;
+#ifdef XTPAX
+	int pt_found = 0, tries, caps;
 #endif
-		if((fd = open(f_name, O_RDONLY)) < 0)
-		{
-			PyErr_SetString(PaxError, "pax_setbinflags: open() failed");
-			return NULL;
-		}
-	}
-
-	flags = (uint16_t) iflags;
 
 #ifdef PTPAX
 	if(rdwr_pt_pax)
 	{
-		oflags = get_pt_flags(fd);
-		if( oflags == UINT16_MAX )
-			oflags = PF_NOEMUTRAMP ;
-		nflags = update_flags( oflags, flags);
-		set_pt_flags(fd, nflags);
-        }
-#endif
+		oflags = get_pt_flags(fd, err);
+		if(*err)
+			return -1;
 
+		// No PT_PAX program header means there is nothing to write.
+		if( oflags != UINT16_MAX )
+		{
 #ifdef XTPAX
-	oflags = get_xt_flags(fd);
-	if( oflags == UINT16_MAX )
-		oflags = PF_NOEMUTRAMP ;
-	nflags = update_flags( oflags, flags);
-	set_xt_flags(fd, nflags);
+			pt_found = 1;
+#endif
+			nflags = update_flags( oflags, flags);
+			if( nflags != oflags )
+			{
+				if(set_pt_flags(fd, nflags, err) < 0)
+					return -1;
+				changed++;
+			}
+		}
+	}
 #endif
 
-	close(fd);
+#ifdef XTPAX
+	/* setflags_xtpath() and deletextpax() write XATTR_PAX by path without
+	 * the lock, so only create it where we found none and only replace it
+	 * where we found one.  If it came or went meanwhile, merge again.
+	 */
+	for(tries = 1; ; tries++)
+	{
+		oflags = get_xt_flags(fd);
+		caps = oflags == UINT16_MAX && errno == ENOTSUP ? 0 : xtcap(fd);
+		nflags = update_flags( oflags == UINT16_MAX ? PF_NOEMUTRAMP : oflags, flags);
+		if( oflags != UINT16_MAX && nflags == oflags )
+			break;
 
-	return Py_BuildValue("");
+		// Where XATTR_PAX cannot be read or written, PT_PAX alone will do
+		if(!(caps & XTCAP_SET))
+		{
+			if(pt_found)
+				return changed;
+			*err = "set_xt_flags: XATTR_PAX cannot be written on this filesystem";
+			return -1;
+		}
+		if(set_xt_flags(fd, nflags, oflags == UINT16_MAX ? XATTR_CREATE : XATTR_REPLACE, err) == 0)
+		{
+			changed++;
+			break;
+		}
+		if( (errno != EEXIST && errno != ENOATTR) || tries == XT_TRIES )
+			return -1;
+		*err = NULL;
+	}
+#endif
+
+	return changed;
+}
+
+
+/* Take an exclusive lock on fd for the read, merge and write of its
+ * markings, so several processes or threads marking the same file at
+ * once, eg. the pax.aio workers or parallel builds, do not lose updates.
+ * It is flock() rather than an OFD lock, which goes with the open file
+ * the same way, because it can be taken on a file opened O_RDONLY, as a
+ * running executable is.  Wait at most LOCK_WAIT ms, backing off, and
+ * return -1 if someone still has it by then.  Where the filesystem does
+ * not do locks we mark unlocked, as we always did.
+ */
+static int
+lock_file(int fd)
+{
+	struct timespec ts;
+	long backoff = LOCK_BACKOFF_MIN, waited = 0;
+
+	for(;;)
+	{
+		if(flock(fd, LOCK_EX | LOCK_NB) == 0)
+			return 0;
+		if(errno == EINTR)
+			continue;
+		if(errno != EWOULDBLOCK)
+			return 0;
+		if(waited >= LOCK_WAIT)
+			return -1;
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = backoff * 1000000;
+		nanosleep(&ts, NULL);
+		waited += backoff;
+		backoff *= 2;
+		if(backoff > LOCK_BACKOFF_MAX)
+			backoff = LOCK_BACKOFF_MAX;
+	}
+}
+
+
+static int
+setflags_file(const char *f_name, uint16_t flags, const char *open_err, const char **err)
+{
+	int fd, changed, rdwr_pt_pax = 1;
+
+#if defined(XTPAX) && !defined(PTPAX)
+	if((changed = setflags_xtpath(f_name, flags)) >= 0)
+		return changed;
+#endif
+
+	if((fd = sysroot_open(f_name, O_RDWR)) < 0)
+	{
+#ifdef PTPAX
+		rdwr_pt_pax = 0;
+#endif
+		if((fd = sysroot_open(f_name, O_RDONLY)) < 0)
+		{
+			*err = open_err;
+			return -1;
+		}
+	}
+
+	if(lock_file(fd) < 0)
+	{
+		close(fd);
+		*err = "setflags_file: timed out waiting for the lock on the file";
+		return -1;
+	}
+
+	changed = update_file_flags(fd, flags, rdwr_pt_pax, err);
+
+	close(fd);
+
+	return changed;
+}
+
+
+/* As setflags_file() on an fd the caller keeps open, so the lock is let
+ * go of here.  PT_PAX is only written if fd is open for writing.
+ */
+static int
+setflags_fd(int fd, uint16_t flags, const char **err)
+{
+	int changed, rdwr_pt_pax;
+
+	rdwr_pt_pax = (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+
+	if(lock_file(fd) < 0)
+	{
+		*err = "setflags_fd: timed out waiting for the lock on the file";
+		return -1;
+	}
+
+	changed = update_file_flags(fd, flags, rdwr_pt_pax, err);
+
+	flock(fd, LOCK_UN);
+
+	return changed;
+}
+
+
+static PyObject *
+setflags_path(PyObject *o, uint16_t flags, const char *arg_err, const char *open_err)
+{
+	struct pax_path path;
+	const char *err = NULL;
+	int changed;
+
+	if(get_path(o, &path, arg_err) < 0)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	if(path.fd >= 0)
+		changed = setflags_fd(path.fd, flags, &err);
+	else
+		changed = setflags_file(path.name, flags, open_err, &err);
+	Py_END_ALLOW_THREADS
+
+	put_path(&path);
+
+	if(changed < 0)
+	{
+		PyErr_SetString(PaxError, err);
+		return NULL;
+	}
+
+	return PAX_INT(changed);
+}
+
+
+static PyObject *
+pax_setbinflags(PyObject *self, PAX_ARGS)
+{
+	PyObject *argv[2];
+	long iflags;
+
+	if(get_args(PAX_PASS, 2, argv, "pax_setbinflags: expected a path or an fd and the flags") < 0)
+		return NULL;
+
+#if PY_MAJOR_VERSION >= 3
+	iflags = PyLong_AsLong(argv[1]);
+#else
+	iflags = PyInt_AsLong(argv[1]);
+#endif
+	if(iflags == -1 && PyErr_Occurred())
+	{
+		PyErr_Clear();
+		PyErr_SetString(PaxError, "pax_setbinflags: expected a path or an fd and the flags");
+		return NULL;
+	}
+
+	return setflags_path(argv[0], (uint16_t) iflags,
+		"pax_setbinflags: expected a path or an fd and the flags",
+		"pax_setbinflags: open() failed");
 }
 
 
 //This logic is like parse_cmd_args() in paxctl-ng.c
 uint16_t
-parse_sflags(char *sflags)
+parse_sflags(const char *sflags)
 {
 	int i;
 	uint16_t flags = 0;
@@ -615,86 +1301,3159 @@ parse_sflags(char *sflags)
 
 
 static PyObject *
-pax_setstrflags(PyObject *self, PyObject *args)
+pax_setstrflags(PyObject *self, PAX_ARGS)
 {
-	char *f_name, *sflags;
-	int fd, rdwr_pt_pax = 1;
-	uint16_t oflags, nflags, flags;
+	PyObject *argv[2];
+	const char *sflags;
 
-	if (!PyArg_ParseTuple(args, "ss", &f_name, &sflags))
-	{
-		PyErr_SetString(PaxError, "pax_setstrflags: PyArg_ParseTuple failed");
+	if(get_args(PAX_PASS, 2, argv, "pax_setstrflags: expected a path or an fd and the flags") < 0 ||
+	   (sflags = get_str(argv[1], "pax_setstrflags: expected a path or an fd and the flags")) == NULL)
 		return NULL;
+
+	return setflags_path(argv[0], parse_sflags(sflags),
+		"pax_setstrflags: expected a path or an fd and the flags",
+		"pax_setstrflags: open() failed");
+}
+
+
+/* The buffer engine reads and patches PT_PAX in an ELF image which is
+ * already in memory, anything exporting a contiguous buffer like bytes,
+ * bytearray, mmap or a memoryview of them, so no temporary file is needed.
+ * It works on the raw bytes rather than through libelf, handles both ELF
+ * classes and both byte orders, and only looks at the image up to the end
+ * of the program headers, so the buffer may be just the head of the file.
+ * Nothing is copied and the interpreter is not touched, so the image
+ * could as well come from a worker thread.
+ */
+
+static uint64_t
+elf_get(const unsigned char *p, int size, int msb)
+{
+	uint64_t v = 0;
+	int i;
+
+	for(i = 0; i < size; i++)
+		if(msb)
+			v = (v << 8) | p[i];
+		else
+			v |= (uint64_t)p[i] << (8 * i);
+
+	return v;
+}
+
+
+static void
+elf_put(unsigned char *p, int size, uint64_t v, int msb)
+{
+	int i;
+
+	for(i = 0; i < size; i++)
+		if(msb)
+			p[size - 1 - i] = (v >> (8 * i)) & 0xff;
+		else
+			p[i] = (v >> (8 * i)) & 0xff;
+}
+
+
+struct elf_layout
+{
+	int msb;
+	uint64_t phoff;
+	size_t ehsize, phoff_off, phoff_size;
+	size_t phentsize, phnum, type_off, flags_off;
+};
+
+
+// Read where the phdrs are from the ELF header in image, -1 if not an ELF
+static int
+elf_layout(const unsigned char *image, size_t len, struct elf_layout *l)
+{
+	if(len < EI_NIDENT || memcmp(image, ELFMAG, SELFMAG))
+		return -1;
+
+	if(image[EI_DATA] != ELFDATA2LSB && image[EI_DATA] != ELFDATA2MSB)
+		return -1;
+	l->msb = image[EI_DATA] == ELFDATA2MSB;
+
+	if(image[EI_CLASS] == ELFCLASS32 && len >= sizeof(Elf32_Ehdr))
+	{
+		l->phoff = elf_get(image + offsetof(Elf32_Ehdr, e_phoff), 4, l->msb);
+		l->phentsize = elf_get(image + offsetof(Elf32_Ehdr, e_phentsize), 2, l->msb);
+		l->phnum = elf_get(image + offsetof(Elf32_Ehdr, e_phnum), 2, l->msb);
+		if(l->phnum && l->phentsize < sizeof(Elf32_Phdr))
+			return -1;
+		l->ehsize = sizeof(Elf32_Ehdr);
+		l->phoff_off = offsetof(Elf32_Ehdr, e_phoff);
+		l->phoff_size = 4;
+		l->type_off = offsetof(Elf32_Phdr, p_type);
+		l->flags_off = offsetof(Elf32_Phdr, p_flags);
+	}
+	else if(image[EI_CLASS] == ELFCLASS64 && len >= sizeof(Elf64_Ehdr))
+	{
+		l->phoff = elf_get(image + offsetof(Elf64_Ehdr, e_phoff), 8, l->msb);
+		l->phentsize = elf_get(image + offsetof(Elf64_Ehdr, e_phentsize), 2, l->msb);
+		l->phnum = elf_get(image + offsetof(Elf64_Ehdr, e_phnum), 2, l->msb);
+		if(l->phnum && l->phentsize < sizeof(Elf64_Phdr))
+			return -1;
+		l->ehsize = sizeof(Elf64_Ehdr);
+		l->phoff_off = offsetof(Elf64_Ehdr, e_phoff);
+		l->phoff_size = 8;
+		l->type_off = offsetof(Elf64_Phdr, p_type);
+		l->flags_off = offsetof(Elf64_Phdr, p_flags);
 	}
+	else
+		return -1;
 
-	if((fd = open(f_name, O_RDWR)) < 0)
+	// With PN_XNUM the real count lives in section 0, we don't go there.
+	if(l->phnum == PN_XNUM)
+		return -1;
+
+	return 0;
+}
+
+
+/* Return the offsets of the p_flags of the PT_PAX_FLAGS phdrs in image,
+ * up to max of them, and how many there are.  -1 if image is not an ELF
+ * or its phdrs are not all in it.
+ */
+static int
+pt_flags_offsets(const unsigned char *image, size_t len, size_t *offs, int max, int *msb)
+{
+	struct elf_layout l;
+	size_t i;
+	const unsigned char *phdr;
+	int n = 0;
+
+	if(elf_layout(image, len, &l))
+		return -1;
+	*msb = l.msb;
+
+	if(l.phoff > len || l.phnum * l.phentsize > len - l.phoff)
+		return -1;
+
+	for(i = 0; i < l.phnum; i++)
 	{
-#ifdef PTPAX
-		rdwr_pt_pax = 0;
-#endif
-		if((fd = open(f_name, O_RDONLY)) < 0)
-		{
-			PyErr_SetString(PaxError, "pax_setstrflags: open() failed");
-			return NULL;
-		}
+		phdr = image + l.phoff + i * l.phentsize;
+		if(elf_get(phdr + l.type_off, 4, l.msb) == PT_PAX_FLAGS && n < max)
+			offs[n++] = phdr + l.flags_off - image;
 	}
 
-	flags = parse_sflags(sflags);
+	return n;
+}
+
+
+#define PT_PAX_PHDRS_MAX	8
+#define ELF_PHDRS_MAX		(0xffff * 56)	/* bytes, PN_XNUM Elf64_Phdrs, more is bogus */
 
 #ifdef PTPAX
-	if(rdwr_pt_pax)
+/* Write pt_flags to the PT_PAX_FLAGS phdrs of an ELF whose byte order is
+ * not the host's, four bytes each, for which set_pt_flags() cannot use
+ * libelf.
+ */
+static int
+set_pt_flags_foreign(int fd, uint16_t pt_flags, const char **err)
+{
+	unsigned char ehdr[sizeof(Elf64_Ehdr)], *image, word[4];
+	size_t offs[PT_PAX_PHDRS_MAX], phsize;
+	struct elf_layout l;
+	ssize_t len;
+	int i, n, msb;
+
+	if((len = pread(fd, ehdr, sizeof(ehdr), 0)) <= 0 || elf_layout(ehdr, len, &l)
+			|| (phsize = l.phnum * l.phentsize) > ELF_PHDRS_MAX)
+	{
+		*err = "set_pt_flags: cannot read the ELF header";
+		return -1;
+	}
+
+	if((image = malloc(l.ehsize + phsize)) == NULL)
+	{
+		*err = "set_pt_flags: malloc() failed";
+		return -1;
+	}
+
+	// Only the phdrs are read, after a copy of the ELF header pointing to them
+	memcpy(image, ehdr, l.ehsize);
+	elf_put(image + l.phoff_off, l.phoff_size, l.ehsize, l.msb);
+
+	if(pread(fd, image + l.ehsize, phsize, l.phoff) != (ssize_t)phsize
+			|| (n = pt_flags_offsets(image, l.ehsize + phsize, offs, PT_PAX_PHDRS_MAX, &msb)) < 0)
 	{
-		oflags = get_pt_flags(fd);
-		if( oflags == UINT16_MAX )
-			oflags = PF_NOEMUTRAMP ;
-		nflags = update_flags( oflags, flags);
-		set_pt_flags(fd, nflags);
+		free(image);
+		*err = "set_pt_flags: cannot read the program headers";
+		return -1;
 	}
+	free(image);
+
+	elf_put(word, 4, pt_flags, msb);
+	for(i = 0; i < n; i++)
+		if(pwrite(fd, word, sizeof(word), offs[i] - l.ehsize + l.phoff) != sizeof(word))
+		{
+			*err = "set_pt_flags: pwrite() failed";
+			return -1;
+		}
+
+	return 0;
+}
 #endif
 
-#ifdef XTPAX
-	oflags = get_xt_flags(fd);
-	if( oflags == UINT16_MAX )
-		oflags = PF_NOEMUTRAMP ;
-	nflags = update_flags( oflags, flags);
-	set_xt_flags(fd, nflags);
+static PyObject *
+pax_getflags_from_buffer(PyObject *self, PyObject *args)
+{
+	Py_buffer view;
+	size_t offs[PT_PAX_PHDRS_MAX];
+	int n, msb;
+	uint16_t flags;
+
+#if PY_MAJOR_VERSION >= 3
+	if (!PyArg_ParseTuple(args, "y*", &view))
+#else
+	if (!PyArg_ParseTuple(args, "s*", &view))
 #endif
+	{
+		PyErr_SetString(PaxError, "pax_getflags_from_buffer: PyArg_ParseTuple failed");
+		return NULL;
+	}
 
-	close(fd);
+	n = pt_flags_offsets(view.buf, view.len, offs, PT_PAX_PHDRS_MAX, &msb);
+	if(n > 0)
+		// Like get_pt_flags(), the last PT_PAX_FLAGS phdr wins
+		flags = elf_get((unsigned char *)view.buf + offs[n - 1], 4, msb);
+	PyBuffer_Release(&view);
 
-	return Py_BuildValue("");
+	if(n < 0)
+	{
+		PyErr_SetString(PaxError, "pax_getflags_from_buffer: not an ELF image or truncated");
+		return NULL;
+	}
+	if(n == 0)
+	{
+		PyErr_SetString(PaxError, "pax_getflags_from_buffer: no PAX flags found");
+		return NULL;
+	}
+
+	return flags_result(flags);
 }
 
 
-#ifdef XTPAX
+/* Merge flags into the PT_PAX markings in the buffer in place, only
+ * writing if they change, and return 1 if they did.
+ */
 static PyObject *
-pax_deletextpax(PyObject *self, PyObject *args)
+setflags_in_buffer(Py_buffer *view, uint16_t flags, const char *name)
 {
-	const char *f_name;
-	int fd;
+	char err[128];
+	size_t offs[PT_PAX_PHDRS_MAX];
+	int i, n, msb, changed = 0;
+	uint16_t oflags, nflags;
 
-	if(!PyArg_ParseTuple(args, "s", &f_name))
+	n = pt_flags_offsets(view->buf, view->len, offs, PT_PAX_PHDRS_MAX, &msb);
+	if(n > 0)
 	{
-		PyErr_SetString(PaxError, "pax_deletextpax: PyArg_ParseTuple failed");
-		return NULL;
+		oflags = elf_get((unsigned char *)view->buf + offs[n - 1], 4, msb);
+		nflags = update_flags(oflags, flags);
+		if(nflags != oflags)
+		{
+			for(i = 0; i < n; i++)
+				elf_put((unsigned char *)view->buf + offs[i], 4, nflags, msb);
+			changed = 1;
+		}
 	}
+	PyBuffer_Release(view);
 
-	if((fd = open(f_name, O_RDONLY)) < 0)
+	if(n <= 0)
 	{
-		PyErr_SetString(PaxError, "pax_deletextpax: open() failed");
+		snprintf(err, sizeof(err), "%s: %s", name,
+			n < 0 ? "not an ELF image or truncated" : "no PAX flags found");
+		PyErr_SetString(PaxError, err);
 		return NULL;
 	}
 
-	if( !fremovexattr(fd, PAX_NAMESPACE) )
+	return Py_BuildValue("i", changed);
+}
+
+
+static PyObject *
+pax_setbinflags_in_buffer(PyObject *self, PyObject *args)
+{
+	Py_buffer view;
+	int iflags;
+
+	if (!PyArg_ParseTuple(args, "w*i", &view, &iflags))
 	{
-		close(fd);
-		return Py_BuildValue("");
+		PyErr_SetString(PaxError, "pax_setbinflags_in_buffer: PyArg_ParseTuple failed");
+		return NULL;
 	}
-	else
+
+	return setflags_in_buffer(&view, (uint16_t) iflags, "pax_setbinflags_in_buffer");
+}
+
+
+static PyObject *
+pax_setstrflags_in_buffer(PyObject *self, PyObject *args)
+{
+	Py_buffer view;
+	char *sflags;
+
+	if (!PyArg_ParseTuple(args, "w*s", &view, &sflags))
 	{
-		close(fd);
-		PyErr_SetString(PaxError, "pax_deletextpax: fremovexattr() failed");
+		PyErr_SetString(PaxError, "pax_setstrflags_in_buffer: PyArg_ParseTuple failed");
 		return NULL;
 	}
+
+	return setflags_in_buffer(&view, parse_sflags(sflags), "pax_setstrflags_in_buffer");
+}
+
+
+#ifdef XTPAX
+/* As paxctl-ng does, remember the filesystems on which a write of XATTR_PAX
+ * failed with ENOTSUP, and after that setbinflags() and friends leave it
+ * out there rather than repeat the failing write for every file of a
+ * sweep, and mark PT_PAX alone where there is one.  Where user.* xattrs
+ * cannot even be read, the fgetxattr() made anyway says so for each file,
+ * at no more cost than looking it up.  Until some write has failed so,
+ * no fstat() is made for st_dev.  Whether a mount is read-only is not
+ * kept, since a bind mount shares st_dev and a remount changes it under a
+ * long lived user such as revdep-pax --serve.  The workers of pax.aio
+ * share it.
+ */
+
+#define XTCAP_DEVS_MAX		64		/* filesystems after these are not remembered */
+
+static struct
+{
+	dev_t devs[XTCAP_DEVS_MAX];
+	size_t ndevs;			/* written under lock, read without it too */
+	pthread_mutex_t lock;
+} xtcap_state = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+// Whether dev is one XATTR_PAX cannot be written on
+static int
+xtcap_find(dev_t dev)
+{
+	size_t i;
+
+	for(i = 0; i < xtcap_state.ndevs; i++)
+		if(xtcap_state.devs[i] == dev)
+			return 1;
+
+	return 0;
+}
+
+
+static int
+xtcap(int fd)
+{
+	struct stat st;
+	int found;
+
+	if(__atomic_load_n(&xtcap_state.ndevs, __ATOMIC_RELAXED) == 0)
+		return XTCAP_SET;
+
+	// If we cannot tell, try as we always did
+	if(fstat(fd, &st) < 0)
+		return XTCAP_SET;
+
+	pthread_mutex_lock(&xtcap_state.lock);
+	found = xtcap_find(st.st_dev);
+	pthread_mutex_unlock(&xtcap_state.lock);
+
+	return found ? 0 : XTCAP_SET;
+}
+
+
+// A write of XATTR_PAX to fd failed with err
+static void
+xtcap_failed(int fd, int err)
+{
+	struct stat st;
+
+	// Only what holds for the whole filesystem, not eg. EPERM on one file
+	// or EROFS on one mount of it
+	if(err != ENOTSUP || fstat(fd, &st) < 0)
+		return;
+
+	pthread_mutex_lock(&xtcap_state.lock);
+	if(!xtcap_find(st.st_dev) && xtcap_state.ndevs < XTCAP_DEVS_MAX)
+	{
+		xtcap_state.devs[xtcap_state.ndevs] = st.st_dev;
+		__atomic_store_n(&xtcap_state.ndevs, xtcap_state.ndevs + 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&xtcap_state.lock);
+}
+#endif
+
+
+/* With setnocache(True), getflags() and getptxtflags() read the markings
+ * the way paxctl-ng --nocache does: the file is opened with O_NOATIME if
+ * we may, without readahead, only the ELF header and the phdrs are read
+ * and the pages this brings into the page cache are dropped again, so a
+ * sweep over the whole system leaves the cache as it found it.  Pages
+ * which were already there, as cachestat(2) or mincore(2) tell, are left
+ * alone.  It is a switch for the whole process, pax.aio included.
+ */
+
+#define NOCACHE_EHDR_SIZE	64		/* sizeof(Elf64_Ehdr), the larger one */
+#define NOCACHE_PAGES_MAX	64		/* phdrs spanning more are read but not dropped */
+
+static int nocache;
+
+#ifdef SYS_cachestat
+struct nocache_cachestat_range
+{
+	uint64_t off;
+	uint64_t len;
+};
+
+struct nocache_cachestat
+{
+	uint64_t nr_cache;
+	uint64_t nr_dirty;
+	uint64_t nr_writeback;
+	uint64_t nr_evicted;
+	uint64_t nr_recently_evicted;
+};
+
+// Set once the kernel turns out not to have cachestat(), by any thread,
+// so it is only ever read and written with __atomic_*()
+static int no_cachestat;
+#endif
+
+
+static int
+nocache_open(const char *f_name)
+{
+	int fd;
+
+	if(!nocache)
+		return sysroot_open(f_name, O_RDONLY);
+
+	// O_NOATIME is only for the owner or CAP_FOWNER
+	if((fd = sysroot_open(f_name, O_RDONLY | O_NOATIME)) < 0 && errno == EPERM)
+		fd = sysroot_open(f_name, O_RDONLY);
+
+	if(fd >= 0)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+	return fd;
 }
+
+
+// Set resident[i] if page first + i of fd is in the page cache, -1 if we cannot tell
+static int
+pages_resident(int fd, off_t first, size_t n, size_t page, unsigned char *resident)
+{
+	void *addr;
+	size_t i;
+	int ret;
+
+#ifdef SYS_cachestat
+	struct nocache_cachestat_range r;
+	struct nocache_cachestat cs;
+
+	for(i = 0; i < n && !__atomic_load_n(&no_cachestat, __ATOMIC_RELAXED); i++)
+	{
+		r.off = (first + i) * page;
+		r.len = page;
+		if(syscall(SYS_cachestat, fd, &r, &cs, 0) < 0)
+		{
+			if(errno == ENOSYS)
+				__atomic_store_n(&no_cachestat, 1, __ATOMIC_RELAXED);
+			else
+				return -1;
+		}
+		else
+			resident[i] = cs.nr_cache > 0;
+	}
+
+	if(!__atomic_load_n(&no_cachestat, __ATOMIC_RELAXED))
+		return 0;
 #endif
+
+	// Mapping the file does not fault anything in, mincore() only looks
+	if((addr = mmap(NULL, n * page, PROT_READ, MAP_SHARED, fd, first * page)) == MAP_FAILED)
+		return -1;
+
+	ret = mincore(addr, n * page, resident);
+	munmap(addr, n * page);
+	if(ret < 0)
+		return -1;
+
+	for(i = 0; i < n; i++)
+		resident[i] &= 1;
+
+	return 0;
+}
+
+
+// pread() and then drop the pages which were not in the page cache before
+static ssize_t
+pread_nocache(int fd, void *buf, size_t len, off_t off)
+{
+	unsigned char resident[NOCACHE_PAGES_MAX];
+	size_t page, n, i;
+	off_t first;
+	ssize_t ret;
+	int known;
+
+	page = sysconf(_SC_PAGESIZE);
+	first = off / page;
+	n = (off + len + page - 1) / page - first;
+
+	known = n <= NOCACHE_PAGES_MAX && pages_resident(fd, first, n, page, resident) == 0;
+
+	ret = pread(fd, buf, len, off);
+
+	if(known)
+		for(i = 0; i < n; i++)
+			if(!resident[i])
+				posix_fadvise(fd, (first + i) * page, page, POSIX_FADV_DONTNEED);
+
+	return ret;
+}
+
+
+/* Read the ELF header and the phdrs of fd, size bytes long, into ehdr,
+ * which has room for NOCACHE_EHDR_SIZE, if they fit there as they are in
+ * the file.  Else into a buffer malloc()ed for just the two, the phdrs
+ * right after the header which is patched to point to them there, so
+ * whatever lies between them in the file is neither read nor buffered.
+ * Return what holds them and its length in *len, or NULL with *err set.
+ */
+static unsigned char *
+read_elf_headers(int fd, off_t size, unsigned char *ehdr, size_t *len, const char **err)
+{
+	unsigned char *image;
+	struct elf_layout l;
+	size_t phsize;
+	ssize_t n;
+
+	if((n = pread_nocache(fd, ehdr, NOCACHE_EHDR_SIZE, 0)) < 0)
+	{
+		*err = "get_pt_flags: pread() failed";
+		return NULL;
+	}
+
+	*len = n;
+	if(elf_layout(ehdr, *len, &l) || (phsize = l.phnum * l.phentsize) > ELF_PHDRS_MAX
+			|| l.phoff > (uint64_t)size || phsize > (uint64_t)size - l.phoff)
+	{
+		*err = "get_pt_flags: this is not an elf file.";
+		return NULL;
+	}
+
+	if(l.phoff + phsize <= *len)
+		return ehdr;
+
+	if((image = malloc(l.ehsize + phsize)) == NULL)
+	{
+		*err = "get_pt_flags: malloc() failed";
+		return NULL;
+	}
+	memcpy(image, ehdr, l.ehsize);
+	elf_put(image + l.phoff_off, l.phoff_size, l.ehsize, l.msb);
+
+	if(pread_nocache(fd, image + l.ehsize, phsize, l.phoff) != (ssize_t)phsize)
+	{
+		free(image);
+		*err = "get_pt_flags: pread() failed";
+		return NULL;
+	}
+
+	*len = l.ehsize + phsize;
+	return image;
+}
+
+
+#ifdef PTPAX
+// The flags of the last PT_PAX_FLAGS phdr in image, as get_pt_flags() takes them
+static uint16_t
+pt_flags_mem(const unsigned char *image, size_t len)
+{
+	size_t offs[PT_PAX_PHDRS_MAX];
+	int k, msb;
+
+	if((k = pt_flags_offsets(image, len, offs, PT_PAX_PHDRS_MAX, &msb)) > 0)
+		return elf_get(image + offs[k - 1], 4, msb);
+
+	return UINT16_MAX;
+}
+
+
+static uint16_t
+nocache_get_pt_flags(int fd, const char **err)
+{
+	unsigned char ehdr[NOCACHE_EHDR_SIZE];
+	unsigned char *image;
+	struct stat st;
+	size_t len;
+	uint16_t pt_flags;
+
+	if(!nocache)
+		return get_pt_flags(fd, err);
+
+	if(fstat(fd, &st) < 0)
+	{
+		*err = "get_pt_flags: pread() failed";
+		return UINT16_MAX;
+	}
+
+	if((image = read_elf_headers(fd, st.st_size, ehdr, &len, err)) == NULL)
+		return UINT16_MAX;
+
+	pt_flags = pt_flags_mem(image, len);
+
+	if(image != ehdr)
+		free(image);
+
+	return pt_flags;
+}
+#endif
+
+
+/* setnocache(on)
+ *
+ * Turn the page cache neutral reads of getflags() and getptxtflags() on
+ * or off, and return whether they were on.
+ */
+static PyObject *
+pax_setnocache(PyObject *self, PyObject *args)
+{
+	int on, was;
+
+	if (!PyArg_ParseTuple(args, "i", &on))
+	{
+		PyErr_SetString(PaxError, "pax_setnocache: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	was = nocache;
+	nocache = on != 0;
+
+	return PyBool_FromLong(was);
+}
+
+
+/* With setsysroot(DIR), every path handed to the module, the vdb of
+ * needed() included, is taken as a path inside DIR and resolved as from
+ * a chroot into it, as paxctl-ng --sysroot does.  Absolute symlinks and
+ * ".." stop at DIR, so an image can be marked from the build host without
+ * anything in it reaching the host.  openat2(2) does it with
+ * RESOLVE_IN_ROOT, older kernels get a walk of the path here with
+ * O_NOFOLLOW.  It is a switch for the whole process, pax.aio included,
+ * so set it before starting any work.
+ */
+
+#define SYSROOT_LINKS_MAX	40		/* as the kernel's MAXSYMLINKS */
+#define SYSROOT_DEPTH_MAX	(PATH_MAX / 2)
+
+static int sysroot_fd = -1;
+static PyObject *sysroot_dir;
+
+#ifdef SYS_openat2
+#define SYSROOT_RESOLVE_NO_MAGICLINKS	0x02
+#define SYSROOT_RESOLVE_IN_ROOT		0x10
+
+struct sysroot_open_how
+{
+	uint64_t flags;
+	uint64_t mode;
+	uint64_t resolve;
+};
+
+// Set once the kernel turns out not to have openat2(), by any thread, so it
+// is only ever read and written with __atomic_*()
+static int no_openat2;
+#endif
+
+
+// Open path below sysroot_fd as a chroot into it would, without openat2()
+static int
+walk_in_root(const char *path, int flags)
+{
+	int dirs[SYSROOT_DEPTH_MAX];
+	char buf[PATH_MAX], target[PATH_MAX];
+	char *name, *rest;
+	int depth = 0, links = 0, fd, saved;
+	ssize_t n;
+
+	if(strlen(path) >= sizeof(buf))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(buf, path);
+
+	dirs[0] = sysroot_fd;
+	rest = buf;
+	fd = -1;
+
+	for(;;)
+	{
+		while(*rest == '/')
+			rest++;
+		if(*rest == 0)
+		{
+			fd = openat(dirs[depth], ".", flags);
+			break;
+		}
+
+		name = rest;
+		rest += strcspn(rest, "/");
+		if(*rest)
+			*rest++ = 0;
+		while(*rest == '/')
+			rest++;
+
+		if(!strcmp(name, "."))
+			continue;
+
+		// dirs has an fd for every directory walked into, ".." never goes above dirs[0]
+		if(!strcmp(name, ".."))
+		{
+			if(depth > 0)
+				close(dirs[depth--]);
+			continue;
+		}
+
+		if((n = readlinkat(dirs[depth], name, target, sizeof(target))) >= 0)
+		{
+			if(++links > SYSROOT_LINKS_MAX)
+			{
+				errno = ELOOP;
+				break;
+			}
+			if((size_t)n == sizeof(target) || (size_t)n + 1 + strlen(rest) >= sizeof(buf))
+			{
+				errno = ENAMETOOLONG;
+				break;
+			}
+
+			// The target goes in front of what is left of the path
+			memmove(buf + n + 1, rest, strlen(rest) + 1);
+			memcpy(buf, target, n);
+			buf[n] = '/';
+			rest = buf;
+
+			if(target[0] == '/')
+				while(depth > 0)
+					close(dirs[depth--]);
+			continue;
+		}
+		else if(errno != EINVAL)
+			break;
+
+		if(*rest == 0)
+		{
+			fd = openat(dirs[depth], name, flags | O_NOFOLLOW);
+			break;
+		}
+
+		if(depth + 1 >= SYSROOT_DEPTH_MAX)
+		{
+			errno = ENAMETOOLONG;
+			break;
+		}
+
+		if((dirs[depth + 1] = openat(dirs[depth], name, O_PATH | O_DIRECTORY | O_NOFOLLOW)) < 0)
+			break;
+		depth++;
+	}
+
+	saved = errno;
+	while(depth > 0)
+		close(dirs[depth--]);
+	errno = saved;
+
+	return fd;
+}
+
+
+static int
+sysroot_open(const char *path, int flags)
+{
+	if(sysroot_fd < 0)
+		return open(path, flags);
+
+#ifdef SYS_openat2
+	if(!__atomic_load_n(&no_openat2, __ATOMIC_RELAXED))
+	{
+		struct sysroot_open_how how;
+		int fd;
+
+		memset(&how, 0, sizeof(how));
+		how.flags = flags;
+		how.resolve = SYSROOT_RESOLVE_IN_ROOT | SYSROOT_RESOLVE_NO_MAGICLINKS;
+
+		if((fd = syscall(SYS_openat2, sysroot_fd, path, &how, sizeof(how))) >= 0 || errno != ENOSYS)
+			return fd;
+
+		// Older kernels, walk the path ourselves
+		__atomic_store_n(&no_openat2, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	return walk_in_root(path, flags);
+}
+
+
+/* setsysroot(dir)
+ *
+ * Resolve the paths inside dir from now on, or as they are with None,
+ * and return the root there was before, None if there was none.
+ */
+static PyObject *
+pax_setsysroot(PyObject *self, PyObject *args)
+{
+	const char *dir;
+	PyObject *was;
+	int fd = -1;
+
+	if (!PyArg_ParseTuple(args, "z", &dir))
+	{
+		PyErr_SetString(PaxError, "pax_setsysroot: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	if(dir && (fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+	{
+		PyErr_SetString(PaxError, "pax_setsysroot: open() failed");
+		return NULL;
+	}
+
+	if(sysroot_fd >= 0)
+		close(sysroot_fd);
+	sysroot_fd = fd;
+
+	was = sysroot_dir ? sysroot_dir : Py_BuildValue("");
+	sysroot_dir = dir ? Py_BuildValue("s", dir) : NULL;
+
+	return was;
+}
+
+
+#ifdef XTPAX
+/* As paxctl-ng does, get at XATTR_PAX by path where no open file is
+ * needed for anything else, which on NFS or FUSE saves the round trips
+ * of an open() and a close():
+ *
+ *	deletextpax()			always
+ *	getflags(), getptxtflags()	without PT_PAX, ie. in an XTPAX only build
+ *	setbinflags(), setstrflags()	the same, if the flags are there already
+ *					or there is no XATTR_PAX yet to merge into
+ *
+ * getxattrat() and friends are used where the kernel has them, else
+ * getxattr() and friends, which follow symlinks as open() does.  Anything
+ * unexpected, or a root from setsysroot(), goes through the fd as before.
+ */
+
+// Older headers lack them, the numbers are the same on every arch but alpha
+#if !defined(SYS_getxattrat) && !defined(__alpha__)
+#define SYS_setxattrat		463
+#define SYS_getxattrat		464
+#define SYS_removexattrat	466
+#endif
+
+#ifdef SYS_getxattrat
+struct xtpath_xattr_args
+{
+	uint64_t value;
+	uint32_t size;
+	uint32_t flags;
+};
+
+// Set once the kernel turns out not to have them, by any thread, so it
+// is only ever read and written with __atomic_*()
+static int no_xattrat;
+#endif
+
+
+/* Remove XATTR_PAX from path, 1 if it was there, 0 if there is none or
+ * there are no user.* xattrs, else -1.
+ */
+static int
+xtpath_remove(const char *path)
+{
+	int ret = -1;
+
+	if(sysroot_fd >= 0)
+		return -1;
+
+#ifdef SYS_getxattrat
+	if(!__atomic_load_n(&no_xattrat, __ATOMIC_RELAXED))
+	{
+		if((ret = syscall(SYS_removexattrat, AT_FDCWD, path, 0, PAX_NAMESPACE)) < 0 && errno == ENOSYS)
+			__atomic_store_n(&no_xattrat, 1, __ATOMIC_RELAXED);
+	}
+	if(__atomic_load_n(&no_xattrat, __ATOMIC_RELAXED))
+#endif
+		ret = removexattr(path, PAX_NAMESPACE);
+
+	if(ret == 0)
+		return 1;
+
+	return errno == ENOATTR || errno == ENOTSUP ? 0 : -1;
+}
+
+
+#ifndef PTPAX
+static ssize_t
+xtpath_get(const char *path, char *buf, size_t size)
+{
+#ifdef SYS_getxattrat
+	struct xtpath_xattr_args args;
+	ssize_t n;
+
+	if(!__atomic_load_n(&no_xattrat, __ATOMIC_RELAXED))
+	{
+		args.value = (uintptr_t)buf;
+		args.size = size;
+		args.flags = 0;
+
+		if((n = syscall(SYS_getxattrat, AT_FDCWD, path, 0, PAX_NAMESPACE, &args, sizeof(args))) >= 0
+				|| errno != ENOSYS)
+			return n;
+
+		// Older kernels
+		__atomic_store_n(&no_xattrat, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	return getxattr(path, PAX_NAMESPACE, buf, size);
+}
+
+
+static int
+xtpath_set(const char *path, const char *buf, size_t size, int flags)
+{
+#ifdef SYS_getxattrat
+	struct xtpath_xattr_args args;
+	int ret;
+
+	if(!__atomic_load_n(&no_xattrat, __ATOMIC_RELAXED))
+	{
+		args.value = (uintptr_t)buf;
+		args.size = size;
+		args.flags = flags;
+
+		if((ret = syscall(SYS_setxattrat, AT_FDCWD, path, 0, PAX_NAMESPACE, &args, sizeof(args))) == 0
+				|| errno != ENOSYS)
+			return ret;
+
+		__atomic_store_n(&no_xattrat, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	return setxattr(path, PAX_NAMESPACE, buf, size, flags);
+}
+
+
+/* Read the XATTR_PAX of path into *flags, UINT16_MAX if there is none or
+ * there are no user.* xattrs.  Return 0, or -1 if the fd has to tell.
+ */
+static int
+xtpath_flags(const char *path, uint16_t *flags)
+{
+	char buf[FLAGS_SIZE];
+
+	if(sysroot_fd >= 0)
+		return -1;
+
+	memset(buf, 0, FLAGS_SIZE);
+	if(xtpath_get(path, buf, FLAGS_SIZE - 1) >= 0)
+		*flags = string2bin(buf);
+	else if(errno == ENOATTR || errno == ENOTSUP)
+		*flags = UINT16_MAX;
+	else
+		return -1;
+
+	return 0;
+}
+
+
+/* As update_file_flags() by path, return the number of markings written,
+ * or -1 if it takes the fd and the lock.
+ */
+static int
+setflags_xtpath(const char *path, uint16_t flags)
+{
+	char buf[FLAGS_SIZE];
+	uint16_t oflags, nflags;
+
+	if(xtpath_flags(path, &oflags) < 0)
+		return -1;
+
+	// A change has to be merged under the lock
+	if(oflags != UINT16_MAX)
+		return update_flags(oflags, flags) == oflags ? 0 : -1;
+
+	nflags = update_flags(PF_NOEMUTRAMP, flags);
+	memset(buf, 0, FLAGS_SIZE);
+	bin2string(nflags, buf);
+
+	// If it was created meanwhile, or cannot be, the fd takes over
+	return xtpath_set(path, buf, strlen(buf), XATTR_CREATE) == 0 ? 1 : -1;
+}
+#endif
+#endif
+
+
+#ifdef XTPAX
+static int
+deletextpax_fd(int fd, const char **err)
+{
+	int ret, e;
+
+	if(lock_file(fd) < 0)
+	{
+		*err = "pax_deletextpax: timed out waiting for the lock on the file";
+		return -1;
+	}
+
+	if( !(xtcap(fd) & XTCAP_SET) )
+	{
+		// Where it cannot be written, only a missing XATTR_PAX is deleted
+		if( get_xt_flags(fd) == UINT16_MAX )
+			ret = 0;
+		else
+		{
+			*err = "pax_deletextpax: XATTR_PAX cannot be removed on this filesystem";
+			ret = -1;
+		}
+	}
+	else if( !fremovexattr(fd, PAX_NAMESPACE) )
+		ret = 1;
+	else if( (e = errno) == ENOATTR )
+		// Nothing to delete, so nothing changed
+		ret = 0;
+	else
+	{
+		// Nor is there one where user.* xattrs cannot even be read
+		xtcap_failed(fd, e);
+		if( e == ENOTSUP && get_xt_flags(fd) == UINT16_MAX && errno == ENOTSUP )
+			ret = 0;
+		else
+		{
+			*err = "pax_deletextpax: fremovexattr() failed";
+			ret = -1;
+		}
+	}
+
+	flock(fd, LOCK_UN);
+
+	return ret;
+}
+
+
+static int
+deletextpax_file(const char *f_name, const char **err)
+{
+	int fd, ret;
+
+	// A single removexattr() needs neither an open file nor the lock
+	if((ret = xtpath_remove(f_name)) >= 0)
+		return ret;
+
+	if((fd = sysroot_open(f_name, O_RDONLY)) < 0)
+	{
+		*err = "pax_deletextpax: open() failed";
+		return -1;
+	}
+
+	ret = deletextpax_fd(fd, err);
+
+	close(fd);
+
+	return ret;
+}
+
+
+static PyObject *
+pax_deletextpax(PyObject *self, PAX_ARGS)
+{
+	PyObject *argv[1];
+	struct pax_path path;
+	const char *err = NULL;
+	int ret;
+
+	if(get_args(PAX_PASS, 1, argv, "pax_deletextpax: expected a path or an fd") < 0 ||
+	   get_path(argv[0], &path, "pax_deletextpax: expected a path or an fd") < 0)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	if(path.fd >= 0)
+		ret = deletextpax_fd(path.fd, &err);
+	else
+		ret = deletextpax_file(path.name, &err);
+	Py_END_ALLOW_THREADS
+
+	put_path(&path);
+
+	if(ret < 0)
+	{
+		PyErr_SetString(PaxError, err);
+		return NULL;
+	}
+
+	return PAX_INT(ret);
+}
+#endif
+
+
+
+#if PY_MAJOR_VERSION >= 3
+
+/* pax.aio offers the same calls as above for asyncio.  Each call returns
+ * a future at once and the file operation is run by a pool of native
+ * threads, so thousands can be in flight without a Python thread apiece.
+ * A finished job is queued on the channel of the event loop which made
+ * the call and the channel's eventfd, which that loop watches through
+ * add_reader(), is bumped.  The loop then wakes once and resolves the
+ * futures of all the jobs finished so far.
+ */
+
+#define AIO_GETFLAGS		1
+#define AIO_SETBINFLAGS		2
+#define AIO_SETSTRFLAGS		3
+#define AIO_DELETEXTPAX		4
+
+#define AIO_DEFAULT_WORKERS	16
+#define AIO_MAX_WORKERS		256
+
+typedef struct ChannelObject ChannelObject;
+
+typedef struct AioJob {
+	struct AioJob *next;
+	int op;
+	uint16_t flags;			/* in: the flags to set, out: the flags got */
+	char buf[FLAGS_SIZE];		/* out: the flags got as a string */
+	int ret;			/* the file operation's return */
+	const char *err;		/* and why it failed */
+	PyObject *future;		/* only touched with the GIL held */
+	ChannelObject *chan;
+	char path[];
+} AioJob;
+
+struct ChannelObject {
+	PyObject_HEAD
+	int efd;
+	pthread_mutex_t lock;
+	AioJob *done;			/* finished jobs, newest first */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	AioJob *head, *tail;		/* jobs waiting for a worker */
+	int queued, idle, workers, max_workers;
+} aio_pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	NULL, NULL, 0, 0, 0, AIO_DEFAULT_WORKERS
+};
+
+static PyObject *aio_get_running_loop;	/* asyncio.get_running_loop */
+static PyObject *aio_channels;		/* WeakKeyDictionary: loop -> channel */
+static PyObject *aio_str_done, *aio_str_set_result, *aio_str_set_exception;
+
+
+static void
+aio_run(AioJob *job)
+{
+	job->err = NULL;
+
+	switch(job->op)
+	{
+		case AIO_GETFLAGS:
+			memset(job->buf, 0, FLAGS_SIZE);
+			job->ret = getflags_file(job->path, job->buf, &job->flags, &job->err);
+			break;
+		case AIO_SETBINFLAGS:
+			job->ret = setflags_file(job->path, job->flags, "pax_setbinflags: open() failed", &job->err);
+			break;
+		case AIO_SETSTRFLAGS:
+			job->ret = setflags_file(job->path, job->flags, "pax_setstrflags: open() failed", &job->err);
+			break;
+#ifdef XTPAX
+		case AIO_DELETEXTPAX:
+			job->ret = deletextpax_file(job->path, &job->err);
+			break;
+#endif
+	}
+}
+
+
+static void *
+aio_worker(void *arg)
+{
+	AioJob *job;
+	ChannelObject *chan;
+	uint64_t one = 1;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&aio_pool.lock);
+		aio_pool.idle++;
+		while(aio_pool.head == NULL)
+			pthread_cond_wait(&aio_pool.cond, &aio_pool.lock);
+		aio_pool.idle--;
+		job = aio_pool.head;
+		aio_pool.head = job->next;
+		if(aio_pool.head == NULL)
+			aio_pool.tail = NULL;
+		aio_pool.queued--;
+		pthread_mutex_unlock(&aio_pool.lock);
+
+		aio_run(job);
+
+		// Bump the eventfd under the channel lock: once the job is
+		// drained the channel, and with it the eventfd, may go away.
+		chan = job->chan;
+		pthread_mutex_lock(&chan->lock);
+		job->next = chan->done;
+		chan->done = job;
+		if(write(chan->efd, &one, sizeof(one)) < 0)
+		{
+			// Only EAGAIN on overflow, and then the loop is due anyway
+		}
+		pthread_mutex_unlock(&chan->lock);
+	}
+
+	return NULL;
+}
+
+
+/* Queue a job and start another worker if none is free to take it.
+ * Workers are only started on demand and then live as long as the
+ * process.
+ */
+static int
+aio_queue(AioJob *job)
+{
+	pthread_t tid;
+	pthread_attr_t attr;
+	int ret = 0;
+
+	pthread_mutex_lock(&aio_pool.lock);
+
+	if(aio_pool.queued >= aio_pool.idle && aio_pool.workers < aio_pool.max_workers)
+	{
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if(!pthread_create(&tid, &attr, aio_worker, NULL))
+			aio_pool.workers++;
+		else if(aio_pool.workers == 0)
+			ret = -1;
+		pthread_attr_destroy(&attr);
+	}
+
+	if(ret == 0)
+	{
+		job->next = NULL;
+		if(aio_pool.tail)
+			aio_pool.tail->next = job;
+		else
+			aio_pool.head = job;
+		aio_pool.tail = job;
+		aio_pool.queued++;
+		pthread_cond_signal(&aio_pool.cond);
+	}
+
+	pthread_mutex_unlock(&aio_pool.lock);
+
+	return ret;
+}
+
+
+/* The workers do not survive a fork(), so the child starts from an empty
+ * pool.  Any job in flight at the time is lost with the parent's futures.
+ */
+static void
+aio_atfork_child(void)
+{
+	pthread_mutex_init(&aio_pool.lock, NULL);
+	pthread_cond_init(&aio_pool.cond, NULL);
+	aio_pool.head = aio_pool.tail = NULL;
+	aio_pool.queued = aio_pool.idle = aio_pool.workers = 0;
+}
+
+
+static void
+aio_complete(AioJob *job)
+{
+	PyObject *r, *v;
+	int done;
+
+	// A future cancelled while its job ran is simply dropped
+	if((r = PyObject_CallMethodObjArgs(job->future, aio_str_done, NULL)) == NULL)
+	{
+		PyErr_WriteUnraisable(job->future);
+		return;
+	}
+	done = PyObject_IsTrue(r);
+	Py_DECREF(r);
+	if(done)
+		return;
+
+	if(job->ret < 0)
+	{
+		if((v = PyObject_CallFunction(PaxError, "s", job->err)) != NULL)
+		{
+			r = PyObject_CallMethodObjArgs(job->future, aio_str_set_exception, v, NULL);
+			Py_DECREF(v);
+		}
+		else
+			r = NULL;
+	}
+	else
+	{
+		if(job->op == AIO_GETFLAGS)
+			v = flags_result(job->flags);
+		else
+			v = PyLong_FromLong(job->ret);
+
+		if(v != NULL)
+		{
+			r = PyObject_CallMethodObjArgs(job->future, aio_str_set_result, v, NULL);
+			Py_DECREF(v);
+		}
+		else
+			r = NULL;
+	}
+
+	if(r == NULL)
+		PyErr_WriteUnraisable(job->future);
+	else
+		Py_DECREF(r);
+}
+
+
+static PyObject *
+channel_drain(ChannelObject *chan, PyObject *unused)
+{
+	AioJob *job, *next, *done = NULL;
+	uint64_t n;
+
+	if(read(chan->efd, &n, sizeof(n)) < 0)
+	{
+		// EAGAIN, an earlier drain already took these jobs
+	}
+
+	pthread_mutex_lock(&chan->lock);
+	job = chan->done;
+	chan->done = NULL;
+	pthread_mutex_unlock(&chan->lock);
+
+	// Turn the list round so futures complete in the order jobs finished
+	while(job)
+	{
+		next = job->next;
+		job->next = done;
+		done = job;
+		job = next;
+	}
+
+	Py_INCREF(chan);
+	for(job = done; job; job = next)
+	{
+		next = job->next;
+		aio_complete(job);
+		Py_DECREF(job->future);
+		Py_DECREF(job->chan);
+		free(job);
+	}
+	Py_DECREF(chan);
+
+	Py_RETURN_NONE;
+}
+
+
+static void
+channel_dealloc(ChannelObject *chan)
+{
+	if(chan->efd >= 0)
+		close(chan->efd);
+	pthread_mutex_destroy(&chan->lock);
+	Py_TYPE(chan)->tp_free((PyObject *)chan);
+}
+
+
+static PyMethodDef ChannelMethods[] = {
+	{"_drain", (PyCFunction)channel_drain, METH_NOARGS, "Resolve the futures of the finished jobs."},
+	{NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject ChannelType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"pax.aio.Channel",				/* tp_name */
+	sizeof(ChannelObject),				/* tp_basicsize */
+	0,						/* tp_itemsize */
+	(destructor)channel_dealloc,			/* tp_dealloc */
+	0,						/* tp_print */
+	0,						/* tp_getattr */
+	0,						/* tp_setattr */
+	0,						/* tp_reserved */
+	0,						/* tp_repr */
+	0,						/* tp_as_number */
+	0,						/* tp_as_sequence */
+	0,						/* tp_as_mapping */
+	0,						/* tp_hash  */
+	0,						/* tp_call */
+	0,						/* tp_str */
+	0,						/* tp_getattro */
+	0,						/* tp_setattro */
+	0,						/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,				/* tp_flags */
+	"The completion queue of one event loop",	/* tp_doc */
+	0,						/* tp_traverse */
+	0,						/* tp_clear */
+	0,						/* tp_richcompare */
+	0,						/* tp_weaklistoffset */
+	0,						/* tp_iter */
+	0,						/* tp_iternext */
+	ChannelMethods,					/* tp_methods */
+};
+
+
+/* Return a new reference to the channel of loop, creating it and hooking
+ * its eventfd into the loop on first use.
+ */
+static ChannelObject *
+aio_channel(PyObject *loop)
+{
+	ChannelObject *chan;
+	PyObject *drain, *r;
+
+	if((chan = (ChannelObject *)PyObject_GetItem(aio_channels, loop)) != NULL)
+		return chan;
+
+	if(!PyErr_ExceptionMatches(PyExc_KeyError))
+		return NULL;
+	PyErr_Clear();
+
+	if((chan = PyObject_New(ChannelObject, &ChannelType)) == NULL)
+		return NULL;
+
+	chan->done = NULL;
+	pthread_mutex_init(&chan->lock, NULL);
+	if((chan->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+	{
+		Py_DECREF(chan);
+		PyErr_SetString(PaxError, "pax_aio: eventfd() failed");
+		return NULL;
+	}
+
+	if((drain = PyObject_GetAttrString((PyObject *)chan, "_drain")) == NULL)
+	{
+		Py_DECREF(chan);
+		return NULL;
+	}
+
+	r = PyObject_CallMethod(loop, "add_reader", "iO", chan->efd, drain);
+	Py_DECREF(drain);
+	if(r == NULL)
+	{
+		Py_DECREF(chan);
+		return NULL;
+	}
+	Py_DECREF(r);
+
+	if(PyObject_SetItem(aio_channels, loop, (PyObject *)chan) < 0)
+	{
+		Py_DECREF(chan);
+		return NULL;
+	}
+
+	return chan;
+}
+
+
+/* Hand path to the pool and return the future for the running loop.
+ * Takes the reference to path.
+ */
+static PyObject *
+aio_submit(int op, PyObject *path, uint16_t flags)
+{
+	PyObject *mod, *loop, *future;
+	ChannelObject *chan;
+	AioJob *job;
+
+	if(aio_get_running_loop == NULL)
+	{
+		if((mod = PyImport_ImportModule("asyncio")) == NULL)
+			goto out;
+		aio_get_running_loop = PyObject_GetAttrString(mod, "get_running_loop");
+		Py_DECREF(mod);
+		if(aio_get_running_loop == NULL)
+			goto out;
+
+		if((mod = PyImport_ImportModule("weakref")) == NULL)
+			goto out;
+		aio_channels = PyObject_CallMethod(mod, "WeakKeyDictionary", NULL);
+		Py_DECREF(mod);
+		if(aio_channels == NULL)
+		{
+			Py_CLEAR(aio_get_running_loop);
+			goto out;
+		}
+
+		aio_str_done = PyUnicode_InternFromString("done");
+		aio_str_set_result = PyUnicode_InternFromString("set_result");
+		aio_str_set_exception = PyUnicode_InternFromString("set_exception");
+	}
+
+	if((loop = PyObject_CallObject(aio_get_running_loop, NULL)) == NULL)
+		goto out;
+
+	chan = aio_channel(loop);
+	if(chan == NULL)
+	{
+		Py_DECREF(loop);
+		goto out;
+	}
+
+	future = PyObject_CallMethod(loop, "create_future", NULL);
+	Py_DECREF(loop);
+	if(future == NULL)
+	{
+		Py_DECREF(chan);
+		goto out;
+	}
+
+	if((job = malloc(sizeof(AioJob) + PyBytes_GET_SIZE(path) + 1)) == NULL)
+	{
+		Py_DECREF(chan);
+		Py_DECREF(future);
+		Py_DECREF(path);
+		return PyErr_NoMemory();
+	}
+
+	job->op = op;
+	job->flags = flags;
+	memcpy(job->path, PyBytes_AS_STRING(path), PyBytes_GET_SIZE(path) + 1);
+	Py_DECREF(path);
+
+	// The job holds a reference to both until the loop drains it
+	job->chan = chan;
+	job->future = future;
+	Py_INCREF(future);
+
+	if(aio_queue(job) < 0)
+	{
+		Py_DECREF(chan);
+		Py_DECREF(future);
+		Py_DECREF(future);
+		free(job);
+		PyErr_SetString(PaxError, "pax_aio: pthread_create() failed");
+		return NULL;
+	}
+
+	return future;
+
+out:
+	Py_DECREF(path);
+	return NULL;
+}
+
+
+static PyObject *
+aio_getflags(PyObject *self, PyObject *args)
+{
+	PyObject *path;
+
+	if(!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path))
+	{
+		PyErr_SetString(PaxError, "pax_aio_getflags: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	return aio_submit(AIO_GETFLAGS, path, 0);
+}
+
+
+static PyObject *
+aio_setbinflags(PyObject *self, PyObject *args)
+{
+	PyObject *path;
+	int iflags;
+
+	if(!PyArg_ParseTuple(args, "O&i", PyUnicode_FSConverter, &path, &iflags))
+	{
+		PyErr_SetString(PaxError, "pax_aio_setbinflags: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	return aio_submit(AIO_SETBINFLAGS, path, (uint16_t) iflags);
+}
+
+
+static PyObject *
+aio_setstrflags(PyObject *self, PyObject *args)
+{
+	PyObject *path;
+	char *sflags;
+
+	if(!PyArg_ParseTuple(args, "O&s", PyUnicode_FSConverter, &path, &sflags))
+	{
+		PyErr_SetString(PaxError, "pax_aio_setstrflags: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	return aio_submit(AIO_SETSTRFLAGS, path, parse_sflags(sflags));
+}
+
+
+#ifdef XTPAX
+static PyObject *
+aio_deletextpax(PyObject *self, PyObject *args)
+{
+	PyObject *path;
+
+	if(!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path))
+	{
+		PyErr_SetString(PaxError, "pax_aio_deletextpax: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	return aio_submit(AIO_DELETEXTPAX, path, 0);
+}
+#endif
+
+
+static PyObject *
+aio_setworkers(PyObject *self, PyObject *args)
+{
+	int n;
+
+	if(!PyArg_ParseTuple(args, "i", &n))
+	{
+		PyErr_SetString(PaxError, "pax_aio_setworkers: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	if(n < 1 || n > AIO_MAX_WORKERS)
+	{
+		PyErr_SetString(PaxError, "pax_aio_setworkers: the number of workers is out of range");
+		return NULL;
+	}
+
+	// Workers already running are kept, only the growth is capped
+	pthread_mutex_lock(&aio_pool.lock);
+	aio_pool.max_workers = n;
+	pthread_mutex_unlock(&aio_pool.lock);
+
+	return Py_BuildValue("");
+}
+
+
+static PyMethodDef AioMethods[] = {
+	{"getflags",     aio_getflags,    METH_VARARGS, "Get the pax flags as a string, return a future."},
+	{"setbinflags",  aio_setbinflags, METH_VARARGS, "Set the pax flags using binary, return a future."},
+	{"setstrflags",  aio_setstrflags, METH_VARARGS, "Set the pax flags using string, return a future."},
+#ifdef XTPAX
+	{"deletextpax",  aio_deletextpax, METH_VARARGS, "Delete the XATTR_PAX field, return a future."},
+#endif
+	{"setworkers",   aio_setworkers,  METH_VARARGS, "Set the most worker threads the pool may start."},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef aiomoduledef = {
+	PyModuleDef_HEAD_INIT,
+	"pax.aio",							/* m_name */
+	"asyncio variants of the pax calls, run on native threads",	/* m_doc */
+	-1,								/* m_size */
+	AioMethods,							/* m_methods */
+	NULL,								/* m_reload */
+	NULL,								/* m_traverse */
+	NULL,								/* m_clear */
+	NULL,								/* m_free */
+};
+#endif
+
+
+
+/* The vdb reader walks ${VDB}/${CATEGORY}/${PF}/NEEDED.ELF.2 directly and
+ * hands back one record per line of the form
+ *
+ *	( cpv, arch, obj, soname, rpath, ( needed1, needed2, ... ) )
+ *
+ * All strings are interned, so the many repeated arch and soname strings
+ * of a system are shared.  Only one NEEDED.ELF.2 file is held in memory
+ * at any time, no matter how big the vdb is.
+ *
+ * A query about one object or one soname only wants a handful of lines,
+ * so the records can be filtered by obj, by soname or by what they need
+ * before any Python object is made for them.
+ */
+
+#define NEEDED_FILE	"NEEDED.ELF.2"
+#define NEEDED_FIELDS	5
+
+// The obj, soname and needed fields
+#define NEEDED_OBJ	1
+#define NEEDED_SONAME	2
+#define NEEDED_NEEDED	4
+
+typedef struct {
+	char **str;
+	size_t *len;
+	Py_ssize_t count;
+} NeededMatch;
+
+typedef struct {
+	PyObject_HEAD
+	int vdb_fd;		/* the vdb, eg /var/db/pkg */
+	DIR *cat_dir;		/* the vdb's categories */
+	DIR *pkg_dir;		/* the current category's packages */
+	int cat_fd;
+	char cat[NAME_MAX + 1];
+	PyObject *cpv;		/* the current package as "cat/pf" */
+	char *buf;		/* the current NEEDED.ELF.2 */
+	size_t len, size, pos;
+	int filtered;		/* only records matching one of the below */
+	NeededMatch objs, sonames, needs;
+} NeededObject;
+
+
+static PyObject *
+intern_string(const char *s, Py_ssize_t len)
+{
+	PyObject *o;
+
+#if PY_MAJOR_VERSION >= 3
+	o = PyUnicode_DecodeFSDefaultAndSize(s, len);
+	if(o)
+		PyUnicode_InternInPlace(&o);
+#else
+	o = PyString_FromStringAndSize(s, len);
+	if(o)
+		PyString_InternInPlace(&o);
+#endif
+
+	return o;
+}
+
+
+// Skip ".", "..", hidden files and portage's -MERGING- leftovers
+static int
+skip_vdb_entry(const char *name)
+{
+	return name[0] == '.' || name[0] == '-';
+}
+
+
+/* Find the next package with a non-empty NEEDED.ELF.2 and load it into
+ * n->buf.  Returns 1 on success, 0 when the vdb is exhausted and -1 on
+ * error.  No Python API is used here, so it can run without the GIL.
+ */
+static int
+load_next_needed(NeededObject *n, char *pf)
+{
+	struct dirent *d;
+	struct stat st;
+	char path[2 * NAME_MAX + 2];
+	ssize_t r;
+	int fd, dfd;
+
+	for(;;)
+	{
+		if(n->pkg_dir == NULL)
+		{
+			if(n->cat_dir == NULL)
+				return 0;
+
+			if((d = readdir(n->cat_dir)) == NULL)
+			{
+				closedir(n->cat_dir);
+				n->cat_dir = NULL;
+				return 0;
+			}
+
+			if(skip_vdb_entry(d->d_name))
+				continue;
+
+			if((dfd = openat(n->vdb_fd, d->d_name, O_RDONLY | O_DIRECTORY)) < 0)
+				continue;
+
+			if((n->pkg_dir = fdopendir(dfd)) == NULL)
+			{
+				close(dfd);
+				continue;
+			}
+
+			n->cat_fd = dfd;
+			snprintf(n->cat, sizeof(n->cat), "%s", d->d_name);
+		}
+
+		if((d = readdir(n->pkg_dir)) == NULL)
+		{
+			closedir(n->pkg_dir);
+			n->pkg_dir = NULL;
+			continue;
+		}
+
+		if(skip_vdb_entry(d->d_name))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/" NEEDED_FILE, d->d_name);
+		if((fd = openat(n->cat_fd, path, O_RDONLY)) < 0)
+			continue;  // Some packages have no NEEDED.ELF.2
+
+		if(fstat(fd, &st) < 0 || st.st_size == 0)
+		{
+			close(fd);
+			continue;
+		}
+
+		if((size_t)st.st_size + 1 > n->size)
+		{
+			char *buf = realloc(n->buf, st.st_size + 1);
+			if(buf == NULL)
+			{
+				close(fd);
+				return -1;
+			}
+			n->buf = buf;
+			n->size = st.st_size + 1;
+		}
+
+		n->len = 0;
+		while(n->len < (size_t)st.st_size)
+		{
+			r = read(fd, n->buf + n->len, st.st_size - n->len);
+			if(r < 0 && errno == EINTR)
+				continue;
+			if(r <= 0)
+				break;
+			n->len += r;
+		}
+		close(fd);
+
+		n->buf[n->len] = 0;
+		n->pos = 0;
+
+		snprintf(pf, NAME_MAX + 1, "%s", d->d_name);
+		return 1;
+	}
+}
+
+
+static void
+needed_fields(const char *line, size_t len, const char **field, size_t *flen)
+{
+	const char *p, *end, *q;
+	int i;
+
+	end = line + len;
+	p = line;
+
+	for(i = 0; i < NEEDED_FIELDS; i++)
+	{
+		q = p;
+		while(q < end && *q != ';')
+			q++;
+		field[i] = p;
+		flen[i] = q - p;
+		p = q < end ? q + 1 : end;
+	}
+}
+
+
+static int
+needed_match(NeededMatch *m, const char *s, size_t len)
+{
+	Py_ssize_t i;
+
+	for(i = 0; i < m->count; i++)
+		if(m->len[i] == len && memcmp(m->str[i], s, len) == 0)
+			return 1;
+
+	return 0;
+}
+
+
+// Does the line have a wanted obj or soname, or need a wanted soname?
+static int
+needed_wanted(NeededObject *n, const char **field, size_t *flen)
+{
+	const char *p, *q, *end;
+
+	if(needed_match(&n->objs, field[NEEDED_OBJ], flen[NEEDED_OBJ]))
+		return 1;
+
+	if(flen[NEEDED_SONAME] && needed_match(&n->sonames, field[NEEDED_SONAME], flen[NEEDED_SONAME]))
+		return 1;
+
+	if(n->needs.count == 0)
+		return 0;
+
+	p = field[NEEDED_NEEDED];
+	end = p + flen[NEEDED_NEEDED];
+	while(p < end)
+	{
+		q = p;
+		while(q < end && *q != ',')
+			q++;
+		if(needed_match(&n->needs, p, q - p))
+			return 1;
+		p = q + 1;
+	}
+
+	return 0;
+}
+
+
+static PyObject *
+needed_record(NeededObject *n, const char **field, size_t *flen)
+{
+	const char *p, *end, *q;
+	PyObject *rec, *needed, *o;
+	Py_ssize_t count;
+	int i;
+
+	// needed is a comma separated list of sonames
+	count = 0;
+	for(p = field[4]; p < field[4] + flen[4]; p++)
+		if(*p == ',')
+			count++;
+	if(flen[4])
+		count++;
+
+	if((needed = PyTuple_New(count)) == NULL)
+		return NULL;
+
+	p = field[4];
+	end = field[4] + flen[4];
+	for(i = 0; i < count; i++)
+	{
+		q = p;
+		while(q < end && *q != ',')
+			q++;
+		if((o = intern_string(p, q - p)) == NULL)
+		{
+			Py_DECREF(needed);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(needed, i, o);
+		p = q + 1;
+	}
+
+	if((rec = PyTuple_New(NEEDED_FIELDS + 1)) == NULL)
+	{
+		Py_DECREF(needed);
+		return NULL;
+	}
+
+	Py_INCREF(n->cpv);
+	PyTuple_SET_ITEM(rec, 0, n->cpv);
+	for(i = 0; i < NEEDED_FIELDS - 1; i++)
+	{
+		if((o = intern_string(field[i], flen[i])) == NULL)
+		{
+			Py_DECREF(needed);
+			Py_DECREF(rec);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(rec, i + 1, o);
+	}
+	PyTuple_SET_ITEM(rec, NEEDED_FIELDS, needed);
+
+	return rec;
+}
+
+
+static PyObject *
+needed_iternext(NeededObject *n)
+{
+	char pf[NAME_MAX + 1];
+	char cpv[2 * NAME_MAX + 2];
+	const char *field[NEEDED_FIELDS];
+	size_t flen[NEEDED_FIELDS];
+	char *line, *eol;
+	int ret;
+
+	for(;;)
+	{
+		// Return the next non-empty line of the current file
+		while(n->buf && n->pos < n->len)
+		{
+			line = n->buf + n->pos;
+			if((eol = memchr(line, '\n', n->len - n->pos)) == NULL)
+				eol = n->buf + n->len;
+			n->pos = eol - n->buf + 1;
+
+			if(eol == line)
+				continue;
+
+			needed_fields(line, eol - line, field, flen);
+			if(n->filtered && !needed_wanted(n, field, flen))
+				continue;
+
+			return needed_record(n, field, flen);
+		}
+
+		Py_BEGIN_ALLOW_THREADS
+		ret = load_next_needed(n, pf);
+		Py_END_ALLOW_THREADS
+
+		if(ret == 0)
+			return NULL;	// StopIteration
+		if(ret < 0)
+			return PyErr_NoMemory();
+
+		snprintf(cpv, sizeof(cpv), "%s/%s", n->cat, pf);
+		Py_XDECREF(n->cpv);
+		if((n->cpv = intern_string(cpv, strlen(cpv))) == NULL)
+			return NULL;
+	}
+}
+
+
+static void
+needed_match_free(NeededMatch *m)
+{
+	Py_ssize_t i;
+
+	for(i = 0; i < m->count; i++)
+		free(m->str[i]);
+	free(m->str);
+	free(m->len);
+	m->str = NULL;
+	m->len = NULL;
+	m->count = 0;
+}
+
+
+// Copy the strings of the sequence o into m, None matches nothing
+static int
+needed_match_fill(NeededMatch *m, PyObject *o)
+{
+	PyObject *seq, *item;
+	char *s;
+	Py_ssize_t i, count, len;
+#if PY_MAJOR_VERSION >= 3
+	PyObject *bytes;
+#endif
+
+	if(o == NULL || o == Py_None)
+		return 0;
+
+	if((seq = PySequence_Fast(o, "pax_needed: the filters must be sequences of strings")) == NULL)
+		return -1;
+
+	count = PySequence_Fast_GET_SIZE(seq);
+	m->str = calloc(count ? count : 1, sizeof(char *));
+	m->len = calloc(count ? count : 1, sizeof(size_t));
+	if(m->str == NULL || m->len == NULL)
+	{
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		item = PySequence_Fast_GET_ITEM(seq, i);
+#if PY_MAJOR_VERSION >= 3
+		if(!PyUnicode_FSConverter(item, &bytes))
+		{
+			Py_DECREF(seq);
+			return -1;
+		}
+		s = PyBytes_AS_STRING(bytes);
+		len = PyBytes_GET_SIZE(bytes);
+#else
+		if(PyString_AsStringAndSize(item, &s, &len) < 0)
+		{
+			Py_DECREF(seq);
+			return -1;
+		}
+#endif
+		m->str[i] = malloc(len + 1);
+		if(m->str[i])
+		{
+			memcpy(m->str[i], s, len);
+			m->str[i][len] = 0;
+			m->len[i] = len;
+			m->count++;
+		}
+#if PY_MAJOR_VERSION >= 3
+		Py_DECREF(bytes);
+#endif
+		if(m->str[i] == NULL)
+		{
+			Py_DECREF(seq);
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
+
+	Py_DECREF(seq);
+	return 0;
+}
+
+
+static void
+needed_dealloc(NeededObject *n)
+{
+	if(n->pkg_dir)
+		closedir(n->pkg_dir);
+	if(n->cat_dir)
+		closedir(n->cat_dir);
+	if(n->vdb_fd >= 0)
+		close(n->vdb_fd);
+	free(n->buf);
+	Py_XDECREF(n->cpv);
+	needed_match_free(&n->objs);
+	needed_match_free(&n->sonames);
+	needed_match_free(&n->needs);
+	PyObject_Del(n);
+}
+
+
+static PyTypeObject NeededType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"pax.NeededIterator",			/* tp_name */
+	sizeof(NeededObject),			/* tp_basicsize */
+	0,					/* tp_itemsize */
+	(destructor) needed_dealloc,		/* tp_dealloc */
+	0,					/* tp_print */
+	0,					/* tp_getattr */
+	0,					/* tp_setattr */
+	0,					/* tp_compare */
+	0,					/* tp_repr */
+	0,					/* tp_as_number */
+	0,					/* tp_as_sequence */
+	0,					/* tp_as_mapping */
+	0,					/* tp_hash */
+	0,					/* tp_call */
+	0,					/* tp_str */
+	0,					/* tp_getattro */
+	0,					/* tp_setattro */
+	0,					/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,			/* tp_flags */
+	"Iterator over NEEDED.ELF.2 records",	/* tp_doc */
+	0,					/* tp_traverse */
+	0,					/* tp_clear */
+	0,					/* tp_richcompare */
+	0,					/* tp_weaklistoffset */
+	PyObject_SelfIter,			/* tp_iter */
+	(iternextfunc) needed_iternext,		/* tp_iternext */
+};
+
+
+/* needed(vdb [, objs [, sonames [, needed]]])
+ *
+ *	vdb	the vdb, eg /var/db/pkg
+ *	objs	only the records of these objects
+ *	sonames	only the records of the libraries with these sonames
+ *	needed	only the records of the objects needing one of these sonames
+ *
+ * The filters are sequences of strings, or None.  If any is given, a
+ * record is returned when it matches at least one of them, otherwise
+ * every record is.
+ */
+static PyObject *
+pax_needed(PyObject *self, PyObject *args)
+{
+	const char *vdb;
+	PyObject *objs = NULL, *sonames = NULL, *needs = NULL;
+	NeededObject *n;
+	int fd, dfd;
+
+	if (!PyArg_ParseTuple(args, "s|OOO", &vdb, &objs, &sonames, &needs))
+	{
+		PyErr_SetString(PaxError, "pax_needed: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	if((fd = sysroot_open(vdb, O_RDONLY | O_DIRECTORY)) < 0)
+	{
+		PyErr_SetString(PaxError, "pax_needed: open() failed");
+		return NULL;
+	}
+
+	if((n = PyObject_New(NeededObject, &NeededType)) == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	n->vdb_fd = fd;
+	n->pkg_dir = NULL;
+	n->cat_fd = -1;
+	n->cat[0] = 0;
+	n->cpv = NULL;
+	n->buf = NULL;
+	n->len = n->size = n->pos = 0;
+	n->cat_dir = NULL;
+	memset(&n->objs, 0, sizeof(NeededMatch));
+	memset(&n->sonames, 0, sizeof(NeededMatch));
+	memset(&n->needs, 0, sizeof(NeededMatch));
+
+	n->filtered = (objs && objs != Py_None) || (sonames && sonames != Py_None)
+			|| (needs && needs != Py_None);
+
+	if(needed_match_fill(&n->objs, objs) < 0
+			|| needed_match_fill(&n->sonames, sonames) < 0
+			|| needed_match_fill(&n->needs, needs) < 0)
+	{
+		Py_DECREF(n);
+		return NULL;
+	}
+
+	// fdopendir() takes ownership, so keep our own copy of the vdb fd for openat()
+	if((dfd = dup(fd)) < 0 || (n->cat_dir = fdopendir(dfd)) == NULL)
+	{
+		if(dfd >= 0)
+			close(dfd);
+		n->cat_dir = NULL;
+		Py_DECREF(n);
+		PyErr_SetString(PaxError, "pax_needed: opendir() failed");
+		return NULL;
+	}
+
+	return (PyObject *) n;
+}
+
+
+
+/* scan() walks trees of files for the Python tools in place of os.walk()
+ * and a getflags() per file, which costs a few Python objects for every
+ * directory entry and an exception for every file which is not an ELF or
+ * has no markings.  Here a pool of native threads, like paxctl-ng --census
+ * has, share a stack of directories and readdir() them in parallel, and
+ * of each regular file read only the ELF header, the phdrs and the xattr,
+ * with the GIL released.  What they find queues up as plain C records
+ * until the iterator hands them out, in lists of up to batch records
+ *
+ *	( path, dev, ino, type, pt, xt, errno )
+ *
+ * as a pax.ScanRecord, whose fields can also be taken by name:
+ *
+ *	type	the e_type of the ELF, None if it is not one
+ *	pt, xt	the PT_PAX and XATTR_PAX flags as getptxtflags() gives them
+ *	errno	0, ENOEXEC for a file which is not an ELF, or why the file or
+ *		directory at path could not be read
+ *
+ * A miss is a record, not an exception.  Files which are not ELFs are
+ * only returned if asked for.  Symlinks are not followed below the roots
+ * and pseudo filesystems like /proc and /sys are not entered.  Paths are
+ * resolved inside setsysroot()'s root and read as setnocache() says.
+ * The records come in no particular order.
+ */
+
+#define SCAN_THREADS_MAX	16
+#define SCAN_BATCH		256		/* records per list, by default */
+#define SCAN_QUEUE_BATCHES	4		/* the threads wait once this many lists are ready */
+
+typedef struct {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	int type;		/* -1 if not an ELF */
+	uint16_t pt, xt;
+	int err;
+} ScanRecord;
+
+typedef struct {
+	PyObject_HEAD
+	char **dirs;		/* the stack of paths still to walk */
+	size_t ndirs, dsize;
+	ScanRecord *recs;	/* the records found and not yet handed out */
+	size_t nrecs, rsize;
+	size_t batch;
+	int all;		/* return the files which are not ELFs too */
+	int busy;		/* threads walking a path, which may push more */
+	int running;		/* threads not done yet */
+	int stop;		/* the iterator is going away */
+	int oom;
+	int nthreads;
+	pthread_t threads[SCAN_THREADS_MAX];
+	pthread_mutex_t lock;	/* guards all of the above */
+	pthread_cond_t more;	/* a path was pushed, or there will be none */
+	pthread_cond_t ready;	/* a batch of records is ready, or there will be none */
+	pthread_cond_t room;	/* records were handed out */
+} ScanObject;
+
+static PyStructSequence_Field scan_record_fields[] = {
+	{"path",  "the path of the file"},
+	{"dev",   "its st_dev"},
+	{"ino",   "its st_ino"},
+	{"type",  "its ELF e_type, None if not an ELF"},
+	{"pt",    "its PT_PAX flags, None if missing"},
+	{"xt",    "its XATTR_PAX flags, None if missing"},
+	{"errno", "0, or why it could not be read"},
+	{NULL, NULL}
+};
+
+static PyStructSequence_Desc scan_record_desc = {
+	"pax.ScanRecord",
+	"What scan() found for a file",
+	scan_record_fields,
+	7
+};
+
+
+// Pseudo filesystems, whose files are not ELF objects and may not like being read
+static int
+pseudo_fs(int fd)
+{
+	struct statfs sfs;
+
+	if(fstatfs(fd, &sfs) < 0)
+		return 0;
+
+	switch((unsigned long)sfs.f_type)
+	{
+		case 0x9fa0:			/* PROC_SUPER_MAGIC */
+		case 0x62656572:		/* SYSFS_MAGIC */
+		case 0x1cd1:			/* DEVPTS_SUPER_MAGIC */
+		case 0x64626720:		/* DEBUGFS_MAGIC */
+		case 0x74726163:		/* TRACEFS_MAGIC */
+		case 0x73636673:		/* SECURITYFS_MAGIC */
+		case 0x27e0eb:			/* CGROUP_SUPER_MAGIC */
+		case 0x63677270:		/* CGROUP2_SUPER_MAGIC */
+		case 0xcafe4a11:		/* BPF_FS_MAGIC */
+		case 0x6165676c:		/* PSTOREFS_MAGIC */
+		case 0x62656570:		/* CONFIGFS_MAGIC */
+		case 0xde5e81e4:		/* EFIVARFS_MAGIC */
+			return 1;
+	}
+
+	return 0;
+}
+
+
+// Queue a copy of path to be walked, -1 if out of memory
+static int
+scan_push_dir(ScanObject *s, const char *path)
+{
+	char **dirs, *dir;
+
+	if((dir = strdup(path)) == NULL)
+		return -1;
+
+	pthread_mutex_lock(&s->lock);
+	if(s->ndirs == s->dsize)
+	{
+		if((dirs = realloc(s->dirs, (s->dsize ? 2 * s->dsize : 1024) * sizeof(char *))) == NULL)
+		{
+			pthread_mutex_unlock(&s->lock);
+			free(dir);
+			return -1;
+		}
+		s->dirs = dirs;
+		s->dsize = s->dsize ? 2 * s->dsize : 1024;
+	}
+	s->dirs[s->ndirs++] = dir;
+	pthread_cond_signal(&s->more);
+	pthread_mutex_unlock(&s->lock);
+
+	return 0;
+}
+
+
+// Take a path to walk, NULL once there are none left and none can come
+static char *
+scan_pop_dir(ScanObject *s)
+{
+	char *dir = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	while(s->ndirs == 0 && s->busy > 0 && !s->stop)
+		pthread_cond_wait(&s->more, &s->lock);
+
+	if(s->ndirs > 0 && !s->stop)
+	{
+		dir = s->dirs[--s->ndirs];
+		s->busy++;
+	}
+	else
+		pthread_cond_broadcast(&s->more);
+	pthread_mutex_unlock(&s->lock);
+
+	return dir;
+}
+
+
+static void
+scan_done_dir(ScanObject *s)
+{
+	pthread_mutex_lock(&s->lock);
+	if(--s->busy == 0 && s->ndirs == 0)
+		pthread_cond_broadcast(&s->more);
+	pthread_mutex_unlock(&s->lock);
+}
+
+
+// Queue a record for the iterator, which takes over r->path
+static void
+scan_put(ScanObject *s, ScanRecord *r)
+{
+	ScanRecord *recs;
+
+	pthread_mutex_lock(&s->lock);
+	while(s->nrecs >= SCAN_QUEUE_BATCHES * s->batch && !s->stop)
+		pthread_cond_wait(&s->room, &s->lock);
+
+	if(!s->stop && s->nrecs == s->rsize)
+	{
+		if((recs = realloc(s->recs, (s->rsize ? 2 * s->rsize : s->batch) * sizeof(ScanRecord))) == NULL)
+			s->oom = 1;
+		else
+		{
+			s->recs = recs;
+			s->rsize = s->rsize ? 2 * s->rsize : s->batch;
+		}
+	}
+
+	if(s->stop || s->nrecs == s->rsize)
+		free(r->path);
+	else
+	{
+		s->recs[s->nrecs++] = *r;
+		if(s->nrecs >= s->batch)
+			pthread_cond_signal(&s->ready);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+
+static void
+scan_error(ScanObject *s, const char *path, int err)
+{
+	ScanRecord r;
+
+	memset(&r, 0, sizeof(r));
+	r.type = -1;
+	r.pt = r.xt = UINT16_MAX;
+	r.err = err;
+	if((r.path = strdup(path)) == NULL)
+	{
+		pthread_mutex_lock(&s->lock);
+		s->oom = 1;
+		pthread_mutex_unlock(&s->lock);
+		return;
+	}
+
+	scan_put(s, &r);
+}
+
+
+// As nocache_open(), for name in the directory dfd, never following a symlink
+static int
+scan_openat(int dfd, const char *name)
+{
+	int fd;
+
+	if(!nocache)
+		return openat(dfd, name, O_RDONLY | O_NOFOLLOW);
+
+	if((fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_NOATIME)) < 0 && errno == EPERM)
+		fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW);
+
+	if(fd >= 0)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+	return fd;
+}
+
+
+// Read the markings of the regular file open on fd, and close it
+static void
+scan_file(ScanObject *s, const char *path, int fd)
+{
+	unsigned char ehdr[NOCACHE_EHDR_SIZE];
+	unsigned char *image;
+	const char *err = NULL;
+	struct elf_layout l;
+	struct stat st;
+	ScanRecord r;
+	size_t len;
+
+	memset(&r, 0, sizeof(r));
+	r.type = -1;
+	r.pt = r.xt = UINT16_MAX;
+
+	if(fstat(fd, &st) < 0)
+		r.err = errno;
+	else
+	{
+		r.dev = st.st_dev;
+		r.ino = st.st_ino;
+
+		if((image = read_elf_headers(fd, st.st_size, ehdr, &len, &err)) == NULL)
+			r.err = ENOEXEC;
+		else
+		{
+			elf_layout(image, len, &l);
+			r.type = elf_get(image + offsetof(Elf64_Ehdr, e_type), 2, l.msb);
+#ifdef PTPAX
+			r.pt = pt_flags_mem(image, len);
+#endif
+			if(image != ehdr)
+				free(image);
+#ifdef XTPAX
+			r.xt = get_xt_flags(fd);
+#endif
+		}
+	}
+
+	close(fd);
+
+	if(r.err == ENOEXEC && !s->all)
+		return;
+
+	if((r.path = strdup(path)) == NULL)
+	{
+		pthread_mutex_lock(&s->lock);
+		s->oom = 1;
+		pthread_mutex_unlock(&s->lock);
+		return;
+	}
+
+	scan_put(s, &r);
+}
+
+
+// Walk path, a directory or else a file given as a root
+static void
+scan_path(ScanObject *s, const char *path)
+{
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	char sub[PATH_MAX];
+	int fd, type;
+
+	if((fd = sysroot_open(path, O_RDONLY | O_DIRECTORY)) < 0)
+	{
+		if(errno == ENOTDIR && (fd = nocache_open(path)) >= 0)
+		{
+			if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+				scan_file(s, path, fd);
+			else
+				close(fd);
+		}
+		else
+			scan_error(s, path, errno);
+		return;
+	}
+
+	if(pseudo_fs(fd) || (d = fdopendir(fd)) == NULL)
+	{
+		close(fd);
+		return;
+	}
+
+	while((de = readdir(d)) != NULL && !s->stop)
+	{
+		if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if(snprintf(sub, sizeof(sub), "%s/%s", strcmp(path, "/") ? path : "", de->d_name)
+				>= (int)sizeof(sub))
+		{
+			scan_error(s, de->d_name, ENAMETOOLONG);
+			continue;
+		}
+
+		type = de->d_type;
+		if(type == DT_UNKNOWN)
+		{
+			if(fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+				continue;
+			type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if(type == DT_DIR)
+		{
+			if(scan_push_dir(s, sub) < 0)
+			{
+				pthread_mutex_lock(&s->lock);
+				s->oom = 1;
+				pthread_mutex_unlock(&s->lock);
+			}
+		}
+		else if(type == DT_REG)
+		{
+			if((fd = scan_openat(dirfd(d), de->d_name)) < 0)
+				scan_error(s, sub, errno);
+			else
+				scan_file(s, sub, fd);
+		}
+	}
+
+	closedir(d);
+}
+
+
+static void *
+scan_thread(void *arg)
+{
+	ScanObject *s = arg;
+	char *path;
+
+	while((path = scan_pop_dir(s)) != NULL)
+	{
+		scan_path(s, path);
+		free(path);
+		scan_done_dir(s);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	if(--s->running == 0)
+		pthread_cond_broadcast(&s->ready);
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+
+static PyObject *
+scan_record(ScanRecord *r)
+{
+	PyObject *t, *v;
+	int i;
+
+	if((t = PyStructSequence_New(&ScanRecordType)) == NULL)
+		return NULL;
+
+	for(i = 0; i < 7; i++)
+	{
+		switch(i)
+		{
+			case 0:
+#if PY_MAJOR_VERSION >= 3
+				v = PyUnicode_DecodeFSDefault(r->path);
+#else
+				v = PyString_FromString(r->path);
+#endif
+				break;
+			case 1:
+				v = PyLong_FromUnsignedLongLong(r->dev);
+				break;
+			case 2:
+				v = PyLong_FromUnsignedLongLong(r->ino);
+				break;
+			case 3:
+				v = r->type < 0 ? Py_BuildValue("") : PAX_INT(r->type);
+				break;
+			case 4:
+				v = r->pt == UINT16_MAX ? Py_BuildValue("") : flags_str(r->pt);
+				break;
+			case 5:
+				v = r->xt == UINT16_MAX ? Py_BuildValue("") : flags_str(r->xt);
+				break;
+			default:
+				v = PAX_INT(r->err);
+				break;
+		}
+
+		if(v == NULL)
+		{
+			Py_DECREF(t);
+			return NULL;
+		}
+		PyStructSequence_SET_ITEM(t, i, v);
+	}
+
+	return t;
+}
+
+
+static PyObject *
+scan_iternext(ScanObject *s)
+{
+	ScanRecord *recs;
+	PyObject *list, *rec;
+	size_t i, n;
+	int oom;
+
+	if((recs = malloc(s->batch * sizeof(ScanRecord))) == NULL)
+		return PyErr_NoMemory();
+
+	// Wait for a whole batch, or what is left once the walk is done
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&s->lock);
+	while(s->nrecs < s->batch && s->running > 0)
+		pthread_cond_wait(&s->ready, &s->lock);
+
+	n = s->nrecs < s->batch ? s->nrecs : s->batch;
+	s->nrecs -= n;
+	memcpy(recs, s->recs + s->nrecs, n * sizeof(ScanRecord));
+	oom = s->oom;
+	pthread_cond_broadcast(&s->room);
+	pthread_mutex_unlock(&s->lock);
+	Py_END_ALLOW_THREADS
+
+	list = NULL;
+	if(oom)
+		PyErr_NoMemory();
+	else if(n > 0 && (list = PyList_New(n)) != NULL)
+	{
+		for(i = 0; i < n; i++)
+		{
+			if((rec = scan_record(&recs[i])) == NULL)
+			{
+				Py_CLEAR(list);
+				break;
+			}
+			PyList_SET_ITEM(list, i, rec);
+		}
+	}
+
+	for(i = 0; i < n; i++)
+		free(recs[i].path);
+	free(recs);
+
+	return list;	// NULL without an error is StopIteration
+}
+
+
+static void
+scan_dealloc(ScanObject *s)
+{
+	size_t i;
+	int k;
+
+	pthread_mutex_lock(&s->lock);
+	s->stop = 1;
+	pthread_cond_broadcast(&s->more);
+	pthread_cond_broadcast(&s->room);
+	pthread_mutex_unlock(&s->lock);
+
+	// The threads may be in the middle of reading a slow file
+	Py_BEGIN_ALLOW_THREADS
+	for(k = 0; k < s->nthreads; k++)
+		pthread_join(s->threads[k], NULL);
+	Py_END_ALLOW_THREADS
+
+	for(i = 0; i < s->ndirs; i++)
+		free(s->dirs[i]);
+	free(s->dirs);
+	for(i = 0; i < s->nrecs; i++)
+		free(s->recs[i].path);
+	free(s->recs);
+
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->more);
+	pthread_cond_destroy(&s->ready);
+	pthread_cond_destroy(&s->room);
+	PyObject_Del(s);
+}
+
+
+static PyTypeObject ScanType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"pax.ScanIterator",			/* tp_name */
+	sizeof(ScanObject),			/* tp_basicsize */
+	0,					/* tp_itemsize */
+	(destructor) scan_dealloc,		/* tp_dealloc */
+	0,					/* tp_print */
+	0,					/* tp_getattr */
+	0,					/* tp_setattr */
+	0,					/* tp_compare */
+	0,					/* tp_repr */
+	0,					/* tp_as_number */
+	0,					/* tp_as_sequence */
+	0,					/* tp_as_mapping */
+	0,					/* tp_hash */
+	0,					/* tp_call */
+	0,					/* tp_str */
+	0,					/* tp_getattro */
+	0,					/* tp_setattro */
+	0,					/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,			/* tp_flags */
+	"Iterator over lists of ScanRecords",	/* tp_doc */
+	0,					/* tp_traverse */
+	0,					/* tp_clear */
+	0,					/* tp_richcompare */
+	0,					/* tp_weaklistoffset */
+	PyObject_SelfIter,			/* tp_iter */
+	(iternextfunc) scan_iternext,		/* tp_iternext */
+};
+
+
+/* scan(roots [, batch [, all]])
+ *
+ *	roots	a path, or a sequence of them, each a directory to walk or
+ *		a file to read
+ *	batch	how many records each list holds at most, 256 by default
+ *	all	also return the files which are not ELFs, with ENOEXEC
+ *
+ * Return an iterator over lists of ScanRecords, see above.
+ */
+static PyObject *
+pax_scan(PyObject *self, PyObject *args)
+{
+	PyObject *roots, *seq, *item;
+	Py_ssize_t batch = SCAN_BATCH, i, count;
+	ScanObject *s;
+	const char *path;
+	long nthreads;
+	int all = 0, ret;
+#if PY_MAJOR_VERSION >= 3
+	PyObject *bytes;
+#endif
+
+	if (!PyArg_ParseTuple(args, "O|ni", &roots, &batch, &all))
+	{
+		PyErr_SetString(PaxError, "pax_scan: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	if(batch < 1)
+	{
+		PyErr_SetString(PaxError, "pax_scan: batch must be at least 1");
+		return NULL;
+	}
+
+#if PY_MAJOR_VERSION >= 3
+	if(PyUnicode_Check(roots) || PyBytes_Check(roots))
+#else
+	if(PyString_Check(roots) || PyUnicode_Check(roots))
+#endif
+		seq = PyTuple_Pack(1, roots);
+	else
+		seq = PySequence_Fast(roots, "pax_scan: expected a path or a sequence of them");
+	if(seq == NULL)
+		return NULL;
+
+	if((s = PyObject_New(ScanObject, &ScanType)) == NULL)
+	{
+		Py_DECREF(seq);
+		return NULL;
+	}
+
+	s->dirs = NULL;
+	s->ndirs = s->dsize = 0;
+	s->recs = NULL;
+	s->nrecs = s->rsize = 0;
+	s->batch = batch;
+	s->all = all;
+	s->busy = s->running = s->stop = s->oom = s->nthreads = 0;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->more, NULL);
+	pthread_cond_init(&s->ready, NULL);
+	pthread_cond_init(&s->room, NULL);
+
+	// The roots go on the stack of paths like any directory
+	count = PySequence_Fast_GET_SIZE(seq);
+	for(i = 0; i < count; i++)
+	{
+		item = PySequence_Fast_GET_ITEM(seq, i);
+#if PY_MAJOR_VERSION >= 3
+		if(!PyUnicode_FSConverter(item, &bytes))
+		{
+			Py_DECREF(seq);
+			Py_DECREF(s);
+			return NULL;
+		}
+		path = PyBytes_AS_STRING(bytes);
+		ret = scan_push_dir(s, path);
+		Py_DECREF(bytes);
+#else
+		if((path = PyString_AsString(item)) == NULL)
+		{
+			Py_DECREF(seq);
+			Py_DECREF(s);
+			return NULL;
+		}
+		ret = scan_push_dir(s, path);
+#endif
+		if(ret < 0)
+		{
+			Py_DECREF(seq);
+			Py_DECREF(s);
+			return PyErr_NoMemory();
+		}
+	}
+	Py_DECREF(seq);
+
+	if((nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nthreads = 1;
+	if(nthreads > SCAN_THREADS_MAX)
+		nthreads = SCAN_THREADS_MAX;
+
+	// running is counted first, so the iterator cannot take the walk as done
+	pthread_mutex_lock(&s->lock);
+	for(; s->nthreads < nthreads; s->nthreads++)
+	{
+		s->running++;
+		if(pthread_create(&s->threads[s->nthreads], NULL, scan_thread, s) != 0)
+		{
+			s->running--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	if(s->nthreads == 0)
+	{
+		Py_DECREF(s);
+		PyErr_SetString(PaxError, "pax_scan: pthread_create() failed");
+		return NULL;
+	}
+
+	return (PyObject *) s;
+}
+
+
+
+/* Reduce the flags to what bin2string4print() shows, so that two nodes
+ * compare equal exactly when their flag strings do.  An enable flag hides
+ * its disable flag, and anything outside the five pairs is ignored.
+ * Negative flags stand for "could not be read" and all compare equal.
+ */
+static int32_t
+canonical_flags(long flags)
+{
+	static const uint16_t pairs[5][2] = {
+		{ PF_PAGEEXEC, PF_NOPAGEEXEC },
+		{ PF_EMUTRAMP, PF_NOEMUTRAMP },
+		{ PF_MPROTECT, PF_NOMPROTECT },
+		{ PF_RANDMMAP, PF_NORANDMMAP },
+		{ PF_SEGMEXEC, PF_NOSEGMEXEC }
+	};
+	int32_t c = 0;
+	int i;
+
+	if(flags < 0)
+		return -1;
+
+	for(i = 0; i < 5; i++)
+	{
+		if(flags & pairs[i][0])
+			c |= pairs[i][0];
+		else if(flags & pairs[i][1])
+			c |= pairs[i][1];
+	}
+
+	return c;
+}
+
+
+static long
+seq_item_as_long(PyObject *seq, Py_ssize_t i)
+{
+#if PY_MAJOR_VERSION >= 3
+	return PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+#else
+	return PyInt_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+#endif
+}
+
+
+/* mismatches(flags, edges [, select])
+ *
+ *	flags	one flag word per node, negative if the flags are unknown
+ *	edges	a sequence of ( node, peer ) index pairs
+ *	select	optionally one truth value per node; edges to a peer which
+ *		is not selected are ignored
+ *
+ * Returns [ ( node, [ peer, ... ] ), ... ] for every node which has at
+ * least one mismatching edge, ordered by node and then by edge order.
+ */
+static PyObject *
+pax_mismatches(PyObject *self, PyObject *args)
+{
+	PyObject *oflags, *oedges, *oselect = NULL;
+	PyObject *flags_seq = NULL, *edges_seq = NULL, *select_seq = NULL;
+	PyObject *ret = NULL, *peers, *group, *o;
+	int32_t *flags = NULL;
+	Py_ssize_t *node = NULL, *peer = NULL, *first = NULL, *order = NULL;
+	char *select = NULL, *hit = NULL;
+	Py_ssize_t nnodes, nedges, nhits, i, j, k;
+
+	if (!PyArg_ParseTuple(args, "OO|O", &oflags, &oedges, &oselect))
+	{
+		PyErr_SetString(PaxError, "pax_mismatches: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	if((flags_seq = PySequence_Fast(oflags, "pax_mismatches: flags must be a sequence")) == NULL)
+		goto out;
+	if((edges_seq = PySequence_Fast(oedges, "pax_mismatches: edges must be a sequence")) == NULL)
+		goto out;
+	if(oselect && oselect != Py_None)
+		if((select_seq = PySequence_Fast(oselect, "pax_mismatches: select must be a sequence")) == NULL)
+			goto out;
+
+	nnodes = PySequence_Fast_GET_SIZE(flags_seq);
+	nedges = PySequence_Fast_GET_SIZE(edges_seq);
+
+	if(select_seq && PySequence_Fast_GET_SIZE(select_seq) != nnodes)
+	{
+		PyErr_SetString(PaxError, "pax_mismatches: flags and select differ in length");
+		goto out;
+	}
+
+	flags = PyMem_New(int32_t, nnodes + 1);
+	select = PyMem_New(char, nnodes + 1);
+	first = PyMem_New(Py_ssize_t, nnodes + 2);
+	node = PyMem_New(Py_ssize_t, nedges + 1);
+	peer = PyMem_New(Py_ssize_t, nedges + 1);
+	hit = PyMem_New(char, nedges + 1);
+	order = PyMem_New(Py_ssize_t, nedges + 1);
+	if(!flags || !select || !first || !node || !peer || !hit || !order)
+	{
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	for(i = 0; i < nnodes; i++)
+	{
+		long f = seq_item_as_long(flags_seq, i);
+		if(f == -1 && PyErr_Occurred())
+			goto out;
+		flags[i] = canonical_flags(f);
+
+		select[i] = 1;
+		if(select_seq)
+		{
+			int t = PyObject_IsTrue(PySequence_Fast_GET_ITEM(select_seq, i));
+			if(t < 0)
+				goto out;
+			select[i] = t;
+		}
+	}
+
+	for(i = 0; i < nedges; i++)
+	{
+		PyObject *e = PySequence_Fast_GET_ITEM(edges_seq, i);
+
+		if(!PyTuple_Check(e) || PyTuple_GET_SIZE(e) != 2)
+		{
+			PyErr_SetString(PaxError, "pax_mismatches: edges must be pairs");
+			goto out;
+		}
+
+#if PY_MAJOR_VERSION >= 3
+		node[i] = PyLong_AsSsize_t(PyTuple_GET_ITEM(e, 0));
+		peer[i] = PyLong_AsSsize_t(PyTuple_GET_ITEM(e, 1));
+#else
+		node[i] = PyInt_AsSsize_t(PyTuple_GET_ITEM(e, 0));
+		peer[i] = PyInt_AsSsize_t(PyTuple_GET_ITEM(e, 1));
+#endif
+		if(PyErr_Occurred())
+			goto out;
+
+		if(node[i] < 0 || node[i] >= nnodes || peer[i] < 0 || peer[i] >= nnodes)
+		{
+			PyErr_SetString(PaxError, "pax_mismatches: edge refers to an unknown node");
+			goto out;
+		}
+	}
+
+	// The comparison itself, a straight pass over the flag words
+	nhits = 0;
+	for(i = 0; i < nedges; i++)
+	{
+		hit[i] = select[peer[i]] && flags[node[i]] != flags[peer[i]];
+		nhits += hit[i];
+	}
+
+	// Group the hits by node with a stable counting sort
+	memset(first, 0, (nnodes + 2) * sizeof(Py_ssize_t));
+	for(i = 0; i < nedges; i++)
+		if(hit[i])
+			first[node[i] + 2]++;
+	for(i = 2; i < nnodes + 2; i++)
+		first[i] += first[i - 1];
+	for(i = 0; i < nedges; i++)
+		if(hit[i])
+			order[first[node[i] + 1]++] = i;
+
+	if((ret = PyList_New(0)) == NULL)
+		goto out;
+
+	for(i = 0, k = 0; i < nnodes && k < nhits; i++)
+	{
+		Py_ssize_t n = first[i + 1] - k;
+
+		if(n == 0)
+			continue;
+
+		if((peers = PyList_New(n)) == NULL)
+			goto fail;
+		for(j = 0; j < n; j++, k++)
+		{
+			if((o = PyLong_FromSsize_t(peer[order[k]])) == NULL)
+			{
+				Py_DECREF(peers);
+				goto fail;
+			}
+			PyList_SET_ITEM(peers, j, o);
+		}
+
+		group = Py_BuildValue("(nN)", i, peers);
+		if(group == NULL || PyList_Append(ret, group) < 0)
+		{
+			Py_XDECREF(group);
+			goto fail;
+		}
+		Py_DECREF(group);
+	}
+
+	goto out;
+
+fail:
+	Py_CLEAR(ret);
+out:
+	PyMem_Free(flags);
+	PyMem_Free(select);
+	PyMem_Free(first);
+	PyMem_Free(node);
+	PyMem_Free(peer);
+	PyMem_Free(hit);
+	PyMem_Free(order);
+	Py_XDECREF(flags_seq);
+	Py_XDECREF(edges_seq);
+	Py_XDECREF(select_seq);
+	return ret;
+}
+
+
+
+/* setioprio(ioclass, level)
+ *
+ * Set the I/O scheduling class, one of the IOPRIO_CLASS_ constants, and
+ * the level, 0 to 7, of the calling process, like ionice(1).  Processes
+ * forked afterwards, eg. the workers of a multiprocessing.Pool, inherit
+ * it.  The level is ignored for IOPRIO_CLASS_IDLE.
+ */
+static PyObject *
+pax_setioprio(PyObject *self, PyObject *args)
+{
+	int ioclass, level;
+
+	if (!PyArg_ParseTuple(args, "ii", &ioclass, &level))
+	{
+		PyErr_SetString(PaxError, "pax_setioprio: PyArg_ParseTuple failed");
+		return NULL;
+	}
+
+	if(ioclass < IOPRIO_CLASS_RT || ioclass > IOPRIO_CLASS_IDLE || level < 0 || level > 7)
+	{
+		PyErr_SetString(PaxError, "pax_setioprio: invalid class or level");
+		return NULL;
+	}
+
+	if(ioclass == IOPRIO_CLASS_IDLE)
+		level = 0;
+
+#ifdef SYS_ioprio_set
+	if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioclass << IOPRIO_CLASS_SHIFT | level) < 0)
+	{
+		PyErr_SetString(PaxError, "pax_setioprio: ioprio_set() failed");
+		return NULL;
+	}
+#else
+	PyErr_SetString(PaxError, "pax_setioprio: not supported on this system");
+	return NULL;
+#endif
+
+	Py_RETURN_NONE;
+}
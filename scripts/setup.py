@@ -36,7 +36,7 @@ if ptpax == None and xtpax != None:
 	module1 = Extension(
 		name='pax',
 		sources = ['paxmodule.c'],
-		libraries = ['attr'],
+		libraries = ['attr', 'pthread'],
 		undef_macros = ['PTPAX'],
 		define_macros = [('XTPAX', 1), ('NEED_PAX_DECLS', 1)]
 	)
@@ -63,7 +63,7 @@ else:
 			module1 = Extension(
 				name='pax',
 				sources = ['paxmodule.c'],
-				libraries = ['elf'],
+				libraries = ['elf', 'pthread'],
 				undef_macros = ['XTPAX'],
 				define_macros = [('PTPAX', 1), ('NEED_PAX_DECLS', 1)]
 			)
@@ -73,7 +73,7 @@ else:
 			module1 = Extension(
 				name='pax',
 				sources = ['paxmodule.c'],
-				libraries = ['elf', 'attr'],
+				libraries = ['elf', 'attr', 'pthread'],
 				define_macros = [('PTPAX', 1), ('XTPAX', 1), ('NEED_PAX_DECLS', 1)]
 			)
 
@@ -85,7 +85,7 @@ else:
 			module1 = Extension(
 				name='pax',
 				sources = ['paxmodule.c'],
-				libraries = ['elf'],
+				libraries = ['elf', 'pthread'],
 				undef_macros = ['XTPAX', 'NEED_PAX_DECLS'],
 				define_macros = [('PTPAX', 1)]
 			)
@@ -95,7 +95,7 @@ else:
 			module1 = Extension(
 				name='pax',
 				sources = ['paxmodule.c'],
-				libraries = ['elf', 'attr'],
+				libraries = ['elf', 'attr', 'pthread'],
 				undef_macros = ['NEED_PAX_DECLS'],
 				define_macros = [('PTPAX', 1), ('XTPAX', 1)]
 			)
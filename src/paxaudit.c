@@ -0,0 +1,421 @@
+/*
+	paxaudit.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Find running processes whose PaX flags no longer match their binary,
+ * ie. processes which were started before the binary was re-marked and
+ * need a restart to pick up the new markings.
+ *
+ * The live flags are the PaX: line of PROCFS/PID/status, which a PaX
+ * kernel gives as five letters in the order PEMRS, upper case if the
+ * feature is on and lower case if it is off.  The on-disk flags are read
+ * through PROCFS/PID/exe, so it is the inode which is running that is
+ * looked at, even if it has since been replaced.  XATTR_PAX is used if
+ * there is one, otherwise PT_PAX.
+ *
+ * Only flags which are set on disk are compared, a '-' leaves the choice
+ * to the kernel.  A feature which is not built into the kernel shows as
+ * off in every process, so a flag which is not on in any process is not
+ * compared either.
+ *
+ * There can be tens of thousands of processes but only a few hundred
+ * binaries, so the pids are shared out among a pool of threads and the
+ * on-disk flags of each binary, found by st_dev and st_ino, are read once.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "paxctl-ng.h"
+
+#define AUDIT_STATUS_SIZE	8192		/* more than any PROCFS/PID/status */
+#define AUDIT_NAME_SIZE		64
+#define AUDIT_CHUNK		64		/* pids a thread takes at a time */
+#define AUDIT_THREADS_MAX	32
+
+#define AUDIT_SKIPPED		0		/* no PaX: line or no exe, eg. a kernel thread */
+#define AUDIT_UNREADABLE	1		/* the exe is there but its flags cannot be read */
+#define AUDIT_OK		2
+#define AUDIT_STALE		3
+
+struct audit_proc
+{
+	pid_t pid;
+	int state;
+	char name[AUDIT_NAME_SIZE];
+	char live[FLAGS_SIZE];
+	char disk[FLAGS_SIZE];
+	char *exe;
+};
+
+struct audit_bin
+{
+	dev_t dev;
+	ino_t ino;
+	int used;
+	int readable;
+	char disk[FLAGS_SIZE];
+};
+
+struct audit
+{
+	const char *procfs;
+	struct audit_proc *procs;
+	size_t nprocs;
+	size_t next;				/* the next proc to be taken */
+	struct audit_bin *bins;			/* open addressing, mask + 1 slots */
+	size_t mask;
+	size_t nbins;
+	pthread_mutex_t lock;			/* guards next and bins */
+};
+
+
+/* Read the Name: and PaX: lines of PROCFS/PID/status.  Return 0 if there
+ * is a PaX: line, -1 if there is not or the process has gone.
+ */
+static int
+read_status(const char *procfs, pid_t pid, char *name, char *live)
+{
+	char path[PATH_MAX];
+	char buf[AUDIT_STATUS_SIZE];
+	char *line, *eol;
+	ssize_t n, len;
+	int fd, found;
+
+	snprintf(path, sizeof(path), "%s/%d/status", procfs, (int)pid);
+	if((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	len = 0;
+	while(len < (ssize_t)sizeof(buf) - 1 && (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += n;
+	close(fd);
+	buf[len] = 0;
+
+	found = 0;
+	for(line = buf; line < buf + len; line = eol + 1)
+	{
+		if((eol = strchr(line, '\n')) == NULL)
+			eol = buf + len;
+		*eol = 0;
+
+		if(strncmp(line, "Name:\t", 6) == 0)
+		{
+			strncpy(name, line + 6, AUDIT_NAME_SIZE - 1);
+			name[AUDIT_NAME_SIZE - 1] = 0;
+		}
+		else if(strncmp(line, "PaX:\t", 5) == 0 && strlen(line + 5) >= FLAGS_SIZE - 1)
+		{
+			memcpy(live, line + 5, FLAGS_SIZE - 1);
+			live[FLAGS_SIZE - 1] = 0;
+			found = 1;
+		}
+	}
+
+	return found ? 0 : -1;
+}
+
+
+static void
+read_disk_flags(int fd, char *disk)
+{
+	uint16_t flags = UINT16_MAX;
+
+#ifdef XTPAX
+	flags = get_xt_flags(fd);
+#endif
+#ifdef PTPAX
+	if(flags == UINT16_MAX)
+		flags = nocache_get_pt_flags(fd, 0);
+#endif
+
+	memset(disk, 0, FLAGS_SIZE);
+	if(flags == UINT16_MAX)
+		memset(disk, '-', FLAGS_SIZE - 1);
+	else
+		bin2string4print(flags, disk);
+}
+
+
+/* Return the slot for dev and ino, used or not.  Call with the lock held. */
+static struct audit_bin *
+find_bin(struct audit *a, dev_t dev, ino_t ino)
+{
+	size_t i;
+
+	i = ((uint64_t)ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t)dev) & a->mask;
+	while(a->bins[i].used && (a->bins[i].dev != dev || a->bins[i].ino != ino))
+		i = (i + 1) & a->mask;
+
+	return &a->bins[i];
+}
+
+
+static void
+audit_one(struct audit *a, struct audit_proc *p)
+{
+	char path[PATH_MAX], link[PATH_MAX];
+	char disk[FLAGS_SIZE];
+	struct audit_bin *b;
+	struct stat st;
+	ssize_t n;
+	int fd, found, readable;
+
+	if(read_status(a->procfs, p->pid, p->name, p->live) < 0)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%d/exe", a->procfs, (int)p->pid);
+	if((n = readlink(path, link, sizeof(link) - 1)) < 0)
+		return;
+	link[n] = 0;
+	if((p->exe = strdup(link)) == NULL)
+		err(EXIT_FAILURE, "strdup");
+
+	p->state = AUDIT_UNREADABLE;
+	if(stat(path, &st) < 0)
+		return;
+
+	pthread_mutex_lock(&a->lock);
+	b = find_bin(a, st.st_dev, st.st_ino);
+	found = b->used;
+	readable = b->readable;
+	memcpy(disk, b->disk, FLAGS_SIZE);
+	pthread_mutex_unlock(&a->lock);
+
+	// Two threads may both miss on the same binary, then both read it
+	if(!found)
+	{
+		readable = 0;
+		if((fd = nocache_open(path)) >= 0)
+		{
+			read_disk_flags(fd, disk);
+			close(fd);
+			readable = 1;
+			throttle(st.st_size);
+		}
+
+		pthread_mutex_lock(&a->lock);
+		b = find_bin(a, st.st_dev, st.st_ino);
+		if(!b->used)
+		{
+			b->dev = st.st_dev;
+			b->ino = st.st_ino;
+			b->used = 1;
+			b->readable = readable;
+			memcpy(b->disk, disk, FLAGS_SIZE);
+			a->nbins++;
+		}
+		pthread_mutex_unlock(&a->lock);
+	}
+
+	if(readable)
+	{
+		memcpy(p->disk, disk, FLAGS_SIZE);
+		p->state = AUDIT_OK;
+	}
+}
+
+
+static void *
+audit_thread(void *arg)
+{
+	struct audit *a = arg;
+	size_t i, end;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&a->lock);
+		i = a->next;
+		end = a->nprocs - i > AUDIT_CHUNK ? i + AUDIT_CHUNK : a->nprocs;
+		a->next = end;
+		pthread_mutex_unlock(&a->lock);
+
+		if(i == end)
+			break;
+
+		for(; i < end; i++)
+			audit_one(a, &a->procs[i]);
+	}
+
+	return NULL;
+}
+
+
+static int
+cmp_proc(const void *x, const void *y)
+{
+	pid_t px = ((const struct audit_proc *)x)->pid;
+	pid_t py = ((const struct audit_proc *)y)->pid;
+
+	return px < py ? -1 : px > py;
+}
+
+
+static void
+list_procs(struct audit *a)
+{
+	DIR *dir;
+	struct dirent *de;
+	char *end;
+	long pid;
+	size_t size = 0;
+
+	if((dir = opendir(a->procfs)) == NULL)
+		err(EXIT_FAILURE, "cannot open %s", a->procfs);
+
+	while((de = readdir(dir)) != NULL)
+	{
+		pid = strtol(de->d_name, &end, 10);
+		if(*end != 0 || end == de->d_name || pid <= 0)
+			continue;
+
+		if(a->nprocs == size)
+		{
+			size = size ? 2 * size : 1024;
+			if((a->procs = realloc(a->procs, size * sizeof(struct audit_proc))) == NULL)
+				err(EXIT_FAILURE, "realloc");
+		}
+
+		memset(&a->procs[a->nprocs], 0, sizeof(struct audit_proc));
+		a->procs[a->nprocs++].pid = (pid_t)pid;
+	}
+
+	closedir(dir);
+
+	qsort(a->procs, a->nprocs, sizeof(struct audit_proc), cmp_proc);
+}
+
+
+static void
+print_proc(struct audit_proc *p, int json)
+{
+	const char *state;
+
+	if(json)
+	{
+		printf("{\"pid\":%d,\"name\":", (int)p->pid);
+		print_json_string(p->name);
+		printf(",\"exe\":");
+		print_json_string(p->exe);
+		printf(",\"live\":\"%s\"", p->live);
+		if(p->state == AUDIT_UNREADABLE)
+			printf(",\"disk\":null,\"stale\":false,\"error\":\"open() failed\"}\n");
+		else
+			printf(",\"disk\":\"%s\",\"stale\":%s}\n", p->disk,
+				p->state == AUDIT_STALE ? "true" : "false");
+		return;
+	}
+
+	state = p->state == AUDIT_STALE ? "stale" :
+		p->state == AUDIT_OK ? "ok" : "unreadable";
+
+	printf("%d\t%s\t%s\t%s\t%s\t%s\n", (int)p->pid, state, p->live,
+		p->state == AUDIT_UNREADABLE ? "?????" : p->disk, p->name, p->exe);
+}
+
+
+int
+audit_procs(const char *procfs, int verbose, int json)
+{
+	struct audit a;
+	struct audit_proc *p;
+	pthread_t threads[AUDIT_THREADS_MAX];
+	int supported[FLAGS_SIZE - 1];
+	long nthreads;
+	size_t i, nstale, nunreadable, nskipped;
+	int t, started;
+
+	memset(&a, 0, sizeof(a));
+	a.procfs = procfs;
+	pthread_mutex_init(&a.lock, NULL);
+
+	list_procs(&a);
+
+	// Twice as many slots as there can be binaries, so it never fills up
+	for(a.mask = 1; a.mask < 2 * a.nprocs; a.mask <<= 1)
+		;
+	if((a.bins = calloc(a.mask, sizeof(struct audit_bin))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	a.mask--;
+
+	if((nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nthreads = 1;
+	if(nthreads > AUDIT_THREADS_MAX)
+		nthreads = AUDIT_THREADS_MAX;
+	if(nthreads > (long)(a.nprocs / AUDIT_CHUNK) + 1)
+		nthreads = a.nprocs / AUDIT_CHUNK + 1;
+
+	for(started = 0; started < nthreads - 1; started++)
+		if(pthread_create(&threads[started], NULL, audit_thread, &a) != 0)
+			break;
+	audit_thread(&a);
+	for(t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+
+	memset(supported, 0, sizeof(supported));
+	for(i = 0; i < a.nprocs; i++)
+		for(t = 0; t < FLAGS_SIZE - 1 && a.procs[i].live[t]; t++)
+			if(a.procs[i].live[t] >= 'A' && a.procs[i].live[t] <= 'Z')
+				supported[t] = 1;
+
+	nstale = nunreadable = nskipped = 0;
+	for(i = 0; i < a.nprocs; i++)
+	{
+		p = &a.procs[i];
+
+		if(p->state == AUDIT_OK)
+			for(t = 0; t < FLAGS_SIZE - 1; t++)
+				if(p->disk[t] != '-' && supported[t] && p->disk[t] != p->live[t])
+					p->state = AUDIT_STALE;
+
+		if(p->state == AUDIT_SKIPPED)
+			nskipped++;
+		else
+		{
+			if(p->state == AUDIT_STALE)
+				nstale++;
+			else if(p->state == AUDIT_UNREADABLE)
+				nunreadable++;
+
+			if(json || verbose || p->state == AUDIT_STALE)
+				print_proc(p, json);
+		}
+
+		free(p->exe);
+	}
+
+	if(verbose)
+		printf("%zu processes, %zu binaries, %zu stale, %zu unreadable, %zu skipped\n",
+			a.nprocs, a.nbins, nstale, nunreadable, nskipped);
+
+	free(a.procs);
+	free(a.bins);
+	pthread_mutex_destroy(&a.lock);
+
+	return nstale ? EXIT_STALE : EXIT_SUCCESS;
+}
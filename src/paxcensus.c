@@ -0,0 +1,573 @@
+/*
+	paxcensus.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Count what marking the ELF objects under some roots would take, before
+ * a PT_PAX or XATTR_PAX policy is rolled out.  Each ELF is classified by
+ *
+ *	its type:	exec	ET_EXEC
+ *			pie	ET_DYN with a PT_INTERP
+ *			dyn	any other ET_DYN, ie. libraries and static-pie
+ *			other	ET_REL, ET_CORE and the rest
+ *
+ *	its phdrs:	pt_pax		there is a PT_PAX_FLAGS phdr
+ *			gnu_stack	only a PT_GNU_STACK, which paxctl -c can convert
+ *			free_slot	a PT_NULL phdr which could take PT_PAX_FLAGS
+ *			no_room		none of them, PT_PAX is out of reach
+ *
+ *	and whether it has an XATTR_PAX, counting per filesystem whether it
+ *	takes user.* xattrs at all, as far as reading them tells.
+ *
+ * Only the ELF header and the phdrs are read, through read_elf_headers(),
+ * so --nocache applies.  The roots are walked by a pool of threads sharing
+ * a stack of directories, each keeping its own counts which are added up
+ * at the end.  Symlinks are not followed, and pseudo filesystems like
+ * /proc and /sys are not entered.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/sysmacros.h>
+#include <elf.h>
+
+#include "paxctl-ng.h"
+
+#define CENSUS_THREADS_MAX	32
+#define CENSUS_DEVS_MAX		64		/* filesystems counted apart, the rest are lumped */
+#define CENSUS_MOUNTINFO	"/proc/self/mountinfo"
+#define CENSUS_FSTYPE_SIZE	64
+
+#define CENSUS_EXEC		0
+#define CENSUS_PIE		1
+#define CENSUS_DYN		2
+#define CENSUS_OTHER		3
+#define CENSUS_TYPES		4
+
+#define CENSUS_PT_PAX		0
+#define CENSUS_GNU_STACK	1
+#define CENSUS_FREE_SLOT	2
+#define CENSUS_NO_ROOM		3
+#define CENSUS_PHDRS		4
+
+#define CENSUS_XATTR_UNKNOWN	0
+#define CENSUS_XATTR_OK		1
+#define CENSUS_XATTR_REJECTED	2
+
+static const char *census_types[CENSUS_TYPES] = { "exec", "pie", "dyn", "other" };
+static const char *census_phdrs[CENSUS_PHDRS] = { "pt_pax", "gnu_stack", "free_slot", "no_room" };
+
+struct census_dev
+{
+	dev_t dev;
+	int xattr;
+	size_t elfs;
+};
+
+struct census_counts
+{
+	size_t files;				/* regular files looked at */
+	size_t elfs;
+	size_t unreadable;			/* files and directories which could not be opened */
+	size_t type[CENSUS_TYPES];
+	size_t phdrs[CENSUS_PHDRS];
+	size_t xt;				/* with an XATTR_PAX */
+	struct census_dev devs[CENSUS_DEVS_MAX];
+	size_t ndevs;
+};
+
+struct census
+{
+	char **dirs;				/* the stack of directories still to walk */
+	size_t ndirs, size;
+	int busy;				/* threads walking a directory, which may push more */
+	int verbose, json;
+	struct census_counts total;
+	pthread_mutex_t lock;			/* guards all of the above */
+	pthread_cond_t more;
+};
+
+
+// Pseudo filesystems, whose files are not ELF objects and may not like being read
+static int
+pseudo_fs(int fd)
+{
+	struct statfs sfs;
+
+	if(fstatfs(fd, &sfs) < 0)
+		return 0;
+
+	switch((unsigned long)sfs.f_type)
+	{
+		case 0x9fa0:			/* PROC_SUPER_MAGIC */
+		case 0x62656572:		/* SYSFS_MAGIC */
+		case 0x1cd1:			/* DEVPTS_SUPER_MAGIC */
+		case 0x64626720:		/* DEBUGFS_MAGIC */
+		case 0x74726163:		/* TRACEFS_MAGIC */
+		case 0x73636673:		/* SECURITYFS_MAGIC */
+		case 0x27e0eb:			/* CGROUP_SUPER_MAGIC */
+		case 0x63677270:		/* CGROUP2_SUPER_MAGIC */
+		case 0xcafe4a11:		/* BPF_FS_MAGIC */
+		case 0x6165676c:		/* PSTOREFS_MAGIC */
+		case 0x62656570:		/* CONFIGFS_MAGIC */
+		case 0xde5e81e4:		/* EFIVARFS_MAGIC */
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static struct census_dev *
+find_dev(struct census_counts *c, dev_t dev)
+{
+	size_t i;
+
+	for(i = 0; i < c->ndevs; i++)
+		if(c->devs[i].dev == dev)
+			return &c->devs[i];
+
+	if(c->ndevs == CENSUS_DEVS_MAX)
+		return NULL;
+
+	memset(&c->devs[c->ndevs], 0, sizeof(struct census_dev));
+	c->devs[c->ndevs].dev = dev;
+	return &c->devs[c->ndevs++];
+}
+
+
+static void
+push_dir(struct census *c, const char *path)
+{
+	char *dir;
+
+	if((dir = strdup(path)) == NULL)
+		err(EXIT_FAILURE, "strdup");
+
+	pthread_mutex_lock(&c->lock);
+	if(c->ndirs == c->size)
+	{
+		c->size = c->size ? 2 * c->size : 1024;
+		if((c->dirs = realloc(c->dirs, c->size * sizeof(char *))) == NULL)
+			err(EXIT_FAILURE, "realloc");
+	}
+	c->dirs[c->ndirs++] = dir;
+	pthread_cond_signal(&c->more);
+	pthread_mutex_unlock(&c->lock);
+}
+
+
+// Take a directory to walk, NULL once there are none left and none can come
+static char *
+pop_dir(struct census *c)
+{
+	char *dir = NULL;
+
+	pthread_mutex_lock(&c->lock);
+	while(c->ndirs == 0 && c->busy > 0)
+		pthread_cond_wait(&c->more, &c->lock);
+
+	if(c->ndirs > 0)
+	{
+		dir = c->dirs[--c->ndirs];
+		c->busy++;
+	}
+	else
+		pthread_cond_broadcast(&c->more);
+	pthread_mutex_unlock(&c->lock);
+
+	return dir;
+}
+
+
+static void
+done_dir(struct census *c)
+{
+	pthread_mutex_lock(&c->lock);
+	if(--c->busy == 0 && c->ndirs == 0)
+		pthread_cond_broadcast(&c->more);
+	pthread_mutex_unlock(&c->lock);
+}
+
+
+static void
+print_file(const char *path, int type, int phdrs, int xt, int json)
+{
+	flockfile(stdout);
+
+	if(json)
+	{
+		printf("{\"path\":");
+		print_json_string(path);
+		printf(",\"type\":\"%s\",\"phdrs\":\"%s\",\"xt\":%s}\n", census_types[type],
+			census_phdrs[phdrs], xt < 0 ? "null" : xt ? "true" : "false");
+	}
+	else
+		printf("%s\t%s\t%s\t%s\n", census_types[type], census_phdrs[phdrs],
+			xt < 0 ? "?" : xt ? "xt" : "-", path);
+
+	funlockfile(stdout);
+}
+
+
+static void
+census_file(struct census *c, struct census_counts *n, const char *path)
+{
+	struct elf_phdr_counts pc;
+	struct census_dev *d;
+	struct stat st;
+	unsigned char *image;
+	size_t len;
+	int fd, type, phdrs, xt = -1;
+#ifdef XTPAX
+	char buf[FLAGS_SIZE];
+#endif
+
+	n->files++;
+
+	if((fd = nocache_open(path)) < 0)
+	{
+		n->unreadable++;
+		return;
+	}
+
+	if(fstat(fd, &st) < 0 || (image = read_elf_headers(fd, &len)) == NULL)
+	{
+		close(fd);
+		return;
+	}
+
+	if(elf_count_phdrs(image, len, &pc) < 0)
+	{
+		free(image);
+		close(fd);
+		return;
+	}
+	free(image);
+
+	if(pc.type == ET_EXEC)
+		type = CENSUS_EXEC;
+	else if(pc.type == ET_DYN)
+		type = pc.interp ? CENSUS_PIE : CENSUS_DYN;
+	else
+		type = CENSUS_OTHER;
+
+	if(pc.pt_pax)
+		phdrs = CENSUS_PT_PAX;
+	else if(pc.gnu_stack)
+		phdrs = CENSUS_GNU_STACK;
+	else if(pc.null)
+		phdrs = CENSUS_FREE_SLOT;
+	else
+		phdrs = CENSUS_NO_ROOM;
+
+	d = find_dev(n, st.st_dev);
+
+#ifdef XTPAX
+	// Reading XATTR_PAX also tells whether the filesystem takes user.* xattrs
+	if(fgetxattr(fd, PAX_NAMESPACE, buf, sizeof(buf)) >= 0 || errno == ERANGE)
+	{
+		xt = 1;
+		if(d)
+			d->xattr = CENSUS_XATTR_OK;
+	}
+	else if(errno == ENODATA)
+	{
+		xt = 0;
+		if(d)
+			d->xattr = CENSUS_XATTR_OK;
+	}
+	else if(errno == ENOTSUP && d && d->xattr == CENSUS_XATTR_UNKNOWN)
+		d->xattr = CENSUS_XATTR_REJECTED;
+#endif
+
+	throttle(st.st_size);
+	close(fd);
+
+	n->elfs++;
+	n->type[type]++;
+	n->phdrs[phdrs]++;
+	if(xt == 1)
+		n->xt++;
+	if(d)
+		d->elfs++;
+
+	if(c->verbose || c->json)
+		print_file(path, type, phdrs, xt, c->json);
+}
+
+
+static void
+census_dir(struct census *c, struct census_counts *n, const char *dir)
+{
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	char path[PATH_MAX];
+	int type;
+
+	if((d = opendir(dir)) == NULL)
+	{
+		n->unreadable++;
+		return;
+	}
+
+	if(pseudo_fs(dirfd(d)))
+	{
+		closedir(d);
+		return;
+	}
+
+	while((de = readdir(d)) != NULL)
+	{
+		if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if(snprintf(path, sizeof(path), "%s/%s", strcmp(dir, "/") ? dir : "", de->d_name)
+				>= (int)sizeof(path))
+		{
+			n->unreadable++;
+			continue;
+		}
+
+		type = de->d_type;
+		if(type == DT_UNKNOWN)
+		{
+			if(fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+				continue;
+			type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+
+		if(type == DT_DIR)
+			push_dir(c, path);
+		else if(type == DT_REG)
+			census_file(c, n, path);
+	}
+
+	closedir(d);
+}
+
+
+static void
+add_counts(struct census_counts *to, struct census_counts *from)
+{
+	struct census_dev *d;
+	size_t i;
+
+	to->files += from->files;
+	to->elfs += from->elfs;
+	to->unreadable += from->unreadable;
+	to->xt += from->xt;
+	for(i = 0; i < CENSUS_TYPES; i++)
+		to->type[i] += from->type[i];
+	for(i = 0; i < CENSUS_PHDRS; i++)
+		to->phdrs[i] += from->phdrs[i];
+
+	for(i = 0; i < from->ndevs; i++)
+	{
+		if((d = find_dev(to, from->devs[i].dev)) == NULL)
+			continue;
+		d->elfs += from->devs[i].elfs;
+		if(d->xattr == CENSUS_XATTR_UNKNOWN || from->devs[i].xattr == CENSUS_XATTR_OK)
+			d->xattr = from->devs[i].xattr;
+	}
+}
+
+
+static void *
+census_thread(void *arg)
+{
+	struct census *c = arg;
+	struct census_counts *n;
+	char *dir;
+
+	// Too big for the stack of a thread
+	if((n = calloc(1, sizeof(struct census_counts))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	while((dir = pop_dir(c)) != NULL)
+	{
+		census_dir(c, n, dir);
+		free(dir);
+		done_dir(c);
+	}
+
+	pthread_mutex_lock(&c->lock);
+	add_counts(&c->total, n);
+	pthread_mutex_unlock(&c->lock);
+
+	free(n);
+	return NULL;
+}
+
+
+/* Find where dev is mounted and as what in /proc/self/mountinfo, whose
+ * lines go "ID PARENT MAJOR:MINOR ROOT MOUNTPOINT OPTIONS ... - FSTYPE ...".
+ * mount must have room for PATH_MAX and fstype for CENSUS_FSTYPE_SIZE.
+ * Return -1 if it is not there.
+ */
+static int
+find_mount(dev_t dev, char *mount, char *fstype)
+{
+	FILE *f;
+	char line[2 * PATH_MAX], *sep;
+	unsigned int maj, min;
+	int found = -1;
+
+	if((f = fopen(CENSUS_MOUNTINFO, "r")) == NULL)
+		return -1;
+
+	while(found < 0 && fgets(line, sizeof(line), f))
+	{
+		if(sscanf(line, "%*s %*s %u:%u %*s %4095s", &maj, &min, mount) != 3
+				|| makedev(maj, min) != dev)
+			continue;
+		if((sep = strstr(line, " - ")) != NULL && sscanf(sep + 3, "%63s", fstype) == 1)
+			found = 0;
+	}
+
+	fclose(f);
+	return found;
+}
+
+
+static void
+print_counts(struct census_counts *n, int json)
+{
+	char mount[PATH_MAX], fstype[CENSUS_FSTYPE_SIZE];
+	const char *xattr;
+	size_t i;
+
+	if(json)
+	{
+		printf("{\"files\":%zu,\"elfs\":%zu,\"unreadable\":%zu,\"type\":{", n->files, n->elfs, n->unreadable);
+		for(i = 0; i < CENSUS_TYPES; i++)
+			printf("%s\"%s\":%zu", i ? "," : "", census_types[i], n->type[i]);
+		printf("},\"phdrs\":{");
+		for(i = 0; i < CENSUS_PHDRS; i++)
+			printf("%s\"%s\":%zu", i ? "," : "", census_phdrs[i], n->phdrs[i]);
+		printf("},\"xt\":%zu,\"filesystems\":[", n->xt);
+	}
+	else
+	{
+		printf("%zu files, %zu ELF objects, %zu unreadable\n", n->files, n->elfs, n->unreadable);
+		printf("type :");
+		for(i = 0; i < CENSUS_TYPES; i++)
+			printf(" %zu %s", n->type[i], census_types[i]);
+		printf("\nphdrs:");
+		for(i = 0; i < CENSUS_PHDRS; i++)
+			printf(" %zu %s", n->phdrs[i], census_phdrs[i]);
+		printf("\nxattr: %zu with XATTR_PAX\n", n->xt);
+	}
+
+	for(i = 0; i < n->ndevs; i++)
+	{
+		if(find_mount(n->devs[i].dev, mount, fstype) < 0)
+		{
+			snprintf(mount, sizeof(mount), "%u:%u", major(n->devs[i].dev), minor(n->devs[i].dev));
+			strcpy(fstype, "?");
+		}
+
+		if(json)
+		{
+			xattr = n->devs[i].xattr == CENSUS_XATTR_OK ? "true" :
+				n->devs[i].xattr == CENSUS_XATTR_REJECTED ? "false" : "null";
+			printf("%s{\"mount\":", i ? "," : "");
+			print_json_string(mount);
+			printf(",\"fstype\":");
+			print_json_string(fstype);
+			printf(",\"xattr\":%s,\"elfs\":%zu}", xattr, n->devs[i].elfs);
+		}
+		else
+		{
+			xattr = n->devs[i].xattr == CENSUS_XATTR_OK ? "takes user.* xattrs" :
+				n->devs[i].xattr == CENSUS_XATTR_REJECTED ? "rejects user.* xattrs" : "user.* xattrs unknown";
+			printf("fs   : %s\t%s\t%zu ELF objects\t%s\n", mount, fstype, n->devs[i].elfs, xattr);
+		}
+	}
+
+	if(json)
+		printf("]}\n");
+}
+
+
+int
+census_roots(char *roots[], int nroots, int verbose, int json)
+{
+	struct census c;
+	struct census_counts *n;
+	struct stat st;
+	pthread_t threads[CENSUS_THREADS_MAX];
+	long nthreads;
+	int i, started, ret = EXIT_SUCCESS;
+
+	memset(&c, 0, sizeof(c));
+	c.verbose = verbose;
+	c.json = json;
+	pthread_mutex_init(&c.lock, NULL);
+	pthread_cond_init(&c.more, NULL);
+
+	if((n = calloc(1, sizeof(struct census_counts))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	// A root may be a file of its own, those are done here and now
+	for(i = 0; i < nroots; i++)
+	{
+		if(lstat(roots[i], &st) < 0)
+		{
+			warn("%s", roots[i]);
+			ret = EXIT_FAILURE;
+		}
+		else if(S_ISDIR(st.st_mode))
+			push_dir(&c, roots[i]);
+		else if(S_ISREG(st.st_mode))
+			census_file(&c, n, roots[i]);
+	}
+	add_counts(&c.total, n);
+	free(n);
+
+	if((nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nthreads = 1;
+	if(nthreads > CENSUS_THREADS_MAX)
+		nthreads = CENSUS_THREADS_MAX;
+
+	for(started = 0; started < nthreads - 1; started++)
+		if(pthread_create(&threads[started], NULL, census_thread, &c) != 0)
+			break;
+	census_thread(&c);
+	for(i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	print_counts(&c.total, json);
+
+	free(c.dirs);
+	pthread_mutex_destroy(&c.lock);
+	pthread_cond_destroy(&c.more);
+
+	return ret;
+}
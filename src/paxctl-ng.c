@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -28,43 +29,7 @@
 #include <unistd.h>
 #include <errno.h>
 
-#ifdef PTPAX
- #include <gelf.h>
-#endif
-
-#ifdef NEED_PAX_DECLS
- #define PT_PAX_FLAGS    0x65041580      /* Indicates PaX flag markings */
- #define PF_PAGEEXEC     (1 << 4)        /* Enable  PAGEEXEC */
- #define PF_NOPAGEEXEC   (1 << 5)        /* Disable PAGEEXEC */
- #define PF_SEGMEXEC     (1 << 6)        /* Enable  SEGMEXEC */
- #define PF_NOSEGMEXEC   (1 << 7)        /* Disable SEGMEXEC */
- #define PF_MPROTECT     (1 << 8)        /* Enable  MPROTECT */
- #define PF_NOMPROTECT   (1 << 9)        /* Disable MPROTECT */
- #define PF_RANDEXEC     (1 << 10)       /* DEPRECATED: Enable  RANDEXEC */
- #define PF_NORANDEXEC   (1 << 11)       /* DEPRECATED: Disable RANDEXEC */
- #define PF_EMUTRAMP     (1 << 12)       /* Enable  EMUTRAMP */
- #define PF_NOEMUTRAMP   (1 << 13)       /* Disable EMUTRAMP */
- #define PF_RANDMMAP     (1 << 14)       /* Enable  RANDMMAP */
- #define PF_NORANDMMAP   (1 << 15)       /* Disable RANDMMAP */
-#endif
-
-#ifdef XTPAX
- #include <attr/xattr.h>
- #define PAX_NAMESPACE	"user.pax.flags"
- #define CREATE_XT_FLAGS_SECURE         1
- #define CREATE_XT_FLAGS_DEFAULT        2
- #define DELETE_XT_FLAGS                3
-#endif
-
-#if defined(PTPAX) && defined(XTPAX)
- #define COPY_PT_TO_XT_FLAGS            4
- #define COPY_XT_TO_PT_FLAGS            5
-#endif
-
-#define LIMIT_TO_PT_FLAGS               6
-#define LIMIT_TO_XT_FLAGS               7
-
-#define FLAGS_SIZE                      6
+#include "paxctl-ng.h"
 
 #include <config.h>
 
@@ -78,17 +43,22 @@ print_help_exit(char *v)
 		"Program Name : %s\n"
 		"Description  : Get or set pax flags on an ELF object\n\n"
 #if defined(PTPAX) && defined(XTPAX)
-		"Usage        : %s -PpEeMmRrSs|-Z|-z [-L|-l] [-v] ELF\n"
+		"Usage        : %s -PpEeMmRrSs|-Z|-z [-L|-l] [-n] [-v|--json] [--sysroot DIR] ELF\n"
 #else
-		"Usage        : %s -PpEeMmRrSs|-Z|-z [-v] ELF\n"
+		"Usage        : %s -PpEeMmRrSs|-Z|-z [-n] [-v|--json] [--sysroot DIR] ELF\n"
 #endif
 #ifdef XTPAX
-		"             : %s -C|-c|-d [-v] ELF\n"
+		"             : %s -C|-c|-d [-n] [-v|--json] [--sysroot DIR] ELF\n"
 #endif
 #if defined(PTPAX) && defined(XTPAX)
-		"             : %s -F|-f [-v] ELF\n"
-#endif
-		"             : %s -v ELF\n"
+		"             : %s -F|-f [-n] [-v|--json] [--sysroot DIR] ELF\n"
+#endif
+		"             : %s -v|--json [--nocache] [--sysroot DIR] ELF\n"
+		"             : %s --tar RULES [-L|-l] [-v] < IN.tar > OUT.tar\n"
+		"             : %s --audit [--procfs DIR] [--nocache] [-v|--json]\n"
+		"             : %s --census [--nocache] [-v|--json] ROOT...\n"
+		"             : %s --serve SOCKET\n"
+		"             : %s --connect SOCKET OPTIONS ELF...\n"
 		"             : %s -L|-l\n"
 		"             : %s [-h]\n\n"
 		"Options      : -P enable PAGEEXEC\t-p disable  PAGEEXEC\n"
@@ -120,8 +90,29 @@ print_help_exit(char *v)
 #else
 		"             : -l when given alone, EXIT_FAILURE (XATTR_PAX is not supported)\n"
 #endif
+		"             : -n exit with 2 if no ELF needed a change\n"
 		"             : -v view the flags, along with any accompanying operation\n"
-		"             : -h print out this help\n\n"
+		"             : -h print out this help\n"
+		"             :\n"
+		"             : --json print one JSON object per ELF instead of -v\n"
+		"             : --tar RULES mark the ELF members of a tar stream, see paxctl-ng(1)\n"
+		"             : --audit list processes whose flags differ from their binary,\n"
+		"             :         exit with 2 if there are any\n"
+		"             : --procfs DIR audit the proc filesystem mounted on DIR, default /proc\n"
+		"             : --census count the ELFs under ROOT... by type, room for PT_PAX\n"
+		"             :          and XATTR_PAX, -v or --json for each ELF too\n"
+		"             : --serve SOCKET take requests on the UNIX socket SOCKET\n"
+		"             : --connect SOCKET have the server on SOCKET do the work\n"
+		"             : --nocache with -v, --json, --audit or --census, only read the ELF and\n"
+		"             :           program headers and leave the page cache as it was\n"
+		"             : --sysroot DIR take each ELF as a path inside the image DIR, resolved\n"
+		"             :           as from a chroot into it, to mark it from the build host\n"
+		"             :\n"
+		"             : With many ELFs, --audit, --census or --serve:\n"
+		"             : --ioprio CLASS[:LEVEL] the I/O class, rt, be or idle, and level 0-7\n"
+		"             : --files-per-sec N at most N ELFs per second\n"
+		"             : --bytes-per-sec N[KMG] at most N bytes of ELFs per second\n"
+		"             : --psi-io PERCENT wait while the io pressure is above PERCENT\n\n"
 		"Note         :  If both enabling and disabling flags are set, the default - is used\n\n",
 		basename(v),
 		basename(v),
@@ -131,6 +122,11 @@ print_help_exit(char *v)
 #if defined(PTPAX) && defined(XTPAX)
 		basename(v),
 #endif
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
 		basename(v),
 		basename(v),
 		basename(v)
@@ -140,11 +136,48 @@ print_help_exit(char *v)
 }
 
 
+#define OPT_TAR		256
+#define OPT_JSON	257
+#define OPT_AUDIT	258
+#define OPT_PROCFS	259
+#define OPT_SERVE	260
+#define OPT_CONNECT	261
+#define OPT_IOPRIO	262
+#define OPT_FILES	263
+#define OPT_BYTES	264
+#define OPT_PSI		265
+#define OPT_NOCACHE	266
+#define OPT_CENSUS	267
+#define OPT_SYSROOT	268
+
+// Report in 64 KiB chunks rather than per line
+#define JSON_BUFSIZ	65536
+
+static struct option long_opts[] = {
+	{ "tar", required_argument, NULL, OPT_TAR },
+	{ "json", no_argument, NULL, OPT_JSON },
+	{ "audit", no_argument, NULL, OPT_AUDIT },
+	{ "procfs", required_argument, NULL, OPT_PROCFS },
+	{ "serve", required_argument, NULL, OPT_SERVE },
+	{ "connect", required_argument, NULL, OPT_CONNECT },
+	{ "ioprio", required_argument, NULL, OPT_IOPRIO },
+	{ "files-per-sec", required_argument, NULL, OPT_FILES },
+	{ "bytes-per-sec", required_argument, NULL, OPT_BYTES },
+	{ "psi-io", required_argument, NULL, OPT_PSI },
+	{ "nocache", no_argument, NULL, OPT_NOCACHE },
+	{ "census", no_argument, NULL, OPT_CENSUS },
+	{ "sysroot", required_argument, NULL, OPT_SYSROOT },
+	{ NULL, 0, NULL, 0 }
+};
+
+
 void
 parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *cp_flags,
-	int *limit, int *begin, int *end)
+	int *limit, int *nochange, int *json, int *begin, int *end, char **tar_rules,
+	int *audit, char **procfs, char **serve_path, char **connect_path, struct throttle_opts *throttle,
+	int *nocache, int *census, char **sysroot)
 {
-	int i, oc;
+	int oc;
 	int setflags, solflags, limitflags, solitaire;
 
 	setflags = 0;
@@ -155,13 +188,24 @@ parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *c
 	*pax_flags = 0;
 	*verbose = 0;
 	*cp_flags = 0; 
+	*nochange = 0;
+	*json = 0;
+	*tar_rules = NULL;
+	*audit = 0;
+	*procfs = NULL;
+	*serve_path = NULL;
+	*connect_path = NULL;
+	memset(throttle, 0, sizeof(struct throttle_opts));
+	*nocache = 0;
+	*census = 0;
+	*sysroot = NULL;
 
 #if defined(PTPAX) && defined(XTPAX)
-	while((oc = getopt(argc, argv,":PpEeMmRrSsZzCcdFfLlvh")) != -1)
+	while((oc = getopt_long(argc, argv, ":PpEeMmRrSsZzCcdFfLlnvh", long_opts, NULL)) != -1)
 #elif defined(XTPAX) && !defined(PTPAX)
-	while((oc = getopt(argc, argv,":PpEeMmRrSsZzCcdLlvh")) != -1)
+	while((oc = getopt_long(argc, argv, ":PpEeMmRrSsZzCcdLlnvh", long_opts, NULL)) != -1)
 #else
-	while((oc = getopt(argc, argv,":PpEeMmRrSsZzLlvh")) != -1)
+	while((oc = getopt_long(argc, argv, ":PpEeMmRrSsZzLlnvh", long_opts, NULL)) != -1)
 #endif
 	{
 		switch(oc)
@@ -249,21 +293,119 @@ parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *c
 				limitflags += 1;
 				*limit = LIMIT_TO_XT_FLAGS;
 				break;
+			case 'n':
+				*nochange = 1;
+				break;
 			case 'v':
 				*verbose = 1;
 				break;
 			case 'h':
 				print_help_exit(argv[0]);
 				break;
+			case OPT_TAR:
+				*tar_rules = optarg;
+				break;
+			case OPT_JSON:
+				*json = 1;
+				break;
+			case OPT_AUDIT:
+				*audit = 1;
+				break;
+			case OPT_PROCFS:
+				*procfs = optarg;
+				break;
+			case OPT_SERVE:
+				*serve_path = optarg;
+				break;
+			case OPT_CONNECT:
+				*connect_path = optarg;
+				break;
+			case OPT_IOPRIO:
+				throttle->ioprio = optarg;
+				break;
+			case OPT_FILES:
+				throttle->files = optarg;
+				break;
+			case OPT_BYTES:
+				throttle->bytes = optarg;
+				break;
+			case OPT_PSI:
+				throttle->psi = optarg;
+				break;
+			case OPT_NOCACHE:
+				*nocache = 1;
+				break;
+			case OPT_CENSUS:
+				*census = 1;
+				break;
+			case OPT_SYSROOT:
+				*sysroot = optarg;
+				break;
 			case '?':
 			default:
 				errx(EXIT_FAILURE, "option -%c is invalid: ignored.", optopt ) ;
 		}
 	}
 
+	if(*procfs && !*audit)
+		print_help_exit(argv[0]);
+
+	// Only for the modes going through many files here
+	if((throttle->ioprio || throttle->files || throttle->bytes || throttle->psi)
+			&& (*tar_rules || *connect_path))
+		print_help_exit(argv[0]);
+
+	// Only for reading the flags, and not through a server
+	if(*nocache && (setflags || solflags || solitaire || limitflags || *nochange
+			|| *tar_rules || *serve_path || *connect_path))
+		print_help_exit(argv[0]);
+
+	// Only for the ELFs named on the command line
+	if(*sysroot && (*tar_rules || *audit || *census || *serve_path || *connect_path))
+		print_help_exit(argv[0]);
+
+	if(*serve_path)								// --serve SOCKET
+	{
+		if(setflags || solflags || solitaire || limitflags || *nochange || *verbose || *json
+				|| *tar_rules || *audit || *census || *connect_path || argv[optind] != NULL)
+			print_help_exit(argv[0]);
+		return;
+	}
+
+	if(*connect_path && (*tar_rules || *audit || *census))
+		print_help_exit(argv[0]);
+
+	if(*tar_rules)								// --tar RULES [-L|-l] [-v]
+	{
+		if(setflags || solflags || solitaire || limitflags > 1 || *nochange || *json || *audit || *census
+				|| argv[optind] != NULL)
+			print_help_exit(argv[0]);
+		return;
+	}
+
+	if(*audit)								// --audit [--procfs DIR] [-v|--json]
+	{
+		if(setflags || solflags || solitaire || limitflags || *nochange || (*verbose && *json) || *census
+				|| argv[optind] != NULL)
+			print_help_exit(argv[0]);
+		if(*procfs == NULL)
+			*procfs = "/proc";
+		return;
+	}
+
+	if(*census)								// --census [-v|--json] ROOT...
+	{
+		if(setflags || solflags || solitaire || limitflags || *nochange || (*verbose && *json)
+				|| argv[optind] == NULL)
+			print_help_exit(argv[0]);
+		*begin = optind;
+		*end = argc;
+		return;
+	}
+
 	if(
 		  (setflags == 0 && solflags == 0 && limitflags == 1 && solitaire == 0)
-		&& *verbose == 0
+		&& *verbose == 0 && *nochange == 0 && *json == 0
 		&& argv[optind] == NULL								// -L|-l
 	)
 	{
@@ -286,8 +428,9 @@ parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *c
 		    (setflags == 1 && solflags == 0 && limitflags <= 1 && solitaire == 0)		//-PpEeMmRrSs [-L|-l] [-v] ELF
 		 || (setflags == 0 && solflags == 1 && limitflags <= 1 && solitaire == 0)		//-Z|-z [-L|-l] [-v] ELF
 		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 1)		//-C|-c|-d|-F|-f [-v] ELF
-		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0 && *verbose == 1) // -v ELF
+		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0 && (*verbose || *json) && *nochange == 0) // -v|--json ELF
 		)
+		&& !(*verbose && *json)
 		&& argv[optind] != NULL
 	)
 	{
@@ -299,545 +442,245 @@ parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *c
 }
 
 
-#ifdef PTPAX
-uint16_t
-get_pt_flags(int fd, int verbose)
+/* Read back both markings, UINT16_MAX for one which is missing or not
+ * supported.
+ */
+void
+read_flags(int fd, int verbose, uint16_t *pt_flags, uint16_t *xt_flags)
 {
-	Elf *elf;
-	GElf_Phdr phdr;
-	size_t i, phnum;
-
-	uint16_t pt_flags = UINT16_MAX;
-
-	if(elf_version(EV_CURRENT) == EV_NONE)
-	{
-		if(verbose)
-			printf("\tELF ERROR: Library out of date.\n");
-		return pt_flags;
-	}
+	*pt_flags = UINT16_MAX;
+	*xt_flags = UINT16_MAX;
 
-	if((elf = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL)
-	{
-		if(verbose)
-			printf("\tELF ERROR: elf_begin() fail: %s\n", elf_errmsg(elf_errno()));
-		return pt_flags;
-	}
-
-	if(elf_kind(elf) != ELF_K_ELF)
-	{
-		elf_end(elf);
-		if(verbose)
-			printf("\tELF ERROR: elf_kind() fail: this is not an elf file.\n");
-		return pt_flags;
-	}
-
-	elf_getphdrnum(elf, &phnum);
-
-	for(i=0; i<phnum; i++)
-	{
-		if(gelf_getphdr(elf, i, &phdr) != &phdr)
-		{
-			elf_end(elf);
-			if(verbose)
-				printf("\tELF ERROR: gelf_getphdr(): %s\n", elf_errmsg(elf_errno()));
-			return pt_flags;
-		}
-
-		if(phdr.p_type == PT_PAX_FLAGS)
-			pt_flags = phdr.p_flags;
-	}
-
-	elf_end(elf);
-	return pt_flags;
-}
+#ifdef PTPAX
+	*pt_flags = nocache_get_pt_flags(fd, verbose);
 #endif
 
-
 #ifdef XTPAX
-uint16_t
-string2bin(char *buf)
-{
-	int i;
-	uint16_t flags = 0;
-
-	for(i = 0; i < 5; i++)
-	{
-		if(buf[i] == 'P')
-			flags |= PF_PAGEEXEC;
-		else if(buf[i] == 'p')
-			flags |= PF_NOPAGEEXEC;
-
-		if(buf[i] == 'E')
-			flags |= PF_EMUTRAMP;
-		else if(buf[i] == 'e')
-			flags |= PF_NOEMUTRAMP;
-
-		if(buf[i] == 'M')
-			flags |= PF_MPROTECT;
-		else if(buf[i] == 'm')
-			flags |= PF_NOMPROTECT;
-
-		if(buf[i] == 'R')
-			flags |= PF_RANDMMAP;
-		else if(buf[i] == 'r')
-			flags |= PF_NORANDMMAP;
-
-		if(buf[i] == 'S')
-			flags |= PF_SEGMEXEC;
-		else if(buf[i] == 's')
-			flags |= PF_NOSEGMEXEC;
-	}
-
-	return flags;
-}
-
-
-uint16_t
-get_xt_flags(int fd)
-{
-	char buf[FLAGS_SIZE];
-	uint16_t xt_flags = UINT16_MAX;
-
-	memset(buf, 0, FLAGS_SIZE);
-
-	if(fgetxattr(fd, PAX_NAMESPACE, buf, FLAGS_SIZE) != -1)
-		xt_flags = string2bin(buf);
-
-	return xt_flags;
-}
+	*xt_flags = get_xt_flags(fd);
 #endif
-
-
-void
-bin2string4print(uint16_t flags, char *buf)
-{
-	buf[0] = flags & PF_PAGEEXEC ? 'P' :
-		flags & PF_NOPAGEEXEC ? 'p' : '-' ;
-
-	buf[1] = flags & PF_EMUTRAMP   ? 'E' :
-		flags & PF_NOEMUTRAMP ? 'e' : '-';
-
-	buf[2] = flags & PF_MPROTECT   ? 'M' :
-		flags & PF_NOMPROTECT ? 'm' : '-';
-
-	buf[3] = flags & PF_RANDMMAP   ? 'R' :
-		flags & PF_NORANDMMAP ? 'r' : '-';
-
-	buf[4] = flags & PF_SEGMEXEC   ? 'S' :
-		flags & PF_NOSEGMEXEC ? 's' : '-';
 }
 
 
 void
-bin2string(uint16_t flags, char *buf)
+print_flags(uint16_t pt_flags, uint16_t xt_flags)
 {
-	int i;
-
-	for(i = 0; i < 5; i++)
-		buf[i] = 0;
-
-	i = 0;
-
-	if(flags & PF_PAGEEXEC)
-		buf[i++] = 'P';
-	else if(flags & PF_NOPAGEEXEC)
-		buf[i++] = 'p';
-
-	if(flags & PF_EMUTRAMP)
-		buf[i++] = 'E';
-	else if(flags & PF_NOEMUTRAMP)
-		buf[i++] = 'e';
-
-	if(flags & PF_MPROTECT)
-		buf[i++] = 'M';
-	else if(flags & PF_NOMPROTECT)
-		buf[i++] = 'm';
-
-	if(flags & PF_RANDMMAP)
-		buf[i++] = 'R';
-	if(flags & PF_NORANDMMAP)
-		buf[i++] = 'r';
-
-	if(flags & PF_SEGMEXEC)
-		buf[i++] = 'S';
-	else if(flags & PF_NOSEGMEXEC)
-		buf[i++] = 's';
-}
-
-
-void
-print_flags(int fd, int verbose)
-{
-	uint16_t flags;
 	char buf[FLAGS_SIZE];
 
 #ifdef PTPAX
-	flags = get_pt_flags(fd, verbose);
-	if( flags == UINT16_MAX )
+	if( pt_flags == UINT16_MAX )
 		printf("\tPT_PAX    : not found\n");
 	else
 	{
 		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
+		bin2string4print(pt_flags, buf);
 		printf("\tPT_PAX    : %s\n", buf);
 	}
 #endif
 
 #ifdef XTPAX
-	flags = get_xt_flags(fd);
-	if( flags == UINT16_MAX )
+	if( xt_flags == UINT16_MAX )
 		printf("\tXATTR_PAX : not found\n");
 	else
 	{
 		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
+		bin2string4print(xt_flags, buf);
 		printf("\tXATTR_PAX : %s\n", buf);
 	}
 #endif
 }
 
 
-
-uint16_t
-update_flags(uint16_t flags, uint16_t pax_flags)
-{
-	//PAGEEXEC
-	if(pax_flags & PF_PAGEEXEC)
-	{
-		flags |= PF_PAGEEXEC;
-		flags &= ~PF_NOPAGEEXEC;
-	}
-	if(pax_flags & PF_NOPAGEEXEC)
-	{
-		flags &= ~PF_PAGEEXEC;
-		flags |= PF_NOPAGEEXEC;
-	}
-	if((pax_flags & PF_PAGEEXEC) && (pax_flags & PF_NOPAGEEXEC))
-	{
-		flags &= ~PF_PAGEEXEC;
-		flags &= ~PF_NOPAGEEXEC;
-	}
-
-	//EMUTRAMP
-	if(pax_flags & PF_EMUTRAMP)
-	{
-		flags |= PF_EMUTRAMP;
-		flags &= ~PF_NOEMUTRAMP;
-	}
-	if(pax_flags & PF_NOEMUTRAMP)
-	{
-		flags &= ~PF_EMUTRAMP;
-		flags |= PF_NOEMUTRAMP;
-	}
-	if((pax_flags & PF_EMUTRAMP) && (pax_flags & PF_NOEMUTRAMP))
-	{
-		flags &= ~PF_EMUTRAMP;
-		flags &= ~PF_NOEMUTRAMP;
-	}
-
-	//MPROTECT
-	if(pax_flags & PF_MPROTECT)
-	{
-		flags |= PF_MPROTECT;
-		flags &= ~PF_NOMPROTECT;
-	}
-	if(pax_flags & PF_NOMPROTECT)
-	{
-		flags &= ~PF_MPROTECT;
-		flags |= PF_NOMPROTECT;
-	}
-	if((pax_flags & PF_MPROTECT) && (pax_flags & PF_NOMPROTECT))
-	{
-		flags &= ~PF_MPROTECT;
-		flags &= ~PF_NOMPROTECT;
-	}
-
-	//RANDMMAP
-	if(pax_flags & PF_RANDMMAP)
-	{
-		flags |= PF_RANDMMAP;
-		flags &= ~PF_NORANDMMAP;
-	}
-	if(pax_flags & PF_NORANDMMAP)
-	{
-		flags &= ~PF_RANDMMAP;
-		flags |= PF_NORANDMMAP;
-	}
-	if((pax_flags & PF_RANDMMAP) && (pax_flags & PF_NORANDMMAP))
-	{
-		flags &= ~PF_RANDMMAP;
-		flags &= ~PF_NORANDMMAP;
-	}
-
-	//SEGMEXEC
-	if(pax_flags & PF_SEGMEXEC)
-	{
-		flags |= PF_SEGMEXEC;
-		flags &= ~PF_NOSEGMEXEC;
-	}
-	if(pax_flags & PF_NOSEGMEXEC)
-	{
-		flags &= ~PF_SEGMEXEC;
-		flags |= PF_NOSEGMEXEC;
-	}
-	if((pax_flags & PF_SEGMEXEC) && (pax_flags & PF_NOSEGMEXEC))
-	{
-		flags &= ~PF_SEGMEXEC;
-		flags &= ~PF_NOSEGMEXEC;
-	}
-
-	return flags;
-}
-
-
-#ifdef PTPAX
-int
-set_pt_flags(int fd, uint16_t pt_flags, int verbose)
+/* Print s as a JSON string.  Bytes which are not valid in a JSON string
+ * are escaped, anything else, including non-ASCII, is passed as is.
+ */
+void
+print_json_string(const char *s)
 {
-	Elf *elf;
-	GElf_Phdr phdr;
-	size_t i, phnum;
+	const unsigned char *p;
 
-	if(elf_version(EV_CURRENT) == EV_NONE)
+	putchar('"');
+	for(p = (const unsigned char *)s; *p; p++)
 	{
-		if(verbose)
-			printf("\tELF ERROR: Library out of date.\n");
-		return EXIT_FAILURE;
-	}
-
-	if((elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL)) == NULL)
-	{
-		if(verbose)
-			printf("\tELF ERROR: elf_begin() fail: %s\n", elf_errmsg(elf_errno()));
-		return EXIT_FAILURE;
-	}
-
-	if(elf_kind(elf) != ELF_K_ELF)
-	{
-		elf_end(elf);
-		if(verbose)
-			printf("\tELF ERROR: elf_kind() fail: this is not an elf file.\n");
-		return EXIT_FAILURE;
-	}
-
-	elf_getphdrnum(elf, &phnum);
-
-	for(i=0; i<phnum; i++)
-	{
-		if(gelf_getphdr(elf, i, &phdr) != &phdr)
-		{
-			elf_end(elf);
-			if(verbose)
-				printf("\tELF ERROR: gelf_getphdr(): %s\n", elf_errmsg(elf_errno()));
-			return EXIT_FAILURE;
-		}
-
-		if(phdr.p_type == PT_PAX_FLAGS)
-		{
-			//RANDEXEC is deprecated, we'll force it off like paxctl
-			phdr.p_flags = pt_flags | PF_NORANDEXEC;
-
-			if(!gelf_update_phdr(elf, i, &phdr))
-			{
-				elf_end(elf);
-				if(verbose)
-					printf("\tELF ERROR: gelf_update_phdr(): %s", elf_errmsg(elf_errno()));
-				return EXIT_FAILURE;
-			}
-		}
+		if(*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if(*p < 0x20)
+			printf("\\u%04x", *p);
+		else
+			putchar(*p);
 	}
-
-	elf_end(elf);
-	return EXIT_SUCCESS;
+	putchar('"');
 }
-#endif
 
 
-#ifdef XTPAX
-int
-set_xt_flags(int fd, uint16_t xt_flags)
+void
+print_json_flags(const char *name, uint16_t flags)
 {
 	char buf[FLAGS_SIZE];
 
-	memset(buf, 0, FLAGS_SIZE);
-	bin2string(xt_flags, buf);
-
-	if( !fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), 0) )
-		return EXIT_SUCCESS;
+	if( flags == UINT16_MAX )
+		printf(",\"%s\":null", name);
 	else
-		return EXIT_FAILURE;
+	{
+		memset(buf, 0, FLAGS_SIZE);
+		bin2string4print(flags, buf);
+		printf(",\"%s\":\"%s\"", name, buf);
+	}
 }
-#endif
 
 
-int
-set_flags(int fd, uint16_t *pax_flags, int rdwr_pt_pax, int limit, int verbose)
+/* One line per ELF for --json:
+ *
+ *	{"path":"/bin/ls","pt":"PeMRs","xt":null,"changed":false}
+ *
+ * The flags are only given if the file could be opened, changed only
+ * when flags were to be set, error only when that or reading the file
+ * failed.  A flag field is null if the marking is not there or not
+ * supported.
+ */
+void
+print_json(const char *path, int opened, uint16_t pt_flags, uint16_t xt_flags,
+	int changed, const char *error)
 {
-	uint16_t flags;
-	int ret = EXIT_FAILURE;
+	printf("{\"path\":");
+	print_json_string(path);
 
-#ifdef PTPAX
-	if(rdwr_pt_pax)
+	if(opened)
 	{
-#ifdef XTPAX
-		if( !(limit == LIMIT_TO_XT_FLAGS))
-		{
-#endif
-			flags = get_pt_flags(fd, verbose);
-			if( flags == UINT16_MAX )
-				flags = PF_NOEMUTRAMP ;
-			flags = update_flags( flags, *pax_flags);
-			ret = set_pt_flags(fd, flags, verbose);
-#ifdef XTPAX
-		}
-#endif
-
+		print_json_flags("pt", pt_flags);
+		print_json_flags("xt", xt_flags);
 	}
-#endif
 
-#ifdef XTPAX
-#ifdef PTPAX
-	if( !(limit == LIMIT_TO_PT_FLAGS) )
+	if(changed >= 0)
+		printf(",\"changed\":%s", changed ? "true" : "false");
+
+	if(error)
 	{
-#endif
-		flags = get_xt_flags(fd);
-		if( flags == UINT16_MAX )
-			flags = PF_NOEMUTRAMP ;
-		flags = update_flags( flags, *pax_flags);
-		ret = set_xt_flags(fd, flags);
-#ifdef PTPAX
+		printf(",\"error\":");
+		print_json_string(error);
 	}
-#endif
-#endif
 
-	return ret;
+	printf("}\n");
 }
 
 
-#ifdef XTPAX
 int
-create_xt_flags(int fd, int cp_flags)
+main( int argc, char *argv[])
 {
-	char buf[FLAGS_SIZE];
-	uint16_t xt_flags;
-
-	if(cp_flags == CREATE_XT_FLAGS_SECURE)
-		xt_flags = PF_PAGEEXEC | PF_SEGMEXEC | PF_MPROTECT |
-			PF_NOEMUTRAMP | PF_RANDMMAP ;
-	else if(cp_flags == CREATE_XT_FLAGS_DEFAULT)
-		xt_flags = 0;
-	else
-		//Why are we here?
-		return EXIT_FAILURE;
-
-	memset(buf, 0, FLAGS_SIZE);
-	bin2string(xt_flags, buf);
-
-	if( !fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), XATTR_CREATE) )
-		return EXIT_SUCCESS;
-	else
-		return EXIT_FAILURE;
-}
+	int fd, fi;
+	uint16_t pax_flags, pt_flags, xt_flags;
+	int verbose, cp_flags, limit, nochange, json, begin, end;
+	int changed, nchanged = 0, nunchanged = 0;
+	int fret, bypath;
+	char *tar_rules;
+	int audit;
+	char *procfs, *serve_path, *connect_path;
+	struct throttle_opts throttle_opts;
+	int nocache, census;
+	char *sysroot;
 
-int
-delete_xt_flags(int fd)
-{
-	if( !fremovexattr(fd, PAX_NAMESPACE) )
-		return EXIT_SUCCESS;
-	else
-	{
-		// If this fails because there was no such named xattr
-		// in the first place, then in a sense, we succeeded.
-		// See: https://bugs.gentoo.org/show_bug.cgi?id=485908
-		if( errno == ENOATTR )
-			return EXIT_SUCCESS;
-		else
-			return EXIT_FAILURE;
-	}
-}
-#endif
+	int ret = EXIT_SUCCESS;
 
+	limit = 0;
+	parse_cmd_args(argc, argv, &pax_flags, &verbose, &cp_flags, &limit, &nochange, &json, &begin, &end, &tar_rules,
+		&audit, &procfs, &serve_path, &connect_path, &throttle_opts, &nocache, &census, &sysroot);
 
-#if defined(PTPAX) && defined(XTPAX)
-int
-copy_xt_flags(int fd, int cp_flags, int verbose)
-{
-	uint16_t flags;
-	int ret = EXIT_FAILURE;
+	throttle_start(&throttle_opts);
+	nocache_start(nocache);
+	sysroot_start(sysroot);
 
-	if(cp_flags == COPY_PT_TO_XT_FLAGS)
-	{
-		flags = get_pt_flags(fd, verbose);
-		if( flags != UINT16_MAX )
-			ret = set_xt_flags(fd, flags);
-	}
-	else if(cp_flags == COPY_XT_TO_PT_FLAGS)
-	{
-		flags = get_xt_flags(fd);
-		if( flags != UINT16_MAX )
-			ret = set_pt_flags(fd, flags, verbose);
-	}
+	if(serve_path)
+		exit(serve(serve_path));
 
-	return ret;
-}
-#endif
+	if(tar_rules)
+		exit(mark_tar(STDIN_FILENO, STDOUT_FILENO, tar_rules, limit, verbose));
 
+	if(json)
+		setvbuf(stdout, NULL, _IOFBF, JSON_BUFSIZ);
 
-int
-main( int argc, char *argv[])
-{
-	int fd, fi;
-	uint16_t pax_flags;
-	int verbose, cp_flags, limit, begin, end;
-	int rdwr_pt_pax = 1;
+	if(audit)
+		exit(audit_procs(procfs, verbose, json));
 
-	int ret = EXIT_SUCCESS;
+	if(census)
+		exit(census_roots(&argv[begin], end - begin, verbose, json));
 
-	parse_cmd_args(argc, argv, &pax_flags, &verbose, &cp_flags, &limit, &begin, &end);
+	if(connect_path)
+		exit(serve_client(connect_path, &argv[begin], end - begin, pax_flags,
+			cp_flags, limit, verbose, nochange, json));
 
 	for(fi = begin; fi < end; fi++)
 	{
 		if(verbose)
 			printf("%s:\n", argv[fi]);
 
-		if((fd = open(argv[fi], O_RDWR)) < 0)
+		bypath = 0;
+
+		// With --nocache there is nothing to mark, so open it only to read
+		if(nocache)
 		{
-			rdwr_pt_pax = 0;
-#ifdef PTPAX
-			if(verbose)
-				printf("\topen(O_RDWR) failed: cannot change PT_PAX flags\n");
-#endif
-			if((fd = open(argv[fi], O_RDONLY)) < 0)
-			{
-				if(verbose)
-					printf("\topen(O_RDONLY) failed: cannot read/change PAX flags\n\n");
-				continue;
-			}
+			changed = 0;
+			fret = EXIT_SUCCESS;
+			if((fd = nocache_open(argv[fi])) < 0 && verbose)
+				printf("\topen(O_RDONLY) failed: cannot read PAX flags\n\n");
 		}
-
 #ifdef XTPAX
-		if(cp_flags == CREATE_XT_FLAGS_SECURE || cp_flags == CREATE_XT_FLAGS_DEFAULT)
-			ret |= create_xt_flags(fd, cp_flags);
-		if(cp_flags == DELETE_XT_FLAGS)
-			ret |= delete_xt_flags(fd);
+		// Nothing to read back and no PT_PAX to mark, so XATTR_PAX goes by path
+		else if(!verbose && !json && mark_xt_path(argv[fi], pax_flags, cp_flags, limit, &changed, &fret) == 0)
+			bypath = 1;
 #endif
+		else
+			fd = mark_file(argv[fi], pax_flags, cp_flags, limit, verbose, &changed, &fret);
 
-#if defined(PTPAX) && defined(XTPAX)
-		if(cp_flags == COPY_PT_TO_XT_FLAGS || (cp_flags == COPY_XT_TO_PT_FLAGS && rdwr_pt_pax))
-			ret |= copy_xt_flags(fd, cp_flags, verbose);
-#endif
+		if(bypath)
+		{
+			ret |= fret;
+			if(changed)
+				nchanged++;
+			else
+				nunchanged++;
+			throttle(0);
+			continue;
+		}
+
+		if(fd < 0)
+		{
+			if(json)
+				print_json(argv[fi], 0, UINT16_MAX, UINT16_MAX, -1, "open() failed");
+			continue;
+		}
+
+		ret |= fret;
+
+		if(changed)
+			nchanged++;
+		else
+			nunchanged++;
 
-		if(pax_flags != 0)
-			ret |= set_flags(fd, &pax_flags, rdwr_pt_pax, limit, verbose);
+		if(verbose && (pax_flags != 0 || cp_flags != 0))
+			printf("\t%s\n", changed ? "changed" : "unchanged");
+
+		if(verbose || json)
+			read_flags(fd, verbose, &pt_flags, &xt_flags);
 
 		if(verbose == 1)
-			print_flags(fd, verbose);
+			print_flags(pt_flags, xt_flags);
+
+		if(json)
+			print_json(argv[fi], 1, pt_flags, xt_flags,
+				(pax_flags != 0 || cp_flags != 0) ? changed : -1,
+				fret == EXIT_SUCCESS ? NULL : "update failed");
 
+		throttle_fd(fd);
 		close(fd);
 
 		if(verbose)
 			printf("\n");
 	}
 
+	if(verbose && (pax_flags != 0 || cp_flags != 0))
+		printf("%d changed, %d unchanged\n", nchanged, nunchanged);
+
+	if(ret == EXIT_SUCCESS && nochange && nchanged == 0)
+		exit(EXIT_UNCHANGED);
+
 	exit(ret);
 }
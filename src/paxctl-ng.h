@@ -0,0 +1,201 @@
+/*
+	paxctl-ng.h: this file is part of the elfix package
+	Copyright (C) 2011  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PAXCTL_NG_H
+#define PAXCTL_NG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#ifdef PTPAX
+ #include <gelf.h>
+#endif
+
+#ifdef NEED_PAX_DECLS
+ #define PT_PAX_FLAGS    0x65041580      /* Indicates PaX flag markings */
+ #define PF_PAGEEXEC     (1 << 4)        /* Enable  PAGEEXEC */
+ #define PF_NOPAGEEXEC   (1 << 5)        /* Disable PAGEEXEC */
+ #define PF_SEGMEXEC     (1 << 6)        /* Enable  SEGMEXEC */
+ #define PF_NOSEGMEXEC   (1 << 7)        /* Disable SEGMEXEC */
+ #define PF_MPROTECT     (1 << 8)        /* Enable  MPROTECT */
+ #define PF_NOMPROTECT   (1 << 9)        /* Disable MPROTECT */
+ #define PF_RANDEXEC     (1 << 10)       /* DEPRECATED: Enable  RANDEXEC */
+ #define PF_NORANDEXEC   (1 << 11)       /* DEPRECATED: Disable RANDEXEC */
+ #define PF_EMUTRAMP     (1 << 12)       /* Enable  EMUTRAMP */
+ #define PF_NOEMUTRAMP   (1 << 13)       /* Disable EMUTRAMP */
+ #define PF_RANDMMAP     (1 << 14)       /* Enable  RANDMMAP */
+ #define PF_NORANDMMAP   (1 << 15)       /* Disable RANDMMAP */
+#endif
+
+#ifdef XTPAX
+ #include <attr/xattr.h>
+ #define PAX_NAMESPACE	"user.pax.flags"
+ #define CREATE_XT_FLAGS_SECURE         1
+ #define CREATE_XT_FLAGS_DEFAULT        2
+ #define DELETE_XT_FLAGS                3
+#endif
+
+#if defined(PTPAX) && defined(XTPAX)
+ #define COPY_PT_TO_XT_FLAGS            4
+ #define COPY_XT_TO_PT_FLAGS            5
+#endif
+
+#define LIMIT_TO_PT_FLAGS               6
+#define LIMIT_TO_XT_FLAGS               7
+
+#define FLAGS_SIZE                      6
+
+#define ELF_PHDRS_MAX                   (0xffff * 56)   /* bytes, PN_XNUM Elf64_Phdrs, more is bogus */
+
+#define MARK_LOCK_WAIT                  10000   /* ms to wait for a file being marked elsewhere */
+#define MARK_LOCK_BACKOFF_MIN           1
+#define MARK_LOCK_BACKOFF_MAX           100
+#define MARK_XT_TRIES                   3       /* merges into an XATTR_PAX written by path meanwhile */
+
+#define EXIT_UNCHANGED                  2
+#define EXIT_STALE                      2
+
+
+/* paxflags.c: get, set, create and delete the markings */
+
+#ifdef PTPAX
+uint16_t get_pt_flags(int fd, int verbose);
+int set_pt_flags(int fd, uint16_t pt_flags, int verbose);
+uint16_t get_pt_flags_mem(const unsigned char *image, size_t len);
+int set_pt_flags_mem(unsigned char *image, size_t len, uint16_t pt_flags);
+#endif
+
+size_t elf_phdrs_end(const unsigned char *image, size_t len);
+size_t elf_headers(const unsigned char *image, size_t len, uint64_t *phoff, size_t *phsize);
+void elf_set_phoff(unsigned char *image, size_t len, uint64_t phoff);
+
+struct elf_phdr_counts
+{
+	int type;			/* e_type */
+	int pt_pax;			/* PT_PAX_FLAGS */
+	int gnu_stack;			/* PT_GNU_STACK, which paxctl -c can turn into PT_PAX_FLAGS */
+	int null;			/* PT_NULL, free slots */
+	int interp;			/* PT_INTERP */
+};
+
+int elf_count_phdrs(const unsigned char *image, size_t len, struct elf_phdr_counts *c);
+
+#ifdef XTPAX
+uint16_t string2bin(char *buf);
+uint16_t get_xt_flags(int fd);
+int same_xt_flags(uint16_t a, uint16_t b);
+int set_xt_flags(int fd, uint16_t xt_flags, int xflags);
+int create_xt_flags(int fd, int cp_flags, int *changed);
+int delete_xt_flags(int fd, int *changed);
+#endif
+
+#if defined(PTPAX) && defined(XTPAX)
+int copy_xt_flags(int fd, int cp_flags, int xt, int verbose, int *changed);
+#endif
+
+void bin2string4print(uint16_t flags, char *buf);
+void bin2string(uint16_t flags, char *buf);
+uint16_t parse_sflags(const char *sflags);
+uint16_t update_flags(uint16_t flags, uint16_t pax_flags);
+int set_flags(int fd, uint16_t *pax_flags, int rdwr_pt_pax, int xt, int limit, int verbose, int *changed);
+int lock_file(int fd);
+int mark_file(const char *path, uint16_t pax_flags, int cp_flags, int limit, int verbose,
+	int *changed, int *fret);
+
+
+/* paxtar.c: mark the ELF members of a tar stream */
+
+int mark_tar(int in, int out, const char *rules, int limit, int verbose);
+
+
+/* paxaudit.c: compare the flags of running processes with their binaries */
+
+int audit_procs(const char *procfs, int verbose, int json);
+
+
+/* paxcensus.c: count the ELFs under some roots by what marking them takes */
+
+int census_roots(char *roots[], int nroots, int verbose, int json);
+
+
+/* paxserve.c: serve requests on a UNIX socket, and the client for it */
+
+int serve(const char *path);
+int serve_client(const char *path, char *files[], int nfiles, uint16_t pax_flags,
+	int cp_flags, int limit, int verbose, int nochange, int json);
+
+
+/* paxthrottle.c: ioprio, rate limits and PSI backoff for sweeps */
+
+struct throttle_opts
+{
+	const char *ioprio;		/* --ioprio CLASS[:LEVEL] */
+	const char *files;		/* --files-per-sec N */
+	const char *bytes;		/* --bytes-per-sec N[KMG] */
+	const char *psi;		/* --psi-io PERCENT */
+};
+
+void throttle_start(const struct throttle_opts *t);
+void throttle(size_t bytes);
+void throttle_fd(int fd);
+
+
+/* paxnocache.c: read the markings without filling the page cache */
+
+void nocache_start(int on);
+int nocache_open(const char *path);
+unsigned char *read_elf_headers(int fd, size_t *len);
+#ifdef PTPAX
+uint16_t nocache_get_pt_flags(int fd, int verbose);
+#endif
+
+
+/* paxsysroot.c: resolve every path inside the root of an image */
+
+void sysroot_start(const char *dir);
+int sysroot_open(const char *path, int flags);
+int sysroot_active(void);
+
+
+/* paxxtcap.c: what XATTR_PAX can do on each filesystem */
+
+#define XTCAP_SET                       1       /* XATTR_PAX is not known to fail to be written */
+
+#ifdef XTPAX
+int xtcap(int fd, const struct stat *st);
+void xtcap_failed(int fd, int err);
+#endif
+
+
+/* paxxtpath.c: mark XATTR_PAX by path, without opening the file */
+
+#ifdef XTPAX
+int mark_xt_path(const char *path, uint16_t pax_flags, int cp_flags, int limit, int *changed, int *fret);
+#endif
+
+
+/* paxctl-ng.c: output shared with the other modes */
+
+void read_flags(int fd, int verbose, uint16_t *pt_flags, uint16_t *xt_flags);
+void print_flags(uint16_t pt_flags, uint16_t xt_flags);
+void print_json_string(const char *s);
+void print_json(const char *path, int opened, uint16_t pt_flags, uint16_t xt_flags,
+	int changed, const char *error);
+
+#endif
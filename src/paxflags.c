@@ -0,0 +1,1047 @@
+/*
+	paxflags.c: this file is part of the elfix package
+	Copyright (C) 2011  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/file.h>
+#include <elf.h>
+
+#include "paxctl-ng.h"
+
+
+#ifdef PTPAX
+uint16_t
+get_pt_flags(int fd, int verbose)
+{
+	Elf *elf;
+	GElf_Phdr phdr;
+	size_t i, phnum;
+
+	uint16_t pt_flags = UINT16_MAX;
+
+	if(elf_version(EV_CURRENT) == EV_NONE)
+	{
+		if(verbose)
+			printf("\tELF ERROR: Library out of date.\n");
+		return pt_flags;
+	}
+
+	if((elf = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL)
+	{
+		if(verbose)
+			printf("\tELF ERROR: elf_begin() fail: %s\n", elf_errmsg(elf_errno()));
+		return pt_flags;
+	}
+
+	if(elf_kind(elf) != ELF_K_ELF)
+	{
+		elf_end(elf);
+		if(verbose)
+			printf("\tELF ERROR: elf_kind() fail: this is not an elf file.\n");
+		return pt_flags;
+	}
+
+	elf_getphdrnum(elf, &phnum);
+
+	for(i=0; i<phnum; i++)
+	{
+		if(gelf_getphdr(elf, i, &phdr) != &phdr)
+		{
+			elf_end(elf);
+			if(verbose)
+				printf("\tELF ERROR: gelf_getphdr(): %s\n", elf_errmsg(elf_errno()));
+			return pt_flags;
+		}
+
+		if(phdr.p_type == PT_PAX_FLAGS)
+			pt_flags = phdr.p_flags;
+	}
+
+	elf_end(elf);
+	return pt_flags;
+}
+#endif
+
+
+#ifdef XTPAX
+uint16_t
+string2bin(char *buf)
+{
+	int i;
+	uint16_t flags = 0;
+
+	for(i = 0; i < 5; i++)
+	{
+		if(buf[i] == 'P')
+			flags |= PF_PAGEEXEC;
+		else if(buf[i] == 'p')
+			flags |= PF_NOPAGEEXEC;
+
+		if(buf[i] == 'E')
+			flags |= PF_EMUTRAMP;
+		else if(buf[i] == 'e')
+			flags |= PF_NOEMUTRAMP;
+
+		if(buf[i] == 'M')
+			flags |= PF_MPROTECT;
+		else if(buf[i] == 'm')
+			flags |= PF_NOMPROTECT;
+
+		if(buf[i] == 'R')
+			flags |= PF_RANDMMAP;
+		else if(buf[i] == 'r')
+			flags |= PF_NORANDMMAP;
+
+		if(buf[i] == 'S')
+			flags |= PF_SEGMEXEC;
+		else if(buf[i] == 's')
+			flags |= PF_NOSEGMEXEC;
+	}
+
+	return flags;
+}
+
+
+// UINT16_MAX if there is no XATTR_PAX, errno says why
+uint16_t
+get_xt_flags(int fd)
+{
+	char buf[FLAGS_SIZE];
+	uint16_t xt_flags = UINT16_MAX;
+
+	memset(buf, 0, FLAGS_SIZE);
+
+	if(fgetxattr(fd, PAX_NAMESPACE, buf, FLAGS_SIZE) != -1)
+		xt_flags = string2bin(buf);
+
+	return xt_flags;
+}
+#endif
+
+
+void
+bin2string4print(uint16_t flags, char *buf)
+{
+	buf[0] = flags & PF_PAGEEXEC ? 'P' :
+		flags & PF_NOPAGEEXEC ? 'p' : '-' ;
+
+	buf[1] = flags & PF_EMUTRAMP   ? 'E' :
+		flags & PF_NOEMUTRAMP ? 'e' : '-';
+
+	buf[2] = flags & PF_MPROTECT   ? 'M' :
+		flags & PF_NOMPROTECT ? 'm' : '-';
+
+	buf[3] = flags & PF_RANDMMAP   ? 'R' :
+		flags & PF_NORANDMMAP ? 'r' : '-';
+
+	buf[4] = flags & PF_SEGMEXEC   ? 'S' :
+		flags & PF_NOSEGMEXEC ? 's' : '-';
+}
+
+
+void
+bin2string(uint16_t flags, char *buf)
+{
+	int i;
+
+	for(i = 0; i < 5; i++)
+		buf[i] = 0;
+
+	i = 0;
+
+	if(flags & PF_PAGEEXEC)
+		buf[i++] = 'P';
+	else if(flags & PF_NOPAGEEXEC)
+		buf[i++] = 'p';
+
+	if(flags & PF_EMUTRAMP)
+		buf[i++] = 'E';
+	else if(flags & PF_NOEMUTRAMP)
+		buf[i++] = 'e';
+
+	if(flags & PF_MPROTECT)
+		buf[i++] = 'M';
+	else if(flags & PF_NOMPROTECT)
+		buf[i++] = 'm';
+
+	if(flags & PF_RANDMMAP)
+		buf[i++] = 'R';
+	if(flags & PF_NORANDMMAP)
+		buf[i++] = 'r';
+
+	if(flags & PF_SEGMEXEC)
+		buf[i++] = 'S';
+	else if(flags & PF_NOSEGMEXEC)
+		buf[i++] = 's';
+}
+
+
+//This logic is like parse_cmd_args() in paxctl-ng.c
+uint16_t
+parse_sflags(const char *sflags)
+{
+	size_t i;
+	uint16_t flags = 0;
+
+	for(i = 0; i < strlen(sflags); i++)
+	{
+		switch(sflags[i])
+		{
+			case 'P':
+				flags |= PF_PAGEEXEC;
+				break;
+			case 'p':
+				flags |= PF_NOPAGEEXEC;
+				break ;
+			case 'E':
+				flags |= PF_EMUTRAMP;
+				break;
+			case 'e':
+				flags |= PF_NOEMUTRAMP;
+				break ;
+			case 'M':
+				flags |= PF_MPROTECT;
+				break;
+			case 'm':
+				flags |= PF_NOMPROTECT;
+				break ;
+			case 'R':
+				flags |= PF_RANDMMAP;
+				break;
+			case 'r':
+				flags |= PF_NORANDMMAP;
+				break ;
+			case 'S':
+				flags |= PF_SEGMEXEC;
+				break;
+			case 's':
+				flags |= PF_NOSEGMEXEC;
+				break ;
+		}
+	}
+
+	return flags;
+}
+
+
+uint16_t
+update_flags(uint16_t flags, uint16_t pax_flags)
+{
+	//PAGEEXEC
+	if(pax_flags & PF_PAGEEXEC)
+	{
+		flags |= PF_PAGEEXEC;
+		flags &= ~PF_NOPAGEEXEC;
+	}
+	if(pax_flags & PF_NOPAGEEXEC)
+	{
+		flags &= ~PF_PAGEEXEC;
+		flags |= PF_NOPAGEEXEC;
+	}
+	if((pax_flags & PF_PAGEEXEC) && (pax_flags & PF_NOPAGEEXEC))
+	{
+		flags &= ~PF_PAGEEXEC;
+		flags &= ~PF_NOPAGEEXEC;
+	}
+
+	//EMUTRAMP
+	if(pax_flags & PF_EMUTRAMP)
+	{
+		flags |= PF_EMUTRAMP;
+		flags &= ~PF_NOEMUTRAMP;
+	}
+	if(pax_flags & PF_NOEMUTRAMP)
+	{
+		flags &= ~PF_EMUTRAMP;
+		flags |= PF_NOEMUTRAMP;
+	}
+	if((pax_flags & PF_EMUTRAMP) && (pax_flags & PF_NOEMUTRAMP))
+	{
+		flags &= ~PF_EMUTRAMP;
+		flags &= ~PF_NOEMUTRAMP;
+	}
+
+	//MPROTECT
+	if(pax_flags & PF_MPROTECT)
+	{
+		flags |= PF_MPROTECT;
+		flags &= ~PF_NOMPROTECT;
+	}
+	if(pax_flags & PF_NOMPROTECT)
+	{
+		flags &= ~PF_MPROTECT;
+		flags |= PF_NOMPROTECT;
+	}
+	if((pax_flags & PF_MPROTECT) && (pax_flags & PF_NOMPROTECT))
+	{
+		flags &= ~PF_MPROTECT;
+		flags &= ~PF_NOMPROTECT;
+	}
+
+	//RANDMMAP
+	if(pax_flags & PF_RANDMMAP)
+	{
+		flags |= PF_RANDMMAP;
+		flags &= ~PF_NORANDMMAP;
+	}
+	if(pax_flags & PF_NORANDMMAP)
+	{
+		flags &= ~PF_RANDMMAP;
+		flags |= PF_NORANDMMAP;
+	}
+	if((pax_flags & PF_RANDMMAP) && (pax_flags & PF_NORANDMMAP))
+	{
+		flags &= ~PF_RANDMMAP;
+		flags &= ~PF_NORANDMMAP;
+	}
+
+	//SEGMEXEC
+	if(pax_flags & PF_SEGMEXEC)
+	{
+		flags |= PF_SEGMEXEC;
+		flags &= ~PF_NOSEGMEXEC;
+	}
+	if(pax_flags & PF_NOSEGMEXEC)
+	{
+		flags &= ~PF_SEGMEXEC;
+		flags |= PF_NOSEGMEXEC;
+	}
+	if((pax_flags & PF_SEGMEXEC) && (pax_flags & PF_NOSEGMEXEC))
+	{
+		flags &= ~PF_SEGMEXEC;
+		flags &= ~PF_NOSEGMEXEC;
+	}
+
+	return flags;
+}
+
+
+#ifdef PTPAX
+static int
+host_msb(void)
+{
+	const uint16_t one = 1;
+
+	return *(const unsigned char *)&one == 0;
+}
+
+
+/* libelf hands out the phdrs of an ELF of the other byte order converted,
+ * and only elf_update(), which may lay out the whole file anew, would put
+ * them back.  So for those we patch the phdrs with our own engine, which
+ * works on the raw bytes of either byte order, and write just them back.
+ */
+static int
+set_pt_flags_foreign(int fd, uint16_t pt_flags, int verbose)
+{
+	unsigned char ehdr[sizeof(Elf64_Ehdr)], *image;
+	uint64_t phoff;
+	size_t ehsize, phsize;
+	ssize_t n;
+	int ret = EXIT_FAILURE;
+
+	if((n = pread(fd, ehdr, sizeof(ehdr), 0)) <= 0 || (ehsize = elf_headers(ehdr, n, &phoff, &phsize)) == 0
+			|| (image = malloc(ehsize + phsize)) == NULL)
+	{
+		if(verbose)
+			printf("\tELF ERROR: cannot read the program headers\n");
+		return EXIT_FAILURE;
+	}
+
+	// Only the phdrs are read, after a copy of the ELF header pointing to them
+	memcpy(image, ehdr, ehsize);
+	elf_set_phoff(image, ehsize, ehsize);
+
+	if(pread(fd, image + ehsize, phsize, phoff) == (ssize_t)phsize
+			&& set_pt_flags_mem(image, ehsize + phsize, pt_flags) == EXIT_SUCCESS
+			&& pwrite(fd, image + ehsize, phsize, phoff) == (ssize_t)phsize)
+		ret = EXIT_SUCCESS;
+	else if(verbose)
+		printf("\tELF ERROR: cannot update the program headers\n");
+
+	free(image);
+	return ret;
+}
+
+
+int
+set_pt_flags(int fd, uint16_t pt_flags, int verbose)
+{
+	Elf *elf;
+	GElf_Phdr phdr;
+	size_t i, phnum;
+	char *ident;
+
+	if(elf_version(EV_CURRENT) == EV_NONE)
+	{
+		if(verbose)
+			printf("\tELF ERROR: Library out of date.\n");
+		return EXIT_FAILURE;
+	}
+
+	if((elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL)) == NULL)
+	{
+		if(verbose)
+			printf("\tELF ERROR: elf_begin() fail: %s\n", elf_errmsg(elf_errno()));
+		return EXIT_FAILURE;
+	}
+
+	if(elf_kind(elf) != ELF_K_ELF)
+	{
+		elf_end(elf);
+		if(verbose)
+			printf("\tELF ERROR: elf_kind() fail: this is not an elf file.\n");
+		return EXIT_FAILURE;
+	}
+
+	if((ident = elf_getident(elf, NULL)) != NULL && (ident[EI_DATA] == ELFDATA2MSB) != host_msb())
+	{
+		elf_end(elf);
+		return set_pt_flags_foreign(fd, pt_flags, verbose);
+	}
+
+	elf_getphdrnum(elf, &phnum);
+
+	for(i=0; i<phnum; i++)
+	{
+		if(gelf_getphdr(elf, i, &phdr) != &phdr)
+		{
+			elf_end(elf);
+			if(verbose)
+				printf("\tELF ERROR: gelf_getphdr(): %s\n", elf_errmsg(elf_errno()));
+			return EXIT_FAILURE;
+		}
+
+		if(phdr.p_type == PT_PAX_FLAGS)
+		{
+			//RANDEXEC is deprecated, we'll force it off like paxctl
+			phdr.p_flags = pt_flags | PF_NORANDEXEC;
+
+			if(!gelf_update_phdr(elf, i, &phdr))
+			{
+				elf_end(elf);
+				if(verbose)
+					printf("\tELF ERROR: gelf_update_phdr(): %s", elf_errmsg(elf_errno()));
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	elf_end(elf);
+	return EXIT_SUCCESS;
+}
+#endif
+
+
+/* The in memory PT_PAX engine works on the raw bytes of an ELF image rather
+ * than through libelf, so it can be used on data which is not backed by a
+ * file, like a tar member passing through a pipe.  It handles both ELF
+ * classes and both byte orders, and only ever needs the bytes from the
+ * start of the image up to the end of the program headers.
+ */
+
+static uint64_t
+elf_get(const unsigned char *p, int size, int msb)
+{
+	uint64_t v = 0;
+	int i;
+
+	for(i = 0; i < size; i++)
+		if(msb)
+			v = (v << 8) | p[i];
+		else
+			v |= (uint64_t)p[i] << (8 * i);
+
+	return v;
+}
+
+
+static void
+elf_put(unsigned char *p, int size, uint64_t v, int msb)
+{
+	int i;
+
+	for(i = 0; i < size; i++)
+		if(msb)
+			p[size - 1 - i] = (v >> (8 * i)) & 0xff;
+		else
+			p[i] = (v >> (8 * i)) & 0xff;
+}
+
+
+struct elf_layout {
+	int msb;			/* big endian */
+	int is64;			/* ELFCLASS64 */
+	uint64_t phoff;
+	size_t phentsize, phnum;
+};
+
+
+static int
+elf_get_layout(const unsigned char *image, size_t len, struct elf_layout *l)
+{
+	if(len < EI_NIDENT || memcmp(image, ELFMAG, SELFMAG))
+		return -1;
+
+	if(image[EI_DATA] != ELFDATA2LSB && image[EI_DATA] != ELFDATA2MSB)
+		return -1;
+	l->msb = image[EI_DATA] == ELFDATA2MSB;
+
+	if(image[EI_CLASS] == ELFCLASS32 && len >= sizeof(Elf32_Ehdr))
+	{
+		l->is64 = 0;
+		l->phoff = elf_get(image + offsetof(Elf32_Ehdr, e_phoff), 4, l->msb);
+		l->phentsize = elf_get(image + offsetof(Elf32_Ehdr, e_phentsize), 2, l->msb);
+		l->phnum = elf_get(image + offsetof(Elf32_Ehdr, e_phnum), 2, l->msb);
+		if(l->phnum && l->phentsize < sizeof(Elf32_Phdr))
+			return -1;
+	}
+	else if(image[EI_CLASS] == ELFCLASS64 && len >= sizeof(Elf64_Ehdr))
+	{
+		l->is64 = 1;
+		l->phoff = elf_get(image + offsetof(Elf64_Ehdr, e_phoff), 8, l->msb);
+		l->phentsize = elf_get(image + offsetof(Elf64_Ehdr, e_phentsize), 2, l->msb);
+		l->phnum = elf_get(image + offsetof(Elf64_Ehdr, e_phnum), 2, l->msb);
+		if(l->phnum && l->phentsize < sizeof(Elf64_Phdr))
+			return -1;
+	}
+	else
+		return -1;
+
+	// With PN_XNUM the real count lives in section 0, we don't go there.
+	if(l->phnum == PN_XNUM)
+		return -1;
+
+	return 0;
+}
+
+
+// Return how many bytes of the image we need to see the ELF header and all
+// the phdrs, 0 if not an ELF.  An ET_REL has no phdrs, it is all header.
+size_t
+elf_phdrs_end(const unsigned char *image, size_t len)
+{
+	struct elf_layout l;
+	size_t ehsize, end;
+
+	if(elf_get_layout(image, len, &l))
+		return 0;
+
+	ehsize = l.is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+	end = l.phnum ? l.phoff + l.phnum * l.phentsize : 0;
+
+	return end > ehsize ? end : ehsize;
+}
+
+
+/* Return how long the ELF header at the start of image is, and where its
+ * phdrs are in the file and how many bytes they take in *phoff and *phsize,
+ * 0 if not an ELF or the phdrs are bogus, taking more than ELF_PHDRS_MAX.
+ */
+size_t
+elf_headers(const unsigned char *image, size_t len, uint64_t *phoff, size_t *phsize)
+{
+	struct elf_layout l;
+
+	if(elf_get_layout(image, len, &l) || l.phnum * l.phentsize > ELF_PHDRS_MAX)
+		return 0;
+
+	*phoff = l.phoff;
+	*phsize = l.phnum * l.phentsize;
+
+	return l.is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+}
+
+
+// Point the ELF header at the start of image to phdrs at phoff
+void
+elf_set_phoff(unsigned char *image, size_t len, uint64_t phoff)
+{
+	struct elf_layout l;
+
+	if(elf_get_layout(image, len, &l))
+		return;
+
+	if(l.is64)
+		elf_put(image + offsetof(Elf64_Ehdr, e_phoff), 8, phoff, l.msb);
+	else
+		elf_put(image + offsetof(Elf32_Ehdr, e_phoff), 4, phoff, l.msb);
+}
+
+
+/* Count the phdrs of image which matter for marking it, and get its e_type.
+ * Return -1 if it is not an ELF or its phdrs are not all in it.
+ */
+int
+elf_count_phdrs(const unsigned char *image, size_t len, struct elf_phdr_counts *c)
+{
+	struct elf_layout l;
+	const unsigned char *phdr;
+	size_t i;
+
+	if(elf_get_layout(image, len, &l))
+		return -1;
+
+	if(l.phoff > len || l.phnum * l.phentsize > len - l.phoff)
+		return -1;
+
+	memset(c, 0, sizeof(struct elf_phdr_counts));
+
+	// e_type is at the same offset in both classes
+	c->type = elf_get(image + offsetof(Elf64_Ehdr, e_type), 2, l.msb);
+
+	for(i = 0; i < l.phnum; i++)
+	{
+		phdr = image + l.phoff + i * l.phentsize;
+		switch(elf_get(phdr, 4, l.msb))
+		{
+			case PT_PAX_FLAGS:
+				c->pt_pax++;
+				break;
+			case PT_GNU_STACK:
+				c->gnu_stack++;
+				break;
+			case PT_NULL:
+				c->null++;
+				break;
+			case PT_INTERP:
+				c->interp++;
+				break;
+		}
+	}
+
+	return 0;
+}
+
+
+#ifdef PTPAX
+// Read the flags of the last PT_PAX_FLAGS phdr, or if pt_flags != NULL, set them on all
+static uint16_t
+pt_flags_mem(unsigned char *image, size_t len, const uint16_t *pt_flags)
+{
+	struct elf_layout l;
+	unsigned char *phdr;
+	size_t i, type_off, flags_off;
+	uint16_t flags = UINT16_MAX;
+
+	if(elf_get_layout(image, len, &l))
+		return UINT16_MAX;
+
+	if(l.phoff > len || l.phnum * l.phentsize > len - l.phoff)
+		return UINT16_MAX;
+
+	type_off = l.is64 ? offsetof(Elf64_Phdr, p_type) : offsetof(Elf32_Phdr, p_type);
+	flags_off = l.is64 ? offsetof(Elf64_Phdr, p_flags) : offsetof(Elf32_Phdr, p_flags);
+
+	for(i = 0; i < l.phnum; i++)
+	{
+		phdr = image + l.phoff + i * l.phentsize;
+
+		if(elf_get(phdr + type_off, 4, l.msb) != PT_PAX_FLAGS)
+			continue;
+
+		if(pt_flags)
+		{
+			//RANDEXEC is deprecated, we'll force it off like paxctl
+			elf_put(phdr + flags_off, 4, *pt_flags | PF_NORANDEXEC, l.msb);
+			flags = *pt_flags;
+		}
+		else
+			flags = elf_get(phdr + flags_off, 4, l.msb);
+	}
+
+	return flags;
+}
+
+
+uint16_t
+get_pt_flags_mem(const unsigned char *image, size_t len)
+{
+	return pt_flags_mem((unsigned char *)image, len, NULL);
+}
+
+
+int
+set_pt_flags_mem(unsigned char *image, size_t len, uint16_t pt_flags)
+{
+	if(pt_flags_mem(image, len, &pt_flags) == UINT16_MAX)
+		return EXIT_FAILURE;
+	else
+		return EXIT_SUCCESS;
+}
+#endif
+
+
+#ifdef XTPAX
+/* XATTR_PAX only stores what bin2string() prints, so two words match
+ * if they print the same, whatever else is set in them.
+ */
+int
+same_xt_flags(uint16_t a, uint16_t b)
+{
+	char abuf[FLAGS_SIZE], bbuf[FLAGS_SIZE];
+
+	memset(abuf, 0, FLAGS_SIZE);
+	memset(bbuf, 0, FLAGS_SIZE);
+	bin2string(a, abuf);
+	bin2string(b, bbuf);
+
+	return !strcmp(abuf, bbuf);
+}
+
+
+/* xflags is XATTR_CREATE where the caller found no XATTR_PAX, XATTR_REPLACE
+ * where it found one, or 0 to write it whatever is there.  errno is kept.
+ */
+int
+set_xt_flags(int fd, uint16_t xt_flags, int xflags)
+{
+	char buf[FLAGS_SIZE];
+	int err;
+
+	memset(buf, 0, FLAGS_SIZE);
+	bin2string(xt_flags, buf);
+
+	if( !fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), xflags) )
+		return EXIT_SUCCESS;
+	else
+	{
+		err = errno;
+		xtcap_failed(fd, err);
+		errno = err;
+		return EXIT_FAILURE;
+	}
+}
+#endif
+
+
+/* rdwr_pt_pax says whether PT_PAX can be written and xt whether XATTR_PAX
+ * can, as xtcap() returns it.
+ */
+int
+set_flags(int fd, uint16_t *pax_flags, int rdwr_pt_pax, int xt, int limit, int verbose, int *changed)
+{
+	uint16_t flags, nflags;
+	int ret = EXIT_FAILURE;
+#ifdef XTPAX
+	int tries;
+#endif
+
+#ifdef PTPAX
+	if(rdwr_pt_pax)
+	{
+#ifdef XTPAX
+		if( !(limit == LIMIT_TO_XT_FLAGS))
+		{
+#endif
+			// Only go through a libelf RDWR update if the stored
+			// word would actually change.  If get_pt_flags() fails
+			// we still call set_pt_flags() so its error is reported.
+			flags = get_pt_flags(fd, verbose);
+			if( flags == UINT16_MAX )
+			{
+				nflags = update_flags( PF_NOEMUTRAMP, *pax_flags);
+				ret = set_pt_flags(fd, nflags, verbose);
+			}
+			else
+			{
+				nflags = update_flags( flags, *pax_flags);
+				if( (uint16_t)(nflags | PF_NORANDEXEC) == flags )
+					ret = EXIT_SUCCESS;
+				else
+				{
+					ret = set_pt_flags(fd, nflags, verbose);
+					if(ret == EXIT_SUCCESS)
+						*changed = 1;
+				}
+			}
+#ifdef XTPAX
+		}
+#endif
+
+	}
+#endif
+
+#ifdef XTPAX
+#ifdef PTPAX
+	if( !(limit == LIMIT_TO_PT_FLAGS) )
+	{
+#endif
+		/* mark_xt_path() creates and removes XATTR_PAX without the
+		 * lock, so only create it where we found none and only
+		 * replace it where we found one.  If it came or went since
+		 * we read it, read it again and merge into that.
+		 */
+		for(tries = 1; ; tries++)
+		{
+			// Without user.* xattrs PT_PAX alone does, if it was asked for
+			if( (flags = get_xt_flags(fd)) == UINT16_MAX && errno == ENOTSUP )
+			{
+				if(verbose)
+					printf("\tXATTR_PAX cannot be used on this filesystem\n");
+				if( !rdwr_pt_pax || limit != 0 )
+					ret = EXIT_FAILURE;
+				break;
+			}
+			nflags = update_flags( flags == UINT16_MAX ? PF_NOEMUTRAMP : flags, *pax_flags);
+			if( flags != UINT16_MAX && same_xt_flags(nflags, flags) )
+				ret = EXIT_SUCCESS;
+			else if( !(xt & XTCAP_SET) )
+				ret = EXIT_FAILURE;
+			else
+			{
+				ret = set_xt_flags(fd, nflags, flags == UINT16_MAX ? XATTR_CREATE : XATTR_REPLACE);
+				if(ret == EXIT_SUCCESS)
+					*changed = 1;
+				else if( (errno == EEXIST || errno == ENOATTR) && tries < MARK_XT_TRIES )
+					continue;
+			}
+			break;
+		}
+#ifdef PTPAX
+	}
+#endif
+#endif
+
+	return ret;
+}
+
+
+#ifdef XTPAX
+int
+create_xt_flags(int fd, int cp_flags, int *changed)
+{
+	char buf[FLAGS_SIZE];
+	uint16_t xt_flags;
+
+	if(cp_flags == CREATE_XT_FLAGS_SECURE)
+		xt_flags = PF_PAGEEXEC | PF_SEGMEXEC | PF_MPROTECT |
+			PF_NOEMUTRAMP | PF_RANDMMAP ;
+	else if(cp_flags == CREATE_XT_FLAGS_DEFAULT)
+		xt_flags = 0;
+	else
+		//Why are we here?
+		return EXIT_FAILURE;
+
+	memset(buf, 0, FLAGS_SIZE);
+	bin2string(xt_flags, buf);
+
+	if( !fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), XATTR_CREATE) )
+	{
+		*changed = 1;
+		return EXIT_SUCCESS;
+	}
+	else
+	{
+		xtcap_failed(fd, errno);
+		return EXIT_FAILURE;
+	}
+}
+
+int
+delete_xt_flags(int fd, int *changed)
+{
+	int err;
+
+	if( !fremovexattr(fd, PAX_NAMESPACE) )
+	{
+		*changed = 1;
+		return EXIT_SUCCESS;
+	}
+	else
+	{
+		// If this fails because there was no such named xattr
+		// in the first place, then in a sense, we succeeded.
+		// See: https://bugs.gentoo.org/show_bug.cgi?id=485908
+		if( (err = errno) == ENOATTR )
+			return EXIT_SUCCESS;
+
+		// Nor is there one where user.* xattrs cannot even be read
+		xtcap_failed(fd, err);
+		if( err == ENOTSUP && get_xt_flags(fd) == UINT16_MAX && errno == ENOTSUP )
+			return EXIT_SUCCESS;
+		else
+			return EXIT_FAILURE;
+	}
+}
+#endif
+
+
+#if defined(PTPAX) && defined(XTPAX)
+int
+copy_xt_flags(int fd, int cp_flags, int xt, int verbose, int *changed)
+{
+	uint16_t flags, oflags;
+	int ret = EXIT_FAILURE;
+
+	if(cp_flags == COPY_PT_TO_XT_FLAGS)
+	{
+		flags = get_pt_flags(fd, verbose);
+		if( flags != UINT16_MAX )
+		{
+			oflags = get_xt_flags(fd);
+			if( oflags != UINT16_MAX && same_xt_flags(oflags, flags) )
+				ret = EXIT_SUCCESS;
+			else if( !(xt & XTCAP_SET) )
+				ret = EXIT_FAILURE;
+			else if( (ret = set_xt_flags(fd, flags, 0)) == EXIT_SUCCESS )
+				*changed = 1;
+		}
+	}
+	else if(cp_flags == COPY_XT_TO_PT_FLAGS)
+	{
+		flags = get_xt_flags(fd);
+		if( flags != UINT16_MAX )
+		{
+			oflags = get_pt_flags(fd, verbose);
+			if( oflags != UINT16_MAX && (uint16_t)(flags | PF_NORANDEXEC) == oflags )
+				ret = EXIT_SUCCESS;
+			else if( (ret = set_pt_flags(fd, flags, verbose)) == EXIT_SUCCESS )
+				*changed = 1;
+		}
+	}
+
+	return ret;
+}
+#endif
+
+
+/* Take an exclusive lock on fd for the read, merge and write of its
+ * markings, so the same file marked by several processes or threads at
+ * once, eg. a library during parallel builds, gets all the updates.  The
+ * lock goes with the open file, like an OFD lock, but flock() also takes
+ * it on a file only opened O_RDONLY, which is how a running executable
+ * gets its XATTR_PAX.  Wait at most MARK_LOCK_WAIT ms, backing off, and
+ * return -1 if someone still has it by then.  Where the filesystem does
+ * not do locks we mark unlocked, as we always did.
+ */
+int
+lock_file(int fd)
+{
+	struct timespec ts;
+	long backoff = MARK_LOCK_BACKOFF_MIN, waited = 0;
+
+	for(;;)
+	{
+		if(flock(fd, LOCK_EX | LOCK_NB) == 0)
+			return 0;
+		if(errno == EINTR)
+			continue;
+		if(errno != EWOULDBLOCK)
+			return 0;
+		if(waited >= MARK_LOCK_WAIT)
+			return -1;
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = backoff * 1000000;
+		nanosleep(&ts, NULL);
+		waited += backoff;
+		backoff *= 2;
+		if(backoff > MARK_LOCK_BACKOFF_MAX)
+			backoff = MARK_LOCK_BACKOFF_MAX;
+	}
+}
+
+
+/* Apply the copy, create or delete in cp_flags, then pax_flags, to path.
+ * Return the fd, which is left open so the flags can be read back, or -1
+ * if path cannot be opened at all.  *fret is EXIT_FAILURE if an update
+ * failed and *changed is set if a marking was changed.
+ */
+int
+mark_file(const char *path, uint16_t pax_flags, int cp_flags, int limit, int verbose,
+	int *changed, int *fret)
+{
+	int fd;
+	int rdwr_pt_pax = 1;
+	int xt = XTCAP_SET;
+
+	*changed = 0;
+	*fret = EXIT_SUCCESS;
+
+	if((fd = sysroot_open(path, O_RDWR)) < 0)
+	{
+		rdwr_pt_pax = 0;
+#ifdef PTPAX
+		if(verbose)
+			printf("\topen(O_RDWR) failed: cannot change PT_PAX flags\n");
+#endif
+		if((fd = sysroot_open(path, O_RDONLY)) < 0)
+		{
+			if(verbose)
+				printf("\topen(O_RDONLY) failed: cannot read/change PAX flags\n\n");
+			return -1;
+		}
+	}
+
+	if(pax_flags == 0 && cp_flags == 0)
+		return fd;
+
+	if(lock_file(fd) < 0)
+	{
+		if(verbose)
+			printf("\tflock() timed out: cannot change PAX flags\n");
+		*fret = EXIT_FAILURE;
+		return fd;
+	}
+
+#ifdef XTPAX
+	/* Leave out XATTR_PAX where it is known not to be written on this
+	 * filesystem.  There a file whose PT_PAX can be written is only
+	 * marked there, unless XATTR_PAX was asked for, rather than failing
+	 * every time.  Where it cannot even be read, set_flags() finds out.
+	 */
+	xt = xtcap(fd, NULL);
+	if(!(xt & XTCAP_SET) && limit != LIMIT_TO_PT_FLAGS)
+	{
+		if(verbose)
+			printf("\tXATTR_PAX cannot be written on this filesystem\n");
+#ifdef PTPAX
+		if(rdwr_pt_pax && limit == 0)
+			limit = LIMIT_TO_PT_FLAGS;
+#endif
+	}
+
+	if(cp_flags == CREATE_XT_FLAGS_SECURE || cp_flags == CREATE_XT_FLAGS_DEFAULT)
+		*fret |= xt & XTCAP_SET ? create_xt_flags(fd, cp_flags, changed) : EXIT_FAILURE;
+	// Where it cannot be written, only a missing XATTR_PAX is deleted
+	if(cp_flags == DELETE_XT_FLAGS)
+		*fret |= xt & XTCAP_SET ? delete_xt_flags(fd, changed) :
+			get_xt_flags(fd) == UINT16_MAX ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+
+#if defined(PTPAX) && defined(XTPAX)
+	if(cp_flags == COPY_PT_TO_XT_FLAGS || (cp_flags == COPY_XT_TO_PT_FLAGS && rdwr_pt_pax))
+		*fret |= copy_xt_flags(fd, cp_flags, xt, verbose, changed);
+#endif
+
+	if(pax_flags != 0)
+		*fret |= set_flags(fd, &pax_flags, rdwr_pt_pax, xt, limit, verbose, changed);
+
+	flock(fd, LOCK_UN);
+
+	return fd;
+}
@@ -0,0 +1,211 @@
+/*
+	paxmark-builtin.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* paxmark as a bash loadable builtin, so marking the ELF objects of a
+ * package does not cost a fork, an exec and a load of libelf per file.
+ *
+ *	enable -f paxmark.so paxmark
+ *	paxmark [-L|-l] [-a NAME] FLAGS ELF...
+ *
+ * FLAGS and PAX_MARKINGS mean what they do to paxmarksh() in paxmark.sh,
+ * and each file gets what its paxctl-ng steps would do: for PT_PAX
+ * "paxctl-ng -L -z" if FLAGS has a z and then "paxctl-ng -L -FLAGS", for
+ * XATTR_PAX "paxctl-ng -d" if FLAGS has a z and then "paxctl-ng -l -FLAGS".
+ * -L or -l do only one of the two, whatever PAX_MARKINGS says.
+ *
+ * The files which could not be marked are put in the indexed array NAME,
+ * so the caller can fall back on the tools which can do more than
+ * paxctl-ng, like paxctl creating a PT_PAX_FLAGS phdr.
+ */
+
+#include "loadables.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+#define PAXMARK_MARKINGS	"PT XT"
+
+// As paxctl-ng -z
+#define PAXMARK_DEFAULT_FLAGS	(PF_PAGEEXEC | PF_NOPAGEEXEC | PF_SEGMEXEC | PF_NOSEGMEXEC | \
+				 PF_MPROTECT | PF_NOMPROTECT | PF_EMUTRAMP | PF_NOEMUTRAMP | \
+				 PF_RANDMMAP | PF_NORANDMMAP)
+
+
+static int
+mark(const char *path, uint16_t pax_flags, int cp_flags, int limit)
+{
+	int fd, changed, fret;
+
+	if((fd = mark_file(path, pax_flags, cp_flags, limit, 0, &changed, &fret)) < 0)
+		return -1;
+	close(fd);
+
+	return fret == EXIT_SUCCESS ? 0 : -1;
+}
+
+
+// paxctl-ng -L -z ELF; paxctl-ng -L -FLAGS ELF
+static int
+mark_pt(const char *path, uint16_t flags, int dodefault)
+{
+#ifdef PTPAX
+	if(dodefault)
+		mark(path, PAXMARK_DEFAULT_FLAGS, 0, LIMIT_TO_PT_FLAGS);
+
+	if(flags == 0)
+		return 0;
+
+	return mark(path, flags, 0, LIMIT_TO_PT_FLAGS);
+#else
+	return -1;
+#endif
+}
+
+
+// paxctl-ng -d ELF; paxctl-ng -l -FLAGS ELF
+static int
+mark_xt(const char *path, uint16_t flags, int dodefault)
+{
+#ifdef XTPAX
+	if(dodefault)
+		mark(path, 0, DELETE_XT_FLAGS, 0);
+
+	if(flags == 0)
+		return 0;
+
+	return mark(path, flags, 0, LIMIT_TO_XT_FLAGS);
+#else
+	return -1;
+#endif
+}
+
+
+int
+paxmark_builtin(WORD_LIST *list)
+{
+	WORD_LIST *l;
+	SHELL_VAR *failed = NULL;
+	char *name = NULL, *markings, *sflags;
+	arrayind_t nfailed = 0;
+	uint16_t flags;
+	int opt, do_pt, do_xt, dodefault, ret;
+
+	markings = get_string_value("PAX_MARKINGS");
+	if(markings == NULL)
+		markings = PAXMARK_MARKINGS;
+
+	// Like has() in paxmark.sh, any substring will do
+	do_pt = strstr(markings, "PT") != NULL;
+	do_xt = strstr(markings, "XT") != NULL;
+
+	reset_internal_getopt();
+	while((opt = internal_getopt(list, "Lla:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'L':
+				do_pt = 1;
+				do_xt = 0;
+				break;
+			case 'l':
+				do_pt = 0;
+				do_xt = 1;
+				break;
+			case 'a':
+				name = list_optarg;
+				break;
+			CASE_HELPOPT;
+			default:
+				builtin_usage();
+				return EX_USAGE;
+		}
+	}
+	list = loptend;
+
+	if(list == NULL)
+	{
+		builtin_usage();
+		return EX_USAGE;
+	}
+
+	if(name)
+	{
+		if(legal_identifier(name) == 0)
+		{
+			sh_invalidid(name);
+			return EXECUTION_FAILURE;
+		}
+		if((failed = find_or_make_array_variable(name, 1)) == NULL)
+			return EXECUTION_FAILURE;
+		array_flush(array_cell(failed));
+	}
+
+	// Only the actual PaX flags and z are accepted, anything else is dropped
+	sflags = list->word->word;
+	flags = parse_sflags(sflags);
+	dodefault = strchr(sflags, 'z') != NULL;
+	if(flags == 0 && !dodefault)
+		return EXECUTION_SUCCESS;
+
+	for(l = list->next; l; l = l->next)
+	{
+		// As in paxmarksh(), a file PT_PAX fails on still gets XATTR_PAX
+		ret = 0;
+		if(do_pt && mark_pt(l->word->word, flags, dodefault) < 0)
+			ret = -1;
+		if(do_xt && mark_xt(l->word->word, flags, dodefault) < 0)
+			ret = -1;
+
+		if(ret < 0)
+		{
+			if(failed)
+				bind_array_element(failed, nfailed, l->word->word, 0);
+			nfailed++;
+		}
+	}
+
+	return nfailed ? EXECUTION_FAILURE : EXECUTION_SUCCESS;
+}
+
+
+char *paxmark_doc[] = {
+	"Set the PaX flags of ELF objects without forking paxctl-ng.",
+	"",
+	"FLAGS is made of PpEeMmRrSs and z, for the default, as for paxmark.sh.",
+	"PT_PAX and XATTR_PAX are marked as PAX_MARKINGS says, or only PT_PAX",
+	"with -L and only XATTR_PAX with -l.  The ELF objects which could not",
+	"be marked are stored in the indexed array NAME given with -a.",
+	"",
+	"Exit Status:",
+	"Returns success unless an ELF object could not be marked or an invalid",
+	"option is given.",
+	(char *)NULL
+};
+
+struct builtin paxmark_struct = {
+	"paxmark",
+	paxmark_builtin,
+	BUILTIN_ENABLED,
+	paxmark_doc,
+	"paxmark [-L|-l] [-a name] flags elf ...",
+	0
+};
@@ -0,0 +1,258 @@
+/*
+	paxnocache.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Read the markings of many files without leaving them in the page cache.
+ *
+ * libelf maps the whole file, and its readahead pulls in far more than the
+ * ELF header and program headers, which is all PT_PAX needs.  A sweep over
+ * a system then pushes the hot data of everything else out of the cache.
+ * With --nocache:
+ *
+ *	the file is opened with O_NOATIME where we are allowed to, so the
+ *	sweep does not dirty the inodes either, and POSIX_FADV_RANDOM turns
+ *	off readahead on it
+ *
+ *	only the ELF header and then the program headers are read, with
+ *	pread(), and parsed by get_pt_flags_mem()
+ *
+ *	the pages read are dropped again with POSIX_FADV_DONTNEED, unless
+ *	they were in the cache before, as cachestat(2) or else mincore(2)
+ *	tells, so whatever the rest of the system uses stays where it is
+ *
+ * XATTR_PAX lives in the inode and does not touch the page cache at all.
+ */
+
+#define _GNU_SOURCE		/* O_NOATIME */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "paxctl-ng.h"
+
+#define NOCACHE_EHDR_SIZE	64		/* sizeof(Elf64_Ehdr), the larger one */
+#define NOCACHE_PAGES_MAX	64		/* phdrs spanning more are read but not dropped */
+
+static int nocache_on;
+
+#ifdef SYS_cachestat
+struct nocache_cachestat_range
+{
+	uint64_t off;
+	uint64_t len;
+};
+
+struct nocache_cachestat
+{
+	uint64_t nr_cache;
+	uint64_t nr_dirty;
+	uint64_t nr_writeback;
+	uint64_t nr_evicted;
+	uint64_t nr_recently_evicted;
+};
+
+// Set once the kernel turns out not to have cachestat(), by any thread,
+// so it is only ever read and written with __atomic_*()
+static int no_cachestat;
+#endif
+
+
+void
+nocache_start(int on)
+{
+	nocache_on = on;
+}
+
+
+int
+nocache_open(const char *path)
+{
+	int fd;
+
+	if(!nocache_on)
+		return sysroot_open(path, O_RDONLY);
+
+#ifdef O_NOATIME
+	// O_NOATIME is only for the owner or CAP_FOWNER
+	if((fd = sysroot_open(path, O_RDONLY | O_NOATIME)) < 0 && errno == EPERM)
+		fd = sysroot_open(path, O_RDONLY);
+#else
+	fd = sysroot_open(path, O_RDONLY);
+#endif
+
+	if(fd >= 0)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+	return fd;
+}
+
+
+/* Set resident[i] if page first + i of fd is in the page cache, for n
+ * pages.  Return -1 if it cannot be told.
+ */
+static int
+pages_resident(int fd, off_t first, size_t n, size_t page, unsigned char *resident)
+{
+	void *addr;
+	size_t i;
+	int ret;
+
+#ifdef SYS_cachestat
+	struct nocache_cachestat_range r;
+	struct nocache_cachestat cs;
+
+	for(i = 0; i < n && !__atomic_load_n(&no_cachestat, __ATOMIC_RELAXED); i++)
+	{
+		r.off = (first + i) * page;
+		r.len = page;
+		if(syscall(SYS_cachestat, fd, &r, &cs, 0) < 0)
+		{
+			// Older kernels, fall back on mincore()
+			if(errno == ENOSYS)
+				__atomic_store_n(&no_cachestat, 1, __ATOMIC_RELAXED);
+			else
+				return -1;
+		}
+		else
+			resident[i] = cs.nr_cache > 0;
+	}
+
+	if(!__atomic_load_n(&no_cachestat, __ATOMIC_RELAXED))
+		return 0;
+#endif
+
+	// Mapping the file does not fault anything in, mincore() only looks
+	if((addr = mmap(NULL, n * page, PROT_READ, MAP_SHARED, fd, first * page)) == MAP_FAILED)
+		return -1;
+
+	ret = mincore(addr, n * page, resident);
+	munmap(addr, n * page);
+	if(ret < 0)
+		return -1;
+
+	for(i = 0; i < n; i++)
+		resident[i] &= 1;
+
+	return 0;
+}
+
+
+/* pread() len bytes at off into buf, and with --nocache drop the pages
+ * this brought into the page cache.  Return what pread() does.
+ */
+static ssize_t
+pread_nocache(int fd, void *buf, size_t len, off_t off)
+{
+	unsigned char resident[NOCACHE_PAGES_MAX];
+	size_t page, n, i;
+	off_t first;
+	ssize_t ret;
+	int known;
+
+	if(!nocache_on)
+		return pread(fd, buf, len, off);
+
+	page = sysconf(_SC_PAGESIZE);
+	first = off / page;
+	n = (off + len + page - 1) / page - first;
+
+	known = n <= NOCACHE_PAGES_MAX && pages_resident(fd, first, n, page, resident) == 0;
+
+	ret = pread(fd, buf, len, off);
+
+	// If we could not tell, rather leave a page in than evict a hot one
+	if(known)
+		for(i = 0; i < n; i++)
+			if(!resident[i])
+				posix_fadvise(fd, (first + i) * page, page, POSIX_FADV_DONTNEED);
+
+	return ret;
+}
+
+
+/* Read the ELF header and the phdrs of fd into a buffer which holds just
+ * those two, the phdrs right after the header which is patched to point to
+ * them there, which is all get_pt_flags_mem() and elf_count_phdrs() look
+ * at.  Whatever lies between them in the file is not read, nor buffered.
+ * With --nocache the pages read are dropped again.  Return NULL if fd is
+ * not an ELF or cannot be read.
+ */
+unsigned char *
+read_elf_headers(int fd, size_t *len)
+{
+	unsigned char ehdr[NOCACHE_EHDR_SIZE];
+	unsigned char *image;
+	struct stat st;
+	uint64_t phoff;
+	size_t ehsize, phsize;
+	ssize_t n;
+
+	if(fstat(fd, &st) < 0 || (n = pread_nocache(fd, ehdr, sizeof(ehdr), 0)) < 0)
+		return NULL;
+
+	if((ehsize = elf_headers(ehdr, n, &phoff, &phsize)) == 0
+			|| phoff > (uint64_t)st.st_size || phsize > (uint64_t)st.st_size - phoff)
+		return NULL;
+
+	if((image = malloc(ehsize + phsize)) == NULL)
+		return NULL;
+	memcpy(image, ehdr, ehsize);
+
+	if(phsize > 0 && pread_nocache(fd, image + ehsize, phsize, phoff) != (ssize_t)phsize)
+	{
+		free(image);
+		return NULL;
+	}
+	elf_set_phoff(image, ehsize, ehsize);
+
+	*len = ehsize + phsize;
+	return image;
+}
+
+
+#ifdef PTPAX
+uint16_t
+nocache_get_pt_flags(int fd, int verbose)
+{
+	unsigned char *image;
+	size_t len;
+	uint16_t pt_flags;
+
+	if(!nocache_on)
+		return get_pt_flags(fd, verbose);
+
+	if((image = read_elf_headers(fd, &len)) == NULL)
+	{
+		if(verbose)
+			printf("\tELF ERROR: cannot read the ELF and program headers\n");
+		return UINT16_MAX;
+	}
+
+	pt_flags = get_pt_flags_mem(image, len);
+	free(image);
+
+	return pt_flags;
+}
+#endif
@@ -0,0 +1,679 @@
+/*
+	paxserve.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* A persistent paxctl-ng on a UNIX socket, and the client which talks to
+ * it, so that marking a package costs a few round trips rather than a
+ * process, a dynamic link of libelf and an elf_version() per file.
+ *
+ * Both ends are the same binary on the same host, so the protocol is a
+ * plain exchange of structs in host byte order.  A request is a srv_req
+ * followed by npaths NUL terminated paths, all of which get the same
+ * operation, just as the ELF arguments of one paxctl-ng do.  The reply is
+ * a srv_reply followed by one srv_result per path, in the same order.
+ *
+ * Each connection has a thread which reads requests and queues them for a
+ * pool of workers, so a client can send the next request before the
+ * reply to the last one has come back.  Replies carry the id of their
+ * request and are sent as soon as they are done, which need not be in
+ * the order the requests were sent.  No more than SRV_QUEUED_MAX bytes of
+ * requests are queued for one connection, past that its reader waits for
+ * the workers, and the client's sends with it.  A connection for which
+ * memory runs out is dropped, the server and its other clients go on.
+ *
+ * The server marks whatever path it is sent with its own rights, usually
+ * root's, so the socket is made 0600 and only connections from its own
+ * user or root are served.
+ */
+
+#define _GNU_SOURCE		/* struct ucred */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "paxctl-ng.h"
+
+#define SRV_REQ_MAX		(4 * 1024 * 1024)	/* largest request accepted */
+#define SRV_QUEUED_MAX		(8 * 1024 * 1024)	/* bytes of requests queued per connection */
+#define SRV_BATCH		64			/* paths the client puts in a request */
+#define SRV_WINDOW		16			/* requests the client has in flight */
+#define SRV_WORKERS_MAX		32
+#define SRV_BACKLOG		64
+
+#define SRV_OK			0
+#define SRV_EOPEN		1			/* the file could not be opened */
+#define SRV_EUPDATE		2			/* changing a marking failed */
+#define SRV_EINVAL		3			/* not supported by this server */
+
+struct srv_req
+{
+	uint32_t len;			/* bytes following this field */
+	uint32_t id;			/* echoed in the reply */
+	uint16_t pax_flags;		/* as given by -PpEeMmRrSs|-Z|-z */
+	uint8_t cp_flags;		/* CREATE_XT_FLAGS_SECURE ... COPY_XT_TO_PT_FLAGS or 0 */
+	uint8_t limit;			/* LIMIT_TO_PT_FLAGS, LIMIT_TO_XT_FLAGS or 0 */
+	uint32_t npaths;
+};
+
+struct srv_reply
+{
+	uint32_t len;			/* bytes following this field */
+	uint32_t id;
+	uint32_t nresults;
+	uint32_t pad;
+};
+
+struct srv_result
+{
+	uint16_t pt_flags;		/* after the operation, UINT16_MAX if missing */
+	uint16_t xt_flags;
+	uint8_t status;
+	uint8_t changed;
+	uint16_t pad;
+};
+
+struct srv_conn
+{
+	int fd;
+	int refs;			/* the reader and every queued job */
+	size_t queued;			/* bytes of the queued jobs' requests */
+	pthread_mutex_t lock;		/* guards refs, queued and writes to fd */
+	pthread_cond_t done;		/* a job is done, queued went down */
+};
+
+struct srv_job
+{
+	struct srv_job *next;
+	struct srv_conn *conn;
+	struct srv_req req;
+	char paths[];
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct srv_job *head, *tail;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL };
+
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+	size_t done = 0;
+
+	while(done < len)
+	{
+		if((n = read(fd, (char *)buf + done, len - done)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		if(n == 0)
+			return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+	size_t done = 0;
+
+	while(done < len)
+	{
+		if((n = send(fd, (const char *)buf + done, len - done, MSG_NOSIGNAL)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+
+// Drop a reference to conn, that of a job whose request was len bytes
+static void
+conn_put(struct srv_conn *conn, size_t len)
+{
+	int refs;
+
+	pthread_mutex_lock(&conn->lock);
+	refs = --conn->refs;
+	conn->queued -= len;
+	pthread_cond_signal(&conn->done);
+	pthread_mutex_unlock(&conn->lock);
+
+	if(refs == 0)
+	{
+		close(conn->fd);
+		pthread_cond_destroy(&conn->done);
+		pthread_mutex_destroy(&conn->lock);
+		free(conn);
+	}
+}
+
+
+static int
+supported(uint8_t cp_flags)
+{
+	switch(cp_flags)
+	{
+		case 0:
+#ifdef XTPAX
+		case CREATE_XT_FLAGS_SECURE:
+		case CREATE_XT_FLAGS_DEFAULT:
+		case DELETE_XT_FLAGS:
+#endif
+#if defined(PTPAX) && defined(XTPAX)
+		case COPY_PT_TO_XT_FLAGS:
+		case COPY_XT_TO_PT_FLAGS:
+#endif
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+
+static void
+run_job(struct srv_job *job)
+{
+	struct srv_reply *reply;
+	struct srv_result *res;
+	const char *path;
+	size_t size;
+	uint32_t i;
+	int fd, changed, fret;
+
+	// Without a reply the client would wait forever, so it is cut off
+	size = sizeof(struct srv_reply) + job->req.npaths * sizeof(struct srv_result);
+	if((reply = calloc(1, size)) == NULL)
+	{
+		warn("calloc, dropping the connection");
+		shutdown(job->conn->fd, SHUT_RDWR);
+		return;
+	}
+
+	reply->len = size - sizeof(reply->len);
+	reply->id = job->req.id;
+	reply->nresults = job->req.npaths;
+	res = (struct srv_result *)(reply + 1);
+
+	path = job->paths;
+	for(i = 0; i < job->req.npaths; i++, path += strlen(path) + 1)
+	{
+		res[i].pt_flags = UINT16_MAX;
+		res[i].xt_flags = UINT16_MAX;
+
+		if(!supported(job->req.cp_flags))
+		{
+			res[i].status = SRV_EINVAL;
+			continue;
+		}
+
+		if((fd = mark_file(path, job->req.pax_flags, job->req.cp_flags,
+				job->req.limit, 0, &changed, &fret)) < 0)
+		{
+			res[i].status = SRV_EOPEN;
+			continue;
+		}
+
+		read_flags(fd, 0, &res[i].pt_flags, &res[i].xt_flags);
+		throttle_fd(fd);
+		close(fd);
+
+		res[i].status = fret == EXIT_SUCCESS ? SRV_OK : SRV_EUPDATE;
+		res[i].changed = changed;
+	}
+
+	// A client which has gone away just does not get its reply
+	pthread_mutex_lock(&job->conn->lock);
+	write_full(job->conn->fd, reply, size);
+	pthread_mutex_unlock(&job->conn->lock);
+
+	free(reply);
+}
+
+
+static void *
+worker(void *arg)
+{
+	struct srv_job *job;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&queue.lock);
+		while(queue.head == NULL)
+			pthread_cond_wait(&queue.cond, &queue.lock);
+		job = queue.head;
+		if((queue.head = job->next) == NULL)
+			queue.tail = NULL;
+		pthread_mutex_unlock(&queue.lock);
+
+		run_job(job);
+		conn_put(job->conn, job->req.len);
+		free(job);
+	}
+
+	return NULL;
+}
+
+
+/* Check that the paths are npaths NUL terminated strings which exactly
+ * fill the request.
+ */
+static int
+valid_paths(const char *paths, size_t len, uint32_t npaths)
+{
+	const char *p, *end;
+	uint32_t n = 0;
+
+	for(p = paths; p < paths + len; p = end + 1, n++)
+		if((end = memchr(p, 0, paths + len - p)) == NULL)
+			return 0;
+
+	return n == npaths;
+}
+
+
+static void *
+reader(void *arg)
+{
+	struct srv_conn *conn = arg;
+	struct srv_job *job;
+	struct srv_req req;
+	size_t len;
+
+	while(read_full(conn->fd, &req, sizeof(req)) == 0)
+	{
+		if(req.len < sizeof(req) - sizeof(req.len) || req.len > SRV_REQ_MAX)
+			break;
+
+		// Wait for the workers rather than queue without end
+		pthread_mutex_lock(&conn->lock);
+		while(conn->queued > 0 && conn->queued + req.len > SRV_QUEUED_MAX)
+			pthread_cond_wait(&conn->done, &conn->lock);
+		pthread_mutex_unlock(&conn->lock);
+
+		len = req.len - (sizeof(req) - sizeof(req.len));
+		if((job = malloc(sizeof(struct srv_job) + len)) == NULL)
+		{
+			warn("malloc, dropping the connection");
+			shutdown(conn->fd, SHUT_RDWR);
+			break;
+		}
+
+		if(read_full(conn->fd, job->paths, len) < 0 || !valid_paths(job->paths, len, req.npaths))
+		{
+			free(job);
+			break;
+		}
+
+		job->next = NULL;
+		job->conn = conn;
+		job->req = req;
+
+		pthread_mutex_lock(&conn->lock);
+		conn->refs++;
+		conn->queued += req.len;
+		pthread_mutex_unlock(&conn->lock);
+
+		pthread_mutex_lock(&queue.lock);
+		if(queue.tail)
+			queue.tail->next = job;
+		else
+			queue.head = job;
+		queue.tail = job;
+		pthread_cond_signal(&queue.cond);
+		pthread_mutex_unlock(&queue.lock);
+	}
+
+	// Stop reading but let the queued jobs still reply
+	shutdown(conn->fd, SHUT_RD);
+	conn_put(conn, 0);
+
+	return NULL;
+}
+
+
+static void
+socket_addr(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr->sun_path))
+		errx(EXIT_FAILURE, "socket path %s is too long", path);
+	strcpy(addr->sun_path, path);
+}
+
+
+// Bind lfd to addr with the socket only accessible to our user
+static int
+bind_private(int lfd, const struct sockaddr_un *addr)
+{
+	mode_t mask;
+	int ret;
+
+	mask = umask(0177);
+	ret = bind(lfd, (const struct sockaddr *)addr, sizeof(struct sockaddr_un));
+	umask(mask);
+
+	return ret;
+}
+
+
+// Whether the peer on fd is our user or root, whatever the socket's mode
+static int
+peer_allowed(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return 0;
+
+	return cred.uid == 0 || cred.uid == geteuid();
+}
+
+
+int
+serve(const char *path)
+{
+	struct sockaddr_un addr;
+	struct srv_conn *conn;
+	struct stat st;
+	pthread_attr_t attr;
+	pthread_t thread;
+	long nworkers, i;
+	int lfd, fd;
+
+	socket_addr(path, &addr);
+
+	if((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		err(EXIT_FAILURE, "socket");
+
+	if(bind_private(lfd, &addr) < 0)
+	{
+		if(errno != EADDRINUSE)
+			err(EXIT_FAILURE, "cannot bind %s", path);
+
+		// Only ever replace a socket, never a file which happens to be there
+		if(lstat(path, &st) < 0)
+			err(EXIT_FAILURE, "cannot bind %s", path);
+		if(!S_ISSOCK(st.st_mode))
+			errx(EXIT_FAILURE, "%s exists and is not a socket", path);
+
+		// Take over the socket of a server which is no longer running
+		if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+			err(EXIT_FAILURE, "socket");
+		if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			errx(EXIT_FAILURE, "%s is already being served", path);
+		close(fd);
+
+		if(unlink(path) < 0 && errno != ENOENT)
+			err(EXIT_FAILURE, "cannot remove %s", path);
+		if(bind_private(lfd, &addr) < 0)
+			err(EXIT_FAILURE, "cannot bind %s", path);
+	}
+
+	if(listen(lfd, SRV_BACKLOG) < 0)
+		err(EXIT_FAILURE, "cannot listen on %s", path);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if((nworkers = sysconf(_SC_NPROCESSORS_ONLN)) < 2)
+		nworkers = 2;
+	if(nworkers > SRV_WORKERS_MAX)
+		nworkers = SRV_WORKERS_MAX;
+
+	for(i = 0; i < nworkers; i++)
+		if(pthread_create(&thread, &attr, worker, NULL) != 0)
+			errx(EXIT_FAILURE, "cannot start worker");
+
+	for(;;)
+	{
+		if((fd = accept(lfd, NULL, NULL)) < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			err(EXIT_FAILURE, "accept");
+		}
+
+		if(!peer_allowed(fd))
+		{
+			close(fd);
+			continue;
+		}
+
+		if((conn = malloc(sizeof(struct srv_conn))) == NULL)
+		{
+			warn("malloc, dropping the connection");
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		conn->refs = 1;
+		conn->queued = 0;
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_cond_init(&conn->done, NULL);
+
+		if(pthread_create(&thread, &attr, reader, conn) != 0)
+		{
+			warnx("cannot start a reader, dropping the connection");
+			conn_put(conn, 0);
+		}
+	}
+
+	return EXIT_FAILURE;
+}
+
+
+/* The server does not run in our working directory, so relative paths
+ * are sent with cwd in front of them.
+ */
+static void
+send_batch(int fd, uint32_t id, char *paths[], uint32_t npaths, const char *cwd,
+	uint16_t pax_flags, int cp_flags, int limit)
+{
+	struct srv_req req;
+	char *buf, *p;
+	size_t len, cwdlen;
+	uint32_t i;
+
+	cwdlen = strlen(cwd) + 1;
+
+	len = 0;
+	for(i = 0; i < npaths; i++)
+		len += strlen(paths[i]) + 1 + (paths[i][0] == '/' ? 0 : cwdlen);
+	if(len > SRV_REQ_MAX - sizeof(req))
+		errx(EXIT_FAILURE, "paths are too long");
+
+	if((buf = malloc(sizeof(req) + len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	req.len = sizeof(req) - sizeof(req.len) + len;
+	req.id = id;
+	req.pax_flags = pax_flags;
+	req.cp_flags = cp_flags;
+	req.limit = limit;
+	req.npaths = npaths;
+	memcpy(buf, &req, sizeof(req));
+
+	p = buf + sizeof(req);
+	for(i = 0; i < npaths; i++)
+	{
+		if(paths[i][0] != '/')
+		{
+			memcpy(p, cwd, cwdlen - 1);
+			p[cwdlen - 1] = '/';
+			p += cwdlen;
+		}
+		strcpy(p, paths[i]);
+		p += strlen(paths[i]) + 1;
+	}
+
+	if(write_full(fd, buf, sizeof(req) + len) < 0)
+		err(EXIT_FAILURE, "cannot send request");
+
+	free(buf);
+}
+
+
+/* Read one reply and file its results under the paths of its request */
+static void
+recv_batch(int fd, struct srv_result *results, uint32_t nfiles)
+{
+	struct srv_reply reply;
+	uint32_t first;
+
+	if(read_full(fd, &reply, sizeof(reply)) < 0)
+		errx(EXIT_FAILURE, "server closed the connection");
+
+	first = reply.id * SRV_BATCH;
+	if(first >= nfiles || reply.nresults > nfiles - first
+			|| reply.len != sizeof(reply) - sizeof(reply.len) + reply.nresults * sizeof(struct srv_result))
+		errx(EXIT_FAILURE, "bad reply from server");
+
+	if(read_full(fd, &results[first], reply.nresults * sizeof(struct srv_result)) < 0)
+		errx(EXIT_FAILURE, "server closed the connection");
+}
+
+
+/* Do what paxctl-ng would do to the files, but through the server at
+ * path, and report the same way.  The files are sent SRV_BATCH at a time
+ * with up to SRV_WINDOW requests in flight.
+ */
+int
+serve_client(const char *path, char *files[], int nfiles, uint16_t pax_flags,
+	int cp_flags, int limit, int verbose, int nochange, int json)
+{
+	struct sockaddr_un addr;
+	struct srv_result *results, *res;
+	uint32_t nbatches, sent, received, n;
+	char cwd[PATH_MAX];
+	int fd, fi;
+	int nchanged = 0, nunchanged = 0;
+	int ret = EXIT_SUCCESS;
+
+	socket_addr(path, &addr);
+
+	if(getcwd(cwd, sizeof(cwd)) == NULL)
+		err(EXIT_FAILURE, "getcwd");
+
+	if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		err(EXIT_FAILURE, "socket");
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		err(EXIT_FAILURE, "cannot connect to %s", path);
+
+	if((results = calloc(nfiles, sizeof(struct srv_result))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	nbatches = (nfiles + SRV_BATCH - 1) / SRV_BATCH;
+	for(sent = received = 0; received < nbatches; )
+	{
+		if(sent < nbatches && sent - received < SRV_WINDOW)
+		{
+			n = nfiles - sent * SRV_BATCH < SRV_BATCH ? nfiles - sent * SRV_BATCH : SRV_BATCH;
+			send_batch(fd, sent, &files[sent * SRV_BATCH], n, cwd, pax_flags, cp_flags, limit);
+			sent++;
+		}
+		else
+		{
+			recv_batch(fd, results, nfiles);
+			received++;
+		}
+	}
+
+	close(fd);
+
+	for(fi = 0; fi < nfiles; fi++)
+	{
+		res = &results[fi];
+
+		if(res->status == SRV_EINVAL)
+			errx(EXIT_FAILURE, "operation not supported by the server");
+
+		if(verbose)
+			printf("%s:\n", files[fi]);
+
+		if(res->status == SRV_EOPEN)
+		{
+			if(verbose)
+				printf("\topen() failed: cannot read/change PAX flags\n\n");
+			if(json)
+				print_json(files[fi], 0, UINT16_MAX, UINT16_MAX, -1, "open() failed");
+			continue;
+		}
+
+		if(res->status == SRV_EUPDATE)
+			ret = EXIT_FAILURE;
+
+		if(res->changed)
+			nchanged++;
+		else
+			nunchanged++;
+
+		if(verbose && (pax_flags != 0 || cp_flags != 0))
+			printf("\t%s\n", res->changed ? "changed" : "unchanged");
+
+		if(verbose)
+		{
+			print_flags(res->pt_flags, res->xt_flags);
+			printf("\n");
+		}
+
+		if(json)
+			print_json(files[fi], 1, res->pt_flags, res->xt_flags,
+				(pax_flags != 0 || cp_flags != 0) ? res->changed : -1,
+				res->status == SRV_OK ? NULL : "update failed");
+	}
+
+	free(results);
+
+	if(verbose && (pax_flags != 0 || cp_flags != 0))
+		printf("%d changed, %d unchanged\n", nchanged, nunchanged);
+
+	if(ret == EXIT_SUCCESS && nochange && nchanged == 0)
+		return EXIT_UNCHANGED;
+
+	return ret;
+}
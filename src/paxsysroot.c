@@ -0,0 +1,217 @@
+/*
+	paxsysroot.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Mark the ELFs of an image, eg. one cross-built for another arch, from
+ * the build host rather than from an emulated chroot of it.
+ *
+ * With --sysroot DIR every path is taken as a path inside DIR, and is
+ * resolved as it would be from a chroot into DIR: absolute symlinks and
+ * ".." stop at DIR and never reach the host.  openat2(2) does this with
+ * RESOLVE_IN_ROOT.  Older kernels get the same by walking the path one
+ * component at a time with O_NOFOLLOW and following the symlinks here.
+ *
+ * Nothing else needs to change: the PT_PAX code reads and writes ELFs of
+ * either byte order and class, whatever the host's.
+ */
+
+#define _GNU_SOURCE		/* O_PATH */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "paxctl-ng.h"
+
+#define SYSROOT_LINKS_MAX	40		/* as the kernel's MAXSYMLINKS */
+#define SYSROOT_DEPTH_MAX	(PATH_MAX / 2)
+
+static int sysroot_fd = -1;
+
+#ifdef SYS_openat2
+#define SYSROOT_RESOLVE_NO_MAGICLINKS	0x02
+#define SYSROOT_RESOLVE_IN_ROOT		0x10
+
+struct sysroot_open_how
+{
+	uint64_t flags;
+	uint64_t mode;
+	uint64_t resolve;
+};
+
+// Set once the kernel turns out not to have openat2(), by any thread, so it
+// is only ever read and written with __atomic_*()
+static int no_openat2;
+#endif
+
+
+void
+sysroot_start(const char *dir)
+{
+	if(dir == NULL)
+		return;
+
+	if((sysroot_fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+		err(EXIT_FAILURE, "--sysroot %s", dir);
+}
+
+
+/* Open path below the directory fd dirs[0] as a chroot into it would,
+ * without openat2().  dirs holds an O_PATH fd for every directory walked
+ * into, so ".." goes back up one and never above dirs[0].
+ */
+static int
+walk_in_root(const char *path, int flags)
+{
+	int dirs[SYSROOT_DEPTH_MAX];
+	char buf[PATH_MAX], target[PATH_MAX];
+	char *name, *rest;
+	int depth = 0, links = 0, fd, saved;
+	ssize_t n;
+
+	if(strlen(path) >= sizeof(buf))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(buf, path);
+
+	dirs[0] = sysroot_fd;
+	rest = buf;
+	fd = -1;
+
+	for(;;)
+	{
+		while(*rest == '/')
+			rest++;
+		if(*rest == 0)
+		{
+			// The path names a directory, or the root itself
+			fd = openat(dirs[depth], ".", flags);
+			break;
+		}
+
+		name = rest;
+		rest += strcspn(rest, "/");
+		if(*rest)
+			*rest++ = 0;
+		while(*rest == '/')
+			rest++;
+
+		if(!strcmp(name, "."))
+			continue;
+
+		if(!strcmp(name, ".."))
+		{
+			if(depth > 0)
+				close(dirs[depth--]);
+			continue;
+		}
+
+		if((n = readlinkat(dirs[depth], name, target, sizeof(target))) >= 0)
+		{
+			if(++links > SYSROOT_LINKS_MAX)
+			{
+				errno = ELOOP;
+				break;
+			}
+			if((size_t)n == sizeof(target) || (size_t)n + 1 + strlen(rest) >= sizeof(buf))
+			{
+				errno = ENAMETOOLONG;
+				break;
+			}
+
+			// The target goes in front of what is left of the path
+			memmove(buf + n + 1, rest, strlen(rest) + 1);
+			memcpy(buf, target, n);
+			buf[n] = '/';
+			rest = buf;
+
+			if(target[0] == '/')
+				while(depth > 0)
+					close(dirs[depth--]);
+			continue;
+		}
+		else if(errno != EINVAL)
+			break;
+
+		if(*rest == 0)
+		{
+			fd = openat(dirs[depth], name, flags | O_NOFOLLOW);
+			break;
+		}
+
+		if(depth + 1 >= SYSROOT_DEPTH_MAX)
+		{
+			errno = ENAMETOOLONG;
+			break;
+		}
+
+		if((dirs[depth + 1] = openat(dirs[depth], name, O_PATH | O_DIRECTORY | O_NOFOLLOW)) < 0)
+			break;
+		depth++;
+	}
+
+	saved = errno;
+	while(depth > 0)
+		close(dirs[depth--]);
+	errno = saved;
+
+	return fd;
+}
+
+
+int
+sysroot_open(const char *path, int flags)
+{
+	if(sysroot_fd < 0)
+		return open(path, flags);
+
+#ifdef SYS_openat2
+	if(!__atomic_load_n(&no_openat2, __ATOMIC_RELAXED))
+	{
+		struct sysroot_open_how how;
+		int fd;
+
+		memset(&how, 0, sizeof(how));
+		how.flags = flags;
+		how.resolve = SYSROOT_RESOLVE_IN_ROOT | SYSROOT_RESOLVE_NO_MAGICLINKS;
+
+		if((fd = syscall(SYS_openat2, sysroot_fd, path, &how, sizeof(how))) >= 0 || errno != ENOSYS)
+			return fd;
+
+		// Older kernels, walk the path ourselves
+		__atomic_store_n(&no_openat2, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	return walk_in_root(path, flags);
+}
+
+
+int
+sysroot_active(void)
+{
+	return sysroot_fd >= 0;
+}
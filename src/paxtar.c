@@ -0,0 +1,618 @@
+/*
+	paxtar.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Mark the ELF members of a tar stream as it passes from in to out, so
+ * that an image layer never has to be unpacked.  PT_PAX flags are patched
+ * in the member's data, XATTR_PAX flags go into the member's pax extended
+ * header as SCHILY.xattr.user.pax.flags, which is how GNU tar, bsdtar and
+ * the OCI tooling carry xattrs.
+ *
+ * Which members get which flags is decided by a rules file with lines of
+ * the form
+ *
+ *	FLAGS PATTERN
+ *
+ * where FLAGS is made of PpEeMmRrSs and z, just like for paxmark.sh, and
+ * PATTERN is a shell glob, see fnmatch(3), matched against the member
+ * name with any leading "./" or "/" removed.  The first matching rule
+ * wins.  Blank lines and lines starting with # are ignored.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+#define TAR_BLOCK		512
+#define TAR_HEAD_CHUNK		(64 * 1024)		/* read this much to find the phdrs */
+#define TAR_PHDRS_MAX		(16 * 1024 * 1024)	/* but never buffer more than this */
+
+#define TAR_NAME		0
+#define TAR_MODE		100
+#define TAR_UID			108
+#define TAR_GID			116
+#define TAR_SIZE		124
+#define TAR_MTIME		136
+#define TAR_CHKSUM		148
+#define TAR_TYPEFLAG		156
+#define TAR_MAGIC		257
+#define TAR_VERSION		263
+#define TAR_PREFIX		345
+
+#ifdef XTPAX
+ #define TAR_XATTR_KEY		"SCHILY.xattr." PAX_NAMESPACE
+#endif
+
+#define ALL_PAX_FLAGS	(PF_PAGEEXEC | PF_NOPAGEEXEC | PF_SEGMEXEC | PF_NOSEGMEXEC | \
+			 PF_MPROTECT | PF_NOMPROTECT | PF_EMUTRAMP | PF_NOEMUTRAMP | \
+			 PF_RANDMMAP | PF_NORANDMMAP)
+
+struct tar_rule {
+	char *pattern;
+	uint16_t flags;
+	int zero;			/* z, reset to the default first */
+	struct tar_rule *next;
+};
+
+struct tar_buf {
+	unsigned char *data;
+	size_t len, size;
+};
+
+static const unsigned char tar_zero[TAR_BLOCK];
+
+
+static struct tar_rule *
+read_rules(const char *path)
+{
+	FILE *f;
+	char line[4096], *flags, *pattern, *p;
+	struct tar_rule *rules = NULL, **tail = &rules, *r;
+
+	if((f = fopen(path, "r")) == NULL)
+		err(EXIT_FAILURE, "cannot open rules %s", path);
+
+	while(fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\n")] = 0;
+
+		for(flags = line; isspace((unsigned char)*flags); flags++);
+		if(*flags == 0 || *flags == '#')
+			continue;
+
+		for(p = flags; *p && !isspace((unsigned char)*p); p++);
+		if(*p == 0)
+			errx(EXIT_FAILURE, "rules %s: missing pattern in '%s'", path, line);
+		*p++ = 0;
+
+		for(pattern = p; isspace((unsigned char)*pattern); pattern++);
+		while(*pattern == '/' || (pattern[0] == '.' && pattern[1] == '/'))
+			pattern += *pattern == '/' ? 1 : 2;
+
+		if((r = calloc(1, sizeof(struct tar_rule))) == NULL)
+			err(EXIT_FAILURE, "calloc");
+		if((r->pattern = strdup(pattern)) == NULL)
+			err(EXIT_FAILURE, "strdup");
+		r->flags = parse_sflags(flags);
+		r->zero = strchr(flags, 'z') != NULL;
+
+		*tail = r;
+		tail = &r->next;
+	}
+
+	fclose(f);
+	return rules;
+}
+
+
+static struct tar_rule *
+match_rule(struct tar_rule *rules, const char *name)
+{
+	while(*name == '/' || (name[0] == '.' && name[1] == '/'))
+		name += *name == '/' ? 1 : 2;
+
+	for(; rules; rules = rules->next)
+		if(!fnmatch(rules->pattern, name, 0))
+			return rules;
+
+	return NULL;
+}
+
+
+static uint16_t
+apply_rule(struct tar_rule *r, uint16_t flags)
+{
+	if(r->zero)
+		flags = update_flags(flags, ALL_PAX_FLAGS);
+	return update_flags(flags, r->flags);
+}
+
+
+// Like read(2) but only comes back short at the end of the stream
+static size_t
+read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < len)
+	{
+		n = read(fd, (char *)buf + done, len - done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			err(EXIT_FAILURE, "read");
+		if(n == 0)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
+
+static void
+write_full(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < len)
+	{
+		n = write(fd, (const char *)buf + done, len - done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			err(EXIT_FAILURE, "write");
+		done += n;
+	}
+}
+
+
+static void
+copy_bytes(int in, int out, uint64_t len)
+{
+	unsigned char buf[TAR_HEAD_CHUNK];
+	size_t n;
+
+	while(len)
+	{
+		n = len < sizeof(buf) ? len : sizeof(buf);
+		if(read_full(in, buf, n) != n)
+			errx(EXIT_FAILURE, "tar stream is truncated");
+		write_full(out, buf, n);
+		len -= n;
+	}
+}
+
+
+static uint64_t
+tar_padding(uint64_t size)
+{
+	return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+}
+
+
+static void
+buf_append(struct tar_buf *b, const void *data, size_t len)
+{
+	if(b->len + len > b->size)
+	{
+		size_t size = b->size ? b->size : TAR_BLOCK;
+		while(size < b->len + len)
+			size *= 2;
+		if((b->data = realloc(b->data, size)) == NULL)
+			err(EXIT_FAILURE, "realloc");
+		b->size = size;
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+
+// Read a member's data, without the padding, into b
+static void
+buf_read_data(struct tar_buf *b, int in, uint64_t size)
+{
+	unsigned char pad[TAR_BLOCK];
+
+	b->len = 0;
+	if(size > TAR_PHDRS_MAX)
+		errx(EXIT_FAILURE, "tar extended header is too large");
+	if(b->size < size)
+	{
+		if((b->data = realloc(b->data, size)) == NULL)
+			err(EXIT_FAILURE, "realloc");
+		b->size = size;
+	}
+	if(read_full(in, b->data, size) != size)
+		errx(EXIT_FAILURE, "tar stream is truncated");
+	b->len = size;
+	if(read_full(in, pad, tar_padding(size)) != tar_padding(size))
+		errx(EXIT_FAILURE, "tar stream is truncated");
+}
+
+
+static void
+write_padded(int out, const unsigned char *data, size_t len)
+{
+	write_full(out, data, len);
+	write_full(out, tar_zero, tar_padding(len));
+}
+
+
+// Numeric fields are octal, or base-256 if the high bit of the first byte is set
+static uint64_t
+tar_number(const unsigned char *field, size_t len)
+{
+	uint64_t v = 0;
+	size_t i;
+
+	if(field[0] & 0x80)
+	{
+		v = field[0] & 0x3f;
+		for(i = 1; i < len; i++)
+			v = (v << 8) | field[i];
+		return v;
+	}
+
+	for(i = 0; i < len && field[i] == ' '; i++);
+	for(; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+		v = (v << 3) | (field[i] - '0');
+
+	return v;
+}
+
+
+static int
+tar_is_end(const unsigned char *hdr)
+{
+	int i;
+
+	for(i = 0; i < TAR_BLOCK; i++)
+		if(hdr[i])
+			return 0;
+	return 1;
+}
+
+
+/* Walk the "LEN KEY=VALUE\n" records of a pax extended header.  Returns
+ * the value of key, or NULL, and its length in vlen.
+ */
+static const char *
+pax_record(const struct tar_buf *x, const char *key, size_t *vlen)
+{
+	const char *p = (const char *)x->data, *end = p + x->len;
+	const char *k, *v;
+	size_t rlen, klen = strlen(key);
+	char *q;
+
+	while(p < end)
+	{
+		rlen = strtoul(p, &q, 10);
+		if(q == p || *q != ' ' || rlen == 0 || rlen > (size_t)(end - p))
+			break;
+
+		k = q + 1;
+		v = memchr(k, '=', p + rlen - k);
+		if(v && (size_t)(v - k) == klen && !memcmp(k, key, klen))
+		{
+			*vlen = p + rlen - 1 - (v + 1);
+			return v + 1;
+		}
+
+		p += rlen;
+	}
+
+	return NULL;
+}
+
+
+#ifdef XTPAX
+// Only headers which are made up or changed need it, which is only for XATTR_PAX
+static void
+tar_checksum(unsigned char *hdr)
+{
+	unsigned int sum = 0;
+	int i;
+
+	memset(hdr + TAR_CHKSUM, ' ', 8);
+	for(i = 0; i < TAR_BLOCK; i++)
+		sum += hdr[i];
+	snprintf((char *)hdr + TAR_CHKSUM, 8, "%06o", sum);
+	hdr[TAR_CHKSUM + 7] = ' ';
+}
+
+
+// Copy the records of x into nx, replacing key's with value
+static void
+pax_replace(const struct tar_buf *x, struct tar_buf *nx, const char *key, const char *value)
+{
+	const char *p = (const char *)x->data, *end = p + x->len;
+	size_t rlen, klen = strlen(key), len, digits;
+	char *q, rec[256];
+
+	nx->len = 0;
+
+	while(p < end)
+	{
+		rlen = strtoul(p, &q, 10);
+		if(q == p || *q != ' ' || rlen == 0 || rlen > (size_t)(end - p))
+			break;
+
+		if(!(strncmp(q + 1, key, klen) == 0 && q[1 + klen] == '='))
+			buf_append(nx, p, rlen);
+
+		p += rlen;
+	}
+
+	// The length counts its own digits
+	len = 1 + klen + 1 + strlen(value) + 1;
+	for(digits = 1; snprintf(rec, sizeof(rec), "%zu", len + digits) > (int)digits; digits++);
+	snprintf(rec, sizeof(rec), "%zu %s=%s\n", len + digits, key, value);
+	buf_append(nx, rec, strlen(rec));
+}
+
+
+// Make up a ustar header for a pax extended header of size bytes
+static void
+pax_header(unsigned char *hdr, const unsigned char *member, uint64_t size)
+{
+	memset(hdr, 0, TAR_BLOCK);
+	snprintf((char *)hdr + TAR_NAME, 100, "PaxHeaders/%.80s", (const char *)member + TAR_NAME);
+	memcpy(hdr + TAR_MODE, "0000644", 8);
+	memcpy(hdr + TAR_UID, "0000000", 8);
+	memcpy(hdr + TAR_GID, "0000000", 8);
+	memcpy(hdr + TAR_MTIME, member + TAR_MTIME, 12);
+	hdr[TAR_TYPEFLAG] = 'x';
+	memcpy(hdr + TAR_MAGIC, "ustar", 6);
+	memcpy(hdr + TAR_VERSION, "00", 2);
+	snprintf((char *)hdr + TAR_SIZE, 12, "%011llo", (unsigned long long)size);
+	tar_checksum(hdr);
+}
+#endif
+
+
+static void
+member_name(const unsigned char *hdr, const struct tar_buf *x, const struct tar_buf *longname,
+	char *name, size_t size)
+{
+	const char *v;
+	size_t vlen;
+
+	if((v = pax_record(x, "path", &vlen)) != NULL)
+		snprintf(name, size, "%.*s", (int)vlen, v);
+	else if(longname->len)
+		snprintf(name, size, "%.*s", (int)longname->len, (const char *)longname->data);
+	else if(!memcmp(hdr + TAR_MAGIC, "ustar", 5) && hdr[TAR_PREFIX])
+		snprintf(name, size, "%.155s/%.100s", (const char *)hdr + TAR_PREFIX,
+			(const char *)hdr + TAR_NAME);
+	else
+		snprintf(name, size, "%.100s", (const char *)hdr + TAR_NAME);
+}
+
+
+int
+mark_tar(int in, int out, const char *rules_file, int limit, int verbose)
+{
+	struct tar_rule *rules, *r;
+	unsigned char hdr[TAR_BLOCK], xhdr[TAR_BLOCK];
+	struct tar_buf x = { NULL, 0, 0 }, nx = { NULL, 0, 0 };
+	struct tar_buf gnu = { NULL, 0, 0 }, longname = { NULL, 0, 0 }, data = { NULL, 0, 0 };
+	char name[4096];
+	const char *v;
+	size_t n, vlen, head, end;
+	uint64_t size;
+	int have_x, marked;
+	uint16_t flags;
+	char buf[FLAGS_SIZE];
+
+	rules = read_rules(rules_file);
+	have_x = 0;
+
+	for(;;)
+	{
+		if((n = read_full(in, hdr, TAR_BLOCK)) == 0)
+			break;
+		if(n != TAR_BLOCK)
+			errx(EXIT_FAILURE, "tar stream is truncated");
+
+		// The end of archive, pass it and anything after it through
+		if(tar_is_end(hdr))
+		{
+			write_full(out, hdr, TAR_BLOCK);
+			while((n = read_full(in, hdr, TAR_BLOCK)) > 0)
+				write_full(out, hdr, n);
+			break;
+		}
+
+		size = tar_number(hdr + TAR_SIZE, 12);
+
+		switch(hdr[TAR_TYPEFLAG])
+		{
+			case 'x':	// pax extended header for the next member
+				memcpy(xhdr, hdr, TAR_BLOCK);
+				buf_read_data(&x, in, size);
+				have_x = 1;
+				continue;
+			case 'L':	// GNU long name, and long link, for the next member
+			case 'K':
+				buf_append(&gnu, hdr, TAR_BLOCK);
+				buf_read_data(&data, in, size);
+				if(hdr[TAR_TYPEFLAG] == 'L')
+				{
+					longname.len = 0;
+					buf_append(&longname, data.data, strnlen((char *)data.data, data.len));
+				}
+				buf_append(&gnu, data.data, data.len);
+				buf_append(&gnu, tar_zero, tar_padding(data.len));
+				continue;
+		}
+
+		// x is empty unless this member has an extended header
+		if((v = pax_record(&x, "size", &vlen)) != NULL)
+			size = strtoull(v, NULL, 10);
+
+		member_name(hdr, &x, &longname, name, sizeof(name));
+
+		head = 0;
+		marked = 0;
+		r = NULL;
+
+		if(hdr[TAR_TYPEFLAG] == '0' || hdr[TAR_TYPEFLAG] == 0 || hdr[TAR_TYPEFLAG] == '7')
+			r = match_rule(rules, name);
+
+		if(r)
+		{
+			head = size < TAR_HEAD_CHUNK ? size : TAR_HEAD_CHUNK;
+			if(data.size < head)
+			{
+				if((data.data = realloc(data.data, head)) == NULL)
+					err(EXIT_FAILURE, "realloc");
+				data.size = head;
+			}
+			if(read_full(in, data.data, head) != head)
+				errx(EXIT_FAILURE, "tar stream is truncated");
+			data.len = head;
+
+			end = elf_phdrs_end(data.data, data.len);
+
+			// Rarely the phdrs are not near the start, fetch the rest of them
+			if(end > head && end <= size && end <= TAR_PHDRS_MAX)
+			{
+				if(data.size < end)
+				{
+					if((data.data = realloc(data.data, end)) == NULL)
+						err(EXIT_FAILURE, "realloc");
+					data.size = end;
+				}
+				if(read_full(in, data.data + head, end - head) != end - head)
+					errx(EXIT_FAILURE, "tar stream is truncated");
+				head = data.len = end;
+			}
+
+			if(end)
+				marked = 1;
+		}
+
+		if(verbose && marked)
+			fprintf(stderr, "%s:\n", name);
+
+#ifdef PTPAX
+		if(marked && limit != LIMIT_TO_XT_FLAGS)
+		{
+			flags = get_pt_flags_mem(data.data, data.len);
+			if(flags == UINT16_MAX)
+			{
+				if(verbose)
+					fprintf(stderr, "\tPT_PAX    : not found\n");
+			}
+			else
+			{
+				flags = apply_rule(r, flags);
+				set_pt_flags_mem(data.data, data.len, flags);
+				if(verbose)
+				{
+					memset(buf, 0, FLAGS_SIZE);
+					bin2string4print(flags, buf);
+					fprintf(stderr, "\tPT_PAX    : %s\n", buf);
+				}
+			}
+		}
+#endif
+
+#ifdef XTPAX
+		if(marked && limit != LIMIT_TO_PT_FLAGS)
+		{
+			flags = PF_NOEMUTRAMP;
+			if((v = pax_record(&x, TAR_XATTR_KEY, &vlen)) != NULL)
+			{
+				memset(buf, 0, FLAGS_SIZE);
+				memcpy(buf, v, vlen < FLAGS_SIZE - 1 ? vlen : FLAGS_SIZE - 1);
+				flags = string2bin(buf);
+			}
+			flags = apply_rule(r, flags);
+
+			memset(buf, 0, FLAGS_SIZE);
+			bin2string(flags, buf);
+			pax_replace(&x, &nx, TAR_XATTR_KEY, buf);
+
+			if(!have_x)
+				pax_header(xhdr, hdr, nx.len);
+			else
+			{
+				snprintf((char *)xhdr + TAR_SIZE, 12, "%011llo", (unsigned long long)nx.len);
+				tar_checksum(xhdr);
+			}
+
+			write_full(out, gnu.data, gnu.len);
+			write_full(out, xhdr, TAR_BLOCK);
+			write_padded(out, nx.data, nx.len);
+			gnu.len = 0;
+			have_x = 0;
+
+			if(verbose)
+			{
+				memset(buf, 0, FLAGS_SIZE);
+				bin2string4print(flags, buf);
+				fprintf(stderr, "\tXATTR_PAX : %s\n", buf);
+			}
+		}
+#endif
+
+		// Whatever was not rewritten goes out as it came in
+		write_full(out, gnu.data, gnu.len);
+		if(have_x)
+		{
+			write_full(out, xhdr, TAR_BLOCK);
+			write_padded(out, x.data, x.len);
+		}
+		write_full(out, hdr, TAR_BLOCK);
+		write_full(out, data.data, head);
+		copy_bytes(in, out, size - head + tar_padding(size));
+
+		gnu.len = 0;
+		longname.len = 0;
+		x.len = 0;
+		have_x = 0;
+		data.len = 0;
+	}
+
+	free(x.data);
+	free(nx.data);
+	free(gnu.data);
+	free(longname.data);
+	free(data.data);
+	while(rules)
+	{
+		r = rules->next;
+		free(rules->pattern);
+		free(rules);
+		rules = r;
+	}
+
+	return EXIT_SUCCESS;
+}
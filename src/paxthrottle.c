@@ -0,0 +1,308 @@
+/*
+	paxthrottle.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Keep a sweep over many files from getting in the way of everything else
+ * on the same disks.  There are three independent knobs:
+ *
+ *	--ioprio CLASS[:LEVEL]	the I/O scheduling class and level, as for
+ *				ionice(1), set once for the whole process
+ *	--files-per-sec N	token buckets, one file or one byte per token,
+ *	--bytes-per-sec N[KMG]	holding at most one second's worth
+ *	--psi-io PERCENT	wait while the "some" avg10 of /proc/pressure/io
+ *				is above PERCENT, backing off exponentially
+ *
+ * throttle() is called once per file after it has been dealt with, so a
+ * file is paid for when its cost, the file's size for the byte bucket, is
+ * known.  A bucket can go into debt, which the next call waits out before
+ * the sweep goes on, so the last file of a sweep does not keep it waiting
+ * for nothing.  Several threads can share the buckets.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "paxctl-ng.h"
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_WHO_PROCESS	1
+
+#define THROTTLE_PSI		"/proc/pressure/io"
+#define THROTTLE_PSI_INTERVAL	1.0		/* read the pressure at most this often, in s */
+#define THROTTLE_BACKOFF_MIN	0.1		/* in s */
+#define THROTTLE_BACKOFF_MAX	5.0
+
+struct bucket
+{
+	double rate;				/* tokens per second, 0 for no limit */
+	double tokens;
+};
+
+static struct
+{
+	int on;
+	struct bucket files, bytes;
+	double last;				/* when the buckets were last filled */
+	double paid;				/* when the debt will have been paid */
+	double psi;				/* the pressure to back off at, 0 not to */
+	double psi_read;			/* when the pressure was last read */
+	double psi_avg10;
+	pthread_mutex_t lock;
+} throttle_state = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+sleep_for(double s)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)s;
+	ts.tv_nsec = (long)((s - ts.tv_sec) * 1e9);
+	while(nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+
+// CLASS[:LEVEL] where CLASS is rt, be, idle or 1 to 3 and LEVEL 0 to 7
+static int
+parse_ioprio(const char *arg)
+{
+	char *end;
+	long class, level = 4;
+	size_t n = strcspn(arg, ":");
+
+	if(n == 2 && !strncmp(arg, "rt", 2))
+		class = 1;
+	else if(n == 2 && !strncmp(arg, "be", 2))
+		class = 2;
+	else if(n == 4 && !strncmp(arg, "idle", 4))
+		class = 3;
+	else
+	{
+		class = strtol(arg, &end, 10);
+		if(end != arg + n || class < 1 || class > 3)
+			errx(EXIT_FAILURE, "--ioprio %s: the class must be rt, be or idle", arg);
+	}
+
+	if(arg[n] == ':')
+	{
+		level = strtol(arg + n + 1, &end, 10);
+		if(*end || end == arg + n + 1 || level < 0 || level > 7)
+			errx(EXIT_FAILURE, "--ioprio %s: the level must be 0 to 7", arg);
+	}
+
+	// The idle class has no levels
+	if(class == 3)
+		level = 0;
+
+	return (int)(class << IOPRIO_CLASS_SHIFT | level);
+}
+
+
+// A positive number, with an optional K, M or G suffix if allowed
+static double
+parse_rate(const char *opt, const char *arg, int suffix)
+{
+	char *end;
+	double r;
+
+	errno = 0;
+	r = strtod(arg, &end);
+	if(suffix && *end && end[1] == 0)
+	{
+		switch(*end)
+		{
+			case 'K':
+				r *= 1024.0;
+				end++;
+				break;
+			case 'M':
+				r *= 1024.0 * 1024;
+				end++;
+				break;
+			case 'G':
+				r *= 1024.0 * 1024 * 1024;
+				end++;
+				break;
+		}
+	}
+
+	if(errno || *end || end == arg || !(r > 0))
+		errx(EXIT_FAILURE, "%s %s: expected a positive number", opt, arg);
+
+	return r;
+}
+
+
+// The "some avg10" of /proc/pressure/io, -1 if there is no PSI
+static double
+read_psi(void)
+{
+	FILE *f;
+	char line[256];
+	double avg10 = -1;
+
+	if((f = fopen(THROTTLE_PSI, "r")) == NULL)
+		return -1;
+
+	while(fgets(line, sizeof(line), f))
+		if(sscanf(line, "some avg10=%lf", &avg10) == 1)
+			break;
+
+	fclose(f);
+	return avg10;
+}
+
+
+void
+throttle_start(const struct throttle_opts *t)
+{
+	int prio;
+
+	if(t->ioprio)
+	{
+		prio = parse_ioprio(t->ioprio);
+#ifdef SYS_ioprio_set
+		if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio) < 0)
+			err(EXIT_FAILURE, "--ioprio %s", t->ioprio);
+#else
+		errx(EXIT_FAILURE, "--ioprio is not supported on this system");
+#endif
+	}
+
+	if(t->files)
+		throttle_state.files.rate = parse_rate("--files-per-sec", t->files, 0);
+	if(t->bytes)
+		throttle_state.bytes.rate = parse_rate("--bytes-per-sec", t->bytes, 1);
+	if(t->psi)
+	{
+		throttle_state.psi = parse_rate("--psi-io", t->psi, 0);
+		if(read_psi() < 0)
+		{
+			warnx("--psi-io: cannot read " THROTTLE_PSI ", not backing off");
+			throttle_state.psi = 0;
+		}
+	}
+
+	// Start with full buckets
+	throttle_state.files.tokens = throttle_state.files.rate;
+	throttle_state.bytes.tokens = throttle_state.bytes.rate;
+	throttle_state.last = throttle_state.paid = now();
+	throttle_state.psi_read = 0;
+
+	throttle_state.on = throttle_state.files.rate > 0 || throttle_state.bytes.rate > 0
+		|| throttle_state.psi > 0;
+}
+
+
+// Take cost out of b and return how long it takes to pay off any debt
+static double
+take(struct bucket *b, double elapsed, double cost)
+{
+	if(b->rate == 0)
+		return 0;
+
+	b->tokens += elapsed * b->rate;
+	if(b->tokens > b->rate)
+		b->tokens = b->rate;
+	b->tokens -= cost;
+
+	return b->tokens < 0 ? -b->tokens / b->rate : 0;
+}
+
+
+void
+throttle(size_t bytes)
+{
+	double t, elapsed, wait, w, avg10, backoff = THROTTLE_BACKOFF_MIN;
+
+	if(!throttle_state.on)
+		return;
+
+	// Wait out what the earlier files left owing
+	pthread_mutex_lock(&throttle_state.lock);
+	wait = throttle_state.paid - now();
+	pthread_mutex_unlock(&throttle_state.lock);
+
+	if(wait > 0)
+		sleep_for(wait);
+
+	pthread_mutex_lock(&throttle_state.lock);
+	t = now();
+	elapsed = t - throttle_state.last;
+	throttle_state.last = t;
+	wait = take(&throttle_state.files, elapsed, 1);
+	w = take(&throttle_state.bytes, elapsed, bytes);
+	if(w > wait)
+		wait = w;
+	throttle_state.paid = t + wait;
+	pthread_mutex_unlock(&throttle_state.lock);
+
+	if(throttle_state.psi == 0)
+		return;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&throttle_state.lock);
+		t = now();
+		if(t - throttle_state.psi_read >= THROTTLE_PSI_INTERVAL)
+		{
+			throttle_state.psi_avg10 = read_psi();
+			throttle_state.psi_read = t;
+		}
+		avg10 = throttle_state.psi_avg10;
+		pthread_mutex_unlock(&throttle_state.lock);
+
+		if(avg10 <= throttle_state.psi)
+			break;
+
+		sleep_for(backoff);
+		backoff *= 2;
+		if(backoff > THROTTLE_BACKOFF_MAX)
+			backoff = THROTTLE_BACKOFF_MAX;
+	}
+}
+
+
+void
+throttle_fd(int fd)
+{
+	struct stat st;
+
+	if(!throttle_state.on)
+		return;
+
+	throttle(fstat(fd, &st) == 0 ? (size_t)st.st_size : 0);
+}
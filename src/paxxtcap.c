@@ -0,0 +1,124 @@
+/*
+	paxxtcap.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Remember on which filesystems XATTR_PAX cannot be written.
+ *
+ * Some filesystems do not take user.* xattrs at all, eg. tmpfs before
+ * 6.6, squashfs or many FUSE mounts, and some only let them be read.
+ * Where they cannot be read at all, the fgetxattr() every marking and
+ * every read makes anyway fails with ENOTSUP and says so for that file,
+ * which costs no more than looking it up would.  Nothing is kept for that.
+ *
+ * What a read cannot tell is whether a write will work.  So once a write
+ * of XATTR_PAX has failed with ENOTSUP, its st_dev is remembered and the
+ * callers leave XATTR_PAX out there rather than fail on every file.  Until
+ * that has happened on some filesystem there is nothing to look up and no
+ * fstat() is made for st_dev.  After, the caller's struct stat does if it
+ * has one.
+ *
+ * Whether the filesystem is mounted read-only is not kept.  That belongs
+ * to the mount, not to st_dev: a read-only bind mount shares st_dev with
+ * the mount it is of, and a remount changes it while a --serve runs on.
+ * On such a mount a write fails with EROFS as it would for one file.
+ *
+ * Only XTPAX builds look at this.  Several threads can share it.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "paxctl-ng.h"
+
+#ifdef XTPAX
+
+#define XTCAP_DEVS_MAX		64		/* filesystems after these are not remembered */
+
+static struct
+{
+	dev_t devs[XTCAP_DEVS_MAX];
+	size_t ndevs;			/* written under lock, read without it too */
+	pthread_mutex_t lock;
+} xtcap_state = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+// Whether dev is one XATTR_PAX cannot be written on
+static int
+find_dev(dev_t dev)
+{
+	size_t i;
+
+	for(i = 0; i < xtcap_state.ndevs; i++)
+		if(xtcap_state.devs[i] == dev)
+			return 1;
+
+	return 0;
+}
+
+
+int
+xtcap(int fd, const struct stat *st)
+{
+	struct stat sb;
+	int found;
+
+	if(__atomic_load_n(&xtcap_state.ndevs, __ATOMIC_RELAXED) == 0)
+		return XTCAP_SET;
+
+	if(st == NULL)
+	{
+		// Then we cannot tell, so try as we always did
+		if(fstat(fd, &sb) < 0)
+			return XTCAP_SET;
+		st = &sb;
+	}
+
+	pthread_mutex_lock(&xtcap_state.lock);
+	found = find_dev(st->st_dev);
+	pthread_mutex_unlock(&xtcap_state.lock);
+
+	return found ? 0 : XTCAP_SET;
+}
+
+
+// A write of XATTR_PAX to fd failed with err
+void
+xtcap_failed(int fd, int err)
+{
+	struct stat st;
+
+	// Only what holds for the whole filesystem, not eg. EPERM on one file
+	// or EROFS on one mount of it
+	if(err != ENOTSUP || fstat(fd, &st) < 0)
+		return;
+
+	pthread_mutex_lock(&xtcap_state.lock);
+	if(!find_dev(st.st_dev) && xtcap_state.ndevs < XTCAP_DEVS_MAX)
+	{
+		xtcap_state.devs[xtcap_state.ndevs] = st.st_dev;
+		__atomic_store_n(&xtcap_state.ndevs, xtcap_state.ndevs + 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&xtcap_state.lock);
+}
+
+#endif
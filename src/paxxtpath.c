@@ -0,0 +1,261 @@
+/*
+	paxxtpath.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Mark XATTR_PAX by path, without opening the file.
+ *
+ * XATTR_PAX lives in the inode, so a file only has to be opened when its
+ * PT_PAX is read or written.  Otherwise an open(), tried O_RDWR and then
+ * O_RDONLY, and a close() are spent on every file just to have an fd for
+ * fgetxattr() or fsetxattr(), and on NFS or FUSE each is a round trip.
+ * Here the xattr calls take the path instead: getxattrat(), setxattrat()
+ * and removexattrat() where the kernel has them, 6.13 on, else getxattr(),
+ * setxattr() and removexattr().  Like open() they follow symlinks.
+ *
+ * What is done this way is what a single xattr call does atomically:
+ *
+ *	-d	removexattr()
+ *	-C, -c	setxattr() with XATTR_CREATE
+ *	-l	getxattr(), and where there is no XATTR_PAX yet, setxattr()
+ *		with XATTR_CREATE.  If the flags are already there nothing
+ *		else is done.
+ *
+ * A merge into an XATTR_PAX which is there and differs still opens and
+ * locks the file, as mark_file() does, so no update is lost.  So does any
+ * error other than the ones which say what XATTR_PAX can do, and the file
+ * is then tried the usual way, which reports it.  With --sysroot a path
+ * must be resolved inside the image, which only sysroot_open() does, so
+ * there every file is opened as before.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "paxctl-ng.h"
+
+#ifdef XTPAX
+
+// Older headers lack them, the numbers are the same on every arch but alpha
+#if !defined(SYS_getxattrat) && !defined(__alpha__)
+#define SYS_setxattrat		463
+#define SYS_getxattrat		464
+#define SYS_removexattrat	466
+#endif
+
+#ifdef SYS_getxattrat
+struct xtpath_xattr_args
+{
+	uint64_t value;
+	uint32_t size;
+	uint32_t flags;
+};
+
+// Set once the kernel turns out not to have them, by any thread, so it
+// is only ever read and written with __atomic_*()
+static int no_xattrat;
+#endif
+
+
+static ssize_t
+xtpath_get(const char *path, char *buf, size_t size)
+{
+#ifdef SYS_getxattrat
+	struct xtpath_xattr_args args;
+	ssize_t n;
+
+	if(!__atomic_load_n(&no_xattrat, __ATOMIC_RELAXED))
+	{
+		args.value = (uintptr_t)buf;
+		args.size = size;
+		args.flags = 0;
+
+		if((n = syscall(SYS_getxattrat, AT_FDCWD, path, 0, PAX_NAMESPACE, &args, sizeof(args))) >= 0
+				|| errno != ENOSYS)
+			return n;
+
+		// Older kernels
+		__atomic_store_n(&no_xattrat, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	return getxattr(path, PAX_NAMESPACE, buf, size);
+}
+
+
+static int
+xtpath_set(const char *path, const char *buf, size_t size, int flags)
+{
+#ifdef SYS_getxattrat
+	struct xtpath_xattr_args args;
+	int ret;
+
+	if(!__atomic_load_n(&no_xattrat, __ATOMIC_RELAXED))
+	{
+		args.value = (uintptr_t)buf;
+		args.size = size;
+		args.flags = flags;
+
+		if((ret = syscall(SYS_setxattrat, AT_FDCWD, path, 0, PAX_NAMESPACE, &args, sizeof(args))) == 0
+				|| errno != ENOSYS)
+			return ret;
+
+		__atomic_store_n(&no_xattrat, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	return setxattr(path, PAX_NAMESPACE, buf, size, flags);
+}
+
+
+static int
+xtpath_remove(const char *path)
+{
+#ifdef SYS_getxattrat
+	int ret;
+
+	if(!__atomic_load_n(&no_xattrat, __ATOMIC_RELAXED))
+	{
+		if((ret = syscall(SYS_removexattrat, AT_FDCWD, path, 0, PAX_NAMESPACE)) == 0 || errno != ENOSYS)
+			return ret;
+
+		__atomic_store_n(&no_xattrat, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	return removexattr(path, PAX_NAMESPACE);
+}
+
+
+// Whether err says what XATTR_PAX can do to the file, rather than that it cannot be reached
+static int
+xtpath_known(int err)
+{
+	return err == ENOTSUP || err == EROFS || err == EPERM;
+}
+
+
+// Create XATTR_PAX with xt_flags, 1 if done, 0 if it is there already, else -1
+static int
+xtpath_create(const char *path, uint16_t xt_flags)
+{
+	char buf[FLAGS_SIZE];
+
+	memset(buf, 0, FLAGS_SIZE);
+	bin2string(xt_flags, buf);
+
+	if(xtpath_set(path, buf, strlen(buf), XATTR_CREATE) == 0)
+		return 1;
+
+	return errno == EEXIST ? 0 : -1;
+}
+
+
+/* Apply cp_flags or pax_flags to the XATTR_PAX of path if that takes no
+ * PT_PAX and no open file, see above.  Return 0 if it was done, with *fret
+ * and *changed as mark_file() sets them, else -1 and the file has to go
+ * through mark_file().
+ */
+int
+mark_xt_path(const char *path, uint16_t pax_flags, int cp_flags, int limit, int *changed, int *fret)
+{
+	char buf[FLAGS_SIZE];
+	uint16_t flags, nflags;
+	ssize_t n;
+	int ret;
+
+	*changed = 0;
+	*fret = EXIT_SUCCESS;
+
+	if(sysroot_active())
+		return -1;
+
+	if(cp_flags == DELETE_XT_FLAGS)
+	{
+		if(xtpath_remove(path) == 0)
+			*changed = 1;
+		// Without user.* xattrs there is no XATTR_PAX to delete
+		else if(errno != ENOATTR && errno != ENOTSUP)
+		{
+			if(!xtpath_known(errno))
+				return -1;
+			*fret = EXIT_FAILURE;
+		}
+		return 0;
+	}
+
+	if(cp_flags == CREATE_XT_FLAGS_SECURE || cp_flags == CREATE_XT_FLAGS_DEFAULT)
+	{
+		flags = cp_flags == CREATE_XT_FLAGS_SECURE ?
+			PF_PAGEEXEC | PF_SEGMEXEC | PF_MPROTECT | PF_NOEMUTRAMP | PF_RANDMMAP : 0;
+
+		if((ret = xtpath_create(path, flags)) < 0 && !xtpath_known(errno))
+			return -1;
+		if(ret == 1)
+			*changed = 1;
+		else
+			*fret = EXIT_FAILURE;
+		return 0;
+	}
+
+#ifdef PTPAX
+	if(limit != LIMIT_TO_XT_FLAGS)
+		return -1;
+#endif
+
+	if(cp_flags != 0 || pax_flags == 0)
+		return -1;
+
+	memset(buf, 0, FLAGS_SIZE);
+	if((n = xtpath_get(path, buf, FLAGS_SIZE - 1)) >= 0)
+	{
+		flags = string2bin(buf);
+		nflags = update_flags(flags, pax_flags);
+		// A change has to be merged under the lock
+		return same_xt_flags(nflags, flags) ? 0 : -1;
+	}
+
+	if(errno == ENOTSUP)
+	{
+		*fret = EXIT_FAILURE;
+		return 0;
+	}
+	if(errno != ENOATTR)
+		return -1;
+
+	// As set_flags() does for a file with no XATTR_PAX yet
+	if((ret = xtpath_create(path, update_flags(PF_NOEMUTRAMP, pax_flags))) == 1)
+	{
+		*changed = 1;
+		return 0;
+	}
+	if(ret < 0 && xtpath_known(errno))
+	{
+		*fret = EXIT_FAILURE;
+		return 0;
+	}
+
+	// It was created meanwhile, or the error is for mark_file() to report
+	return -1;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#!/bin/bash
+#
+#    audittest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Run paxctl-ng --audit against a fake proc filesystem, so neither a PaX
+# kernel nor root is needed.  Each fake process has a status file with a
+# PaX: line and an exe symlink, like the real thing.
+
+verbose=${1-0}
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/audittest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+PROCFS="${TMPDIR}"/proc
+ELF="${TMPDIR}"/elf
+DEFAULTELF="${TMPDIR}"/defaultelf
+
+# Any ELF will do, so use paxctl-ng itself
+cp "${PAXCTLNG}" "${ELF}"
+cp "${PAXCTLNG}" "${DEFAULTELF}"
+
+# -c fails if there is no XATTR_PAX support, which is fine
+${PAXCTLNG} -c "${ELF}" >/dev/null 2>&1
+${PAXCTLNG} -m "${ELF}" >/dev/null 2>&1
+${PAXCTLNG} -z "${DEFAULTELF}" >/dev/null 2>&1
+
+# fakeproc PID NAME PAXLINE EXE
+fakeproc() {
+  mkdir -p "${PROCFS}"/$1
+  printf "Name:\t%s\nState:\tS (sleeping)\n" $2 > "${PROCFS}"/$1/status
+  [[ -n "$3" ]] && printf "PaX:\t%s\n" $3 >> "${PROCFS}"/$1/status
+  [[ -n "$4" ]] && ln -s "$4" "${PROCFS}"/$1/exe
+}
+
+fakeproc 100 stale   PeMRs "${ELF}"		# started before -m
+fakeproc 101 current PemRs "${ELF}"
+fakeproc 102 kthread PeMRs ""			# no exe, skipped
+fakeproc 103 nopax   ""    "${ELF}"		# no PaX: line, skipped
+fakeproc 104 default pemrs "${DEFAULTELF}"	# nothing to compare
+mkdir -p "${PROCFS}"/self "${PROCFS}"/sys	# not pids
+
+echo "================================================================================"
+echo
+echo " RUNNING AUDIT TEST"
+echo
+
+out=$(${PAXCTLNG} --audit --procfs "${PROCFS}")
+ret=$?
+
+if [[ "${verbose}" != 0 ]]; then
+  ${PAXCTLNG} --audit --procfs "${PROCFS}" -v
+  echo
+fi
+
+if [[ "${ret}" != 2 ]]; then
+  echo " Expected exit status 2 for a stale process, got ${ret}"
+  (( count = count + 1 ))
+fi
+
+if ! echo "${out}" | grep -q "^100	stale	"; then
+  echo " Process 100 is stale but was not reported"
+  (( count = count + 1 ))
+fi
+
+for pid in 101 102 103 104; do
+  if echo "${out}" | grep -q "^${pid}	"; then
+    echo " Process ${pid} is not stale but was reported"
+    (( count = count + 1 ))
+  fi
+done
+
+# Once the stale process is gone nothing should be reported
+rm -rf "${PROCFS}"/100
+out=$(${PAXCTLNG} --audit --procfs "${PROCFS}")
+ret=$?
+if [[ "${ret}" != 0 || -n "${out}" ]]; then
+  echo " Expected nothing to be reported, got ${ret}: ${out}"
+  (( count = count + 1 ))
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
@@ -0,0 +1,133 @@
+#!/bin/bash
+#
+#    censustest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Run --census over a tree of ELFs of either class and byte order, with and
+# without PT_PAX_FLAGS, ET_REL objects which have no phdrs at all, and some
+# files which are not ELFs, and check each is classified as it should be,
+# per file with -v and --json, and in the totals, with and without --nocache.
+# One ELF has its phdrs a long way past the ELF header, which only they are
+# read of, and its PT_PAX flags must come back the same through --nocache.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+MKELF="${PWD}"/../mkelf.py
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/censustest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+mismatch() {
+  (( count = count + 1 ))
+  [[ "${verbose}" != 0 ]] && echo " $*"
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING CENSUS TEST"
+echo
+
+ROOT="${TMPDIR}"/root
+mkdir -p "${ROOT}"/sub
+
+# A file, how mkelf.py makes it, and its type and phdrs in the census
+FILES=(
+  exec64    "-f pemrs"     "exec pt_pax"
+  exec32b   "-3 -b -n"     "exec no_room"
+  rel64     "-r"           "other no_room"
+  rel32b    "-3 -b -r"     "other no_room"
+  sub/rel32 "-3 -r"        "other no_room"
+  far       ""             "exec pt_pax"
+)
+
+for (( i = 0; i < ${#FILES[@]}; i += 3 )); do
+  [[ ${FILES[i]} = far ]] && continue
+  python "${MKELF}" ${FILES[i+1]} "${ROOT}"/${FILES[i]}
+done
+
+# The phdrs of far are moved to its end, 4MB on
+python - "${MKELF%/*}" "${ROOT}"/far <<'EOF'
+import struct
+import sys
+sys.path.insert(0, sys.argv[1])
+import mkelf
+image = bytearray(mkelf.elf('PeMRs', size=4 << 20))
+phdrs = image[64:64 + 2 * 56]
+image[64:64 + 2 * 56] = bytearray(2 * 56)
+struct.pack_into('<Q', image, 32, len(image))
+image += phdrs
+open(sys.argv[2], 'wb').write(image)
+EOF
+echo "not an ELF" > "${ROOT}"/text
+: > "${ROOT}"/sub/empty
+
+# And what gcc -c leaves, if it is around
+if echo "int main(void) { return 0; }" > "${TMPDIR}"/obj.c \
+    && ${CC:-gcc} -c -o "${ROOT}"/sub/obj.o "${TMPDIR}"/obj.c >/dev/null 2>&1; then
+  FILES+=( sub/obj.o "" "other no_room" )
+fi
+
+(( elfs = ${#FILES[@]} / 3 ))
+(( files = elfs + 2 ))
+(( rels = elfs - 3 ))
+
+for nocache in "" "--nocache"; do
+  out=$(${PAXCTLNG} --census ${nocache} -v "${ROOT}")
+  for (( i = 0; i < ${#FILES[@]}; i += 3 )); do
+    got=$(echo "${out}" | awk -F '\t' -v p="${ROOT}/${FILES[i]}" '$4 == p { print $1, $2 }')
+    [[ "${got}" != "${FILES[i+2]}" ]] && mismatch "${nocache} -v: ${FILES[i]} is '${got}', expected '${FILES[i+2]}'"
+  done
+
+  got=$(echo "${out}" | grep "ELF objects, ")
+  want="${files} files, ${elfs} ELF objects, 0 unreadable"
+  [[ "${got}" != "${want}" ]] && mismatch "${nocache} -v: '${got}', expected '${want}'"
+
+  got=$(echo "${out}" | grep "^type :")
+  want="type : 3 exec 0 pie 0 dyn ${rels} other"
+  [[ "${got}" != "${want}" ]] && mismatch "${nocache} -v: '${got}', expected '${want}'"
+
+  got=$(echo "${out}" | grep "^phdrs:")
+  want="phdrs: 2 pt_pax 0 gnu_stack 0 free_slot $(( elfs - 2 )) no_room"
+  [[ "${got}" != "${want}" ]] && mismatch "${nocache} -v: '${got}', expected '${want}'"
+
+  got=$(${PAXCTLNG} --census ${nocache} --json "${ROOT}" | grep -o '"type":{[^}]*}')
+  want="\"type\":{\"exec\":3,\"pie\":0,\"dyn\":0,\"other\":${rels}}"
+  [[ "${got}" != "${want}" ]] && mismatch "${nocache} --json: '${got}', expected '${want}'"
+
+  if [[ -n "${PTPAX}" ]]; then
+    got=$(${PAXCTLNG} ${nocache} -v "${ROOT}"/far | sed -n 's/.*PT_PAX    : //p')
+    [[ "${got}" != PeMRs ]] && mismatch "${nocache} -v: far has PT_PAX '${got}', expected PeMRs"
+  fi
+done
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
@@ -0,0 +1,154 @@
+#!/bin/bash
+#
+#    dpkgtest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Run dpkg-paxmark against a fake dpkg database, so neither dpkg nor root
+# is needed.  Each fake package has a .list in ${ADMINDIR}/info naming its
+# files, like the real thing.
+
+verbose=${1-0}
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+DPKGPAXMARK="${PWD}"/../../scripts/dpkg-paxmark
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/dpkgtest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+ADMINDIR="${TMPDIR}"/dpkg
+RULES="${TMPDIR}"/rules
+STAMP="${TMPDIR}"/stamp
+ROOT="${TMPDIR}"/root
+
+mkdir -p "${ADMINDIR}"/info "${ROOT}"/bin "${ROOT}"/lib
+
+# Any ELF will do, so use paxctl-ng itself
+for f in bin/foo bin/bar bin/baz lib/libfoo.so.1; do
+  cp "${PAXCTLNG}" "${ROOT}"/${f}
+done
+printf '#!/bin/sh\n' > "${ROOT}"/bin/foo.sh
+ln -s foo "${ROOT}"/bin/foolink
+
+# foo ships an ELF, a script, a symlink and a library, bar is multiarch
+# and no rule matches baz
+cat << LIST > "${ADMINDIR}"/info/foo.list
+/.
+${ROOT}/bin
+${ROOT}/bin/foo
+${ROOT}/bin/foo.sh
+${ROOT}/bin/foolink
+${ROOT}/lib/libfoo.so.1
+LIST
+echo "${ROOT}/bin/bar" > "${ADMINDIR}"/info/bar:amd64.list
+echo "${ROOT}/bin/baz" > "${ADMINDIR}"/info/baz.list
+
+cat << RULES > "${RULES}"
+# The first match wins
+pEmrS */bin/foo
+PeMRs */bin/foo*
+PeMRs */lib/*.so*
+pemRS */bin/bar
+RULES
+
+DPKGPAXMARK="${DPKGPAXMARK} -a ${ADMINDIR} -r ${RULES} -s ${STAMP} -p ${PAXCTLNG}"
+
+# flags ELF, either marking will do
+flags() {
+  ${PAXCTLNG} -v "$1" | grep -v "not found" | sed -n 's/.*: //p' | head -n 1
+}
+
+expect() {
+  local got=$(flags "$1")
+  if [[ "${got}" != "$2" ]]; then
+    echo " $1: expected '$2', got '${got}'"
+    (( count = count + 1 ))
+  fi
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING DPKG TEST"
+echo
+
+baz=$(flags "${ROOT}"/bin/baz)
+
+# No stamp, so every package is marked
+if [[ "${verbose}" != 0 ]]; then
+  ${DPKGPAXMARK} -v
+else
+  ${DPKGPAXMARK} >/dev/null
+fi
+ret=$?
+
+if [[ "${ret}" != 0 ]]; then
+  echo " Expected exit status 0, got ${ret}"
+  (( count = count + 1 ))
+fi
+
+expect "${ROOT}"/bin/foo pEmrS
+expect "${ROOT}"/lib/libfoo.so.1 PeMRs
+expect "${ROOT}"/bin/bar pemRS
+expect "${ROOT}"/bin/baz "${baz}"
+
+if ! grep -q '^#!/bin/sh$' "${ROOT}"/bin/foo.sh; then
+  echo " The script was touched"
+  (( count = count + 1 ))
+fi
+
+if [[ ! -e "${STAMP}" ]]; then
+  echo " No stamp was left"
+  (( count = count + 1 ))
+fi
+
+# Nothing was unpacked since, so there is nothing to do
+out=$(${DPKGPAXMARK} -n)
+if [[ -n "${out}" ]]; then
+  echo " Expected nothing to do, got: ${out}"
+  (( count = count + 1 ))
+fi
+
+# Only bar was upgraded
+touch -d '+1 minute' "${ADMINDIR}"/info/bar:amd64.list
+out=$(${DPKGPAXMARK} -n)
+if ! echo "${out}" | grep -q "bin/bar$" || echo "${out}" | grep -q "bin/foo"; then
+  echo " Expected only bar to be marked, got: ${out}"
+  (( count = count + 1 ))
+fi
+
+# Packages can be given by name, with or without their architecture
+for pkg in bar bar:amd64; do
+  out=$(${DPKGPAXMARK} -n ${pkg})
+  if ! echo "${out}" | grep -q "bin/bar$"; then
+    echo " Expected ${pkg} to be marked, got: ${out}"
+    (( count = count + 1 ))
+  fi
+done
+
+${DPKGPAXMARK} -n nosuchpackage >/dev/null
+ret=$?
+if [[ "${ret}" != 1 ]]; then
+  echo " Expected exit status 1 for a missing package, got ${ret}"
+  (( count = count + 1 ))
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
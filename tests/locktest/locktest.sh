@@ -0,0 +1,124 @@
+#!/bin/bash
+#
+#    locktest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Mark the same ELFs from five paxctl-ng processes at once, each turning
+# on a different flag, and check that no update was lost: every marking
+# found has to end up PEMRS.  Without the lock taken by mark_file() the
+# read, merge and write of one process overwrites another's now and then,
+# so a few hundred races are run, set ROUNDS to run more or fewer.  Then
+# races between a locked writer and one going by path, as paxctl-ng does
+# without -v, are set up on purpose.
+
+verbose=${1-0}
+shift
+rounds=${ROUNDS-40}
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+MKELF="${PWD}"/../mkelf.py
+PRELOAD="${PWD}"/../.libs/libpreload.so
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+
+NFILES=8
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/locktest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+for (( i = 0; i < NFILES; i++ )); do
+  FILES="${FILES} ${TMPDIR}/f$i"
+done
+
+echo "================================================================================"
+echo
+echo " RUNNING LOCK TEST"
+echo
+
+for (( r = 0; r < rounds; r++ )); do
+  rm -f ${FILES}
+  python "${MKELF}" ${FILES}
+
+  for flag in P E M R S; do
+    ${PAXCTLNG} -${flag} ${FILES} >/dev/null 2>&1 &
+  done
+  wait
+
+  for got in $(${PAXCTLNG} -v ${FILES} | grep "PAX" | grep -v "not found" | sed -n 's/.*: //p'); do
+    if [[ "${got}" != "PEMRS" ]]; then
+      (( count = count + 1 ))
+      [[ "${verbose}" != 0 ]] && echo " round ${r}: a marking is ${got}"
+    fi
+  done
+done
+
+# XATTR_PAX is also created and removed by path, without the lock, which
+# a locked merge must not undo.  Hold a locked writer between its read and
+# its write with the LD_PRELOAD helper, go by path meanwhile, and check
+# the file ends up as if the two had run one after the other.
+if [[ -n "${XTPAX}" ]]; then
+  LIMIT=
+  [[ -n "${PTPAX}" ]] && LIMIT=-l
+
+  if [[ ! -f "${PRELOAD}" ]]; then
+    (( count = count + 1 ))
+    [[ "${verbose}" != 0 ]] && echo " ${PRELOAD} is missing, run make check in tests"
+  fi
+
+  # setup, what goes by path, what is held under the lock
+  RACES=(
+    ""   "${LIMIT} -E"  "${LIMIT} -P"	# created by path, merged into
+    "-C" "-d"           "${LIMIT} -p"	# removed by path, created again
+  )
+
+  for (( i = 0; i < ${#RACES[@]}; i += 3 )); do
+    rm -f "${TMPDIR}"/race "${TMPDIR}"/serial
+    python "${MKELF}" -n "${TMPDIR}"/race "${TMPDIR}"/serial
+    if [[ -n "${RACES[i]}" ]]; then
+      ${PAXCTLNG} ${RACES[i]} "${TMPDIR}"/race "${TMPDIR}"/serial >/dev/null 2>&1
+    fi
+
+    PRELOAD_SLOW=500 LD_PRELOAD="${PRELOAD}" ${PAXCTLNG} -v ${RACES[i+2]} "${TMPDIR}"/race >/dev/null 2>&1 &
+    sleep 0.2
+    ${PAXCTLNG} ${RACES[i+1]} "${TMPDIR}"/race >/dev/null 2>&1
+    wait
+
+    ${PAXCTLNG} ${RACES[i+1]} "${TMPDIR}"/serial >/dev/null 2>&1
+    ${PAXCTLNG} -v ${RACES[i+2]} "${TMPDIR}"/serial >/dev/null 2>&1
+
+    got=$(${PAXCTLNG} -v "${TMPDIR}"/race | sed -n 's/.*XATTR_PAX : //p')
+    want=$(${PAXCTLNG} -v "${TMPDIR}"/serial | sed -n 's/.*XATTR_PAX : //p')
+    if [[ "${got}" != "${want}" ]]; then
+      (( count = count + 1 ))
+      [[ "${verbose}" != 0 ]] && echo " ${RACES[i+1]} by path under ${RACES[i+2]}: XATTR_PAX is ${got}, not ${want}"
+    fi
+  done
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
@@ -0,0 +1,157 @@
+#!/usr/bin/env python
+#
+#    mkelf.py: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Write small ELF objects carrying a PT_PAX_FLAGS program header, of either
+# class and byte order whatever the host's, so the tests do not depend on
+# a toolchain which emits PT_PAX_FLAGS.  The tests either run it
+#
+#     mkelf.py [-b] [-3] [-f FLAGS] [-n] [-p] [-r] [-s SIZE] ELF...
+#
+# where -b makes it big endian, -3 makes it ELF32, -f gives the PT_PAX
+# flags as a string of PpEeMmRrSs, -n leaves out PT_PAX_FLAGS, -p puts the
+# program headers at the end of the file, -r makes an ET_REL with no
+# program headers and -s gives the size of the file, or they
+# import it and use elf() and pt_flags().
+#
+
+import getopt
+import struct
+import sys
+
+
+PT_LOAD = 1
+PT_PAX_FLAGS = 0x65041580
+
+PF_BITS = [
+    ('P', 1 << 4), ('p', 1 << 5), ('S', 1 << 6), ('s', 1 << 7),
+    ('M', 1 << 8), ('m', 1 << 9), ('E', 1 << 12), ('e', 1 << 13),
+    ('R', 1 << 14), ('r', 1 << 15),
+]
+
+PF_NORANDEXEC = 1 << 11
+
+SIZE = 4096
+
+
+def parse_flags(sflags):
+    flags = 0
+    for (c, bit) in PF_BITS:
+        if c in sflags:
+            flags |= bit
+    return flags
+
+
+def show_flags(flags):
+    """ The flags as paxctl-ng -v shows them, eg PeMRs """
+    s = ''
+    for i in range(0, len(PF_BITS), 2):
+        (up, upbit) = PF_BITS[i]
+        (lo, lobit) = PF_BITS[i + 1]
+        s += up if flags & upbit else lo if flags & lobit else '-'
+    # paxctl-ng shows them in PEMRS order
+    return s[0] + s[3] + s[2] + s[4] + s[1]
+
+
+def elf(sflags='', msb=False, bits=64, pax=True, rel=False, far=False, size=SIZE):
+    """ Return an ET_EXEC ELF of size bytes with one PT_LOAD and, unless
+    pax is False, one PT_PAX_FLAGS program header.  The rest of the file
+    is filler, so changes outside the program headers show.  With rel it
+    is an ET_REL with no program headers at all, as gcc -c leaves them.
+    With far the program headers are at the end of the file, past the
+    filler, rather than right after the ELF header.
+    """
+    e = '>' if msb else '<'
+    etype = 1 if rel else 2
+    phnum = 0 if rel else 2 if pax else 1
+    (ehsize, phentsize) = (64, 56) if bits == 64 else (52, 32)
+    phoff = 0 if not phnum else size - phnum * phentsize if far else ehsize
+    if bits == 64:
+        ident = b'\x7fELF' + struct.pack('BBBB', 2, 2 if msb else 1, 1, 0) + b'\0' * 8
+        ehdr = ident + struct.pack(e + 'HHIQQQIHHHHHH',
+                                   etype, 21 if msb else 62, 1, # ET_EXEC or ET_REL, EM_PPC64 or EM_X86_64
+                                   0, phoff, 0,                 # e_entry, e_phoff, e_shoff
+                                   0, 64, 56, phnum,            # e_flags, e_ehsize, e_phentsize, e_phnum
+                                   64, 0, 0)                    # e_shentsize, e_shnum, e_shstrndx
+        phdrs = struct.pack(e + 'IIQQQQQQ', PT_LOAD, 5, 0, 0, 0, size, size, 4096) if phnum else b''
+        if pax and phnum:
+            phdrs += struct.pack(e + 'IIQQQQQQ', PT_PAX_FLAGS, parse_flags(sflags), 0, 0, 0, 0, 0, 4)
+    else:
+        ident = b'\x7fELF' + struct.pack('BBBB', 1, 2 if msb else 1, 1, 0) + b'\0' * 8
+        ehdr = ident + struct.pack(e + 'HHIIIIIHHHHHH',
+                                   etype, 20 if msb else 3, 1,  # ET_EXEC or ET_REL, EM_PPC or EM_386
+                                   0, phoff, 0,
+                                   0, 52, 32, phnum,
+                                   40, 0, 0)
+        phdrs = struct.pack(e + 'IIIIIIII', PT_LOAD, 0, 0, 0, size, size, 5, 4096) if phnum else b''
+        if pax and phnum:
+            phdrs += struct.pack(e + 'IIIIIIII', PT_PAX_FLAGS, 0, 0, 0, 0, 0, parse_flags(sflags), 4)
+    filler = bytes(bytearray((i * 7) & 0xff for i in range(size - len(ehdr) - len(phdrs))))
+    if far:
+        return ehdr + filler + phdrs
+    return ehdr + phdrs + filler
+
+
+def pt_flags(image):
+    """ Return the PT_PAX flags of image as paxctl-ng -v shows them, or None """
+    image = bytes(image)
+    e = '>' if image[5:6] == b'\x02' else '<'
+    if image[4:5] == b'\x02':
+        (phoff,) = struct.unpack_from(e + 'Q', image, 32)
+        (phentsize, phnum) = struct.unpack_from(e + 'HH', image, 54)
+        at = 4
+    else:
+        (phoff,) = struct.unpack_from(e + 'I', image, 28)
+        (phentsize, phnum) = struct.unpack_from(e + 'HH', image, 42)
+        at = 24
+    for i in range(phnum):
+        p = phoff + i * phentsize
+        (ptype,) = struct.unpack_from(e + 'I', image, p)
+        if ptype == PT_PAX_FLAGS:
+            (flags,) = struct.unpack_from(e + 'I', image, p + at)
+            return show_flags(flags & ~PF_NORANDEXEC)
+    return None
+
+
+def main():
+    (opts, args) = getopt.getopt(sys.argv[1:], 'b3f:nprs:')
+    kw = {}
+    for (o, a) in opts:
+        if o == '-b':
+            kw['msb'] = True
+        elif o == '-3':
+            kw['bits'] = 32
+        elif o == '-f':
+            kw['sflags'] = a
+        elif o == '-n':
+            kw['pax'] = False
+        elif o == '-p':
+            kw['far'] = True
+        elif o == '-r':
+            kw['rel'] = True
+        elif o == '-s':
+            kw['size'] = int(a)
+    for path in args:
+        f = open(path, 'wb')
+        f.write(elf(**kw))
+        f.close()
+
+
+if __name__ == '__main__':
+    main()
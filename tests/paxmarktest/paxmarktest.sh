@@ -0,0 +1,169 @@
+#!/bin/bash
+#
+#    paxmarktest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# The paxmark builtin of --enable-bashbuiltin must mark each file as the
+# paxctl-ng steps of paxmarksh() in paxmark.sh would.  Run the same calls
+# on two copies of some files, once through the builtin and once through
+# paxctl-ng, and check that the markings agree and that the files the
+# builtin puts in its -a array are those a paxctl-ng step failed on.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+PAXMARKSO="${PWD}"/../../src/.libs/paxmark.so
+MKELF="${PWD}"/../mkelf.py
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/paxmarktest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+mismatch() {
+  (( count = count + 1 ))
+  [[ "${verbose}" != 0 ]] && echo " $*"
+}
+
+# The markings of a file as paxctl-ng -v shows them
+markings() {
+  ( cd "$1" && ${PAXCTLNG} -v "$2" 2>/dev/null | grep "PAX" | tr -d '\t' | tr '\n' ' ' )
+}
+
+# paxctl-ng -L -z ELF; paxctl-ng -L -FLAGS ELF
+chain_pt() {
+  local flags=${1//z}
+  [[ "${1//[!z]}" ]] && ${PAXCTLNG} -L -z "$2" >/dev/null 2>&1
+  [[ "${flags}" ]] || return 0
+  ${PAXCTLNG} -L -${flags} "$2" >/dev/null 2>&1
+}
+
+# paxctl-ng -d ELF; paxctl-ng -l -FLAGS ELF
+chain_xt() {
+  local flags=${1//z}
+  [[ "${1//[!z]}" ]] && ${PAXCTLNG} -d "$2" >/dev/null 2>&1
+  [[ "${flags}" ]] || return 0
+  ${PAXCTLNG} -l -${flags} "$2" >/dev/null 2>&1
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING PAXMARK TEST"
+echo
+
+# An option, PAX_MARKINGS and the flags, with - for no option
+CALLS=(
+  "-"  "PT XT" "PEMRS"
+  "-L" "PT XT" "pemrs"
+  "-l" "PT XT" "Pem"
+  "-"  "XT"    "z"
+  "-"  "PT"    "zpE"
+  "-L" "none"  "z"
+  "-l" "none"  "zRs"
+  "-"  "PT XT" "PeMrS"
+  "-"  "PT XT" "z"
+  "-"  "none"  "PEMRS"
+  "-"  "PT XT" "Cc"
+)
+
+# paxctl-ng does not fail on a missing file, but the builtin must report
+# it, so it is kept apart
+FILES="elf noheader text"
+MISSING="${TMPDIR}"/gone/missing
+
+if [[ ! -f "${PAXMARKSO}" ]]; then
+  echo " No paxmark builtin, skipped"
+else
+  for d in builtin chain; do
+    mkdir -p "${TMPDIR}"/$d
+    python "${MKELF}" -f pemrs "${TMPDIR}"/$d/elf
+    python "${MKELF}" -n "${TMPDIR}"/$d/noheader
+    echo "not an ELF" > "${TMPDIR}"/$d/text
+  done
+
+  for (( i = 0; i < ${#CALLS[@]}; i += 3 )); do
+    opt=()
+    [[ ${CALLS[i]} != "-" ]] && opt=( ${CALLS[i]} )
+    markings=${CALLS[i+1]}
+    flags=${CALLS[i+2]}
+    call="PAX_MARKINGS='${markings}' paxmark ${opt[*]} ${flags}"
+
+    failed=$( cd "${TMPDIR}"/builtin && PAX_MARKINGS="${markings}" bash -c '
+      enable -f "$1" paxmark || exit 1
+      shift
+      paxmark "$@"
+      echo "${failed[@]}"' - "${PAXMARKSO}" "${opt[@]}" -a failed "${flags}" ${FILES} "${MISSING}" 2>/dev/null )
+    if [[ $? != 0 ]]; then
+      mismatch "${PAXMARKSO} could not be loaded"
+      break
+    fi
+
+    # Which markings paxmarksh() would do, and the paxctl-ng steps for them
+    do_pt=; do_xt=
+    [[ "${markings}" != "${markings/PT/}" ]] && do_pt=1
+    [[ "${markings}" != "${markings/XT/}" ]] && do_xt=1
+    [[ ${CALLS[i]} = "-L" ]] && do_pt=1 && do_xt=
+    [[ ${CALLS[i]} = "-l" ]] && do_pt= && do_xt=1
+    cflags=${flags//[!zPpEeMmRrSs]}
+
+    expected=
+    if [[ "${cflags}" ]]; then
+      for f in ${FILES}; do
+        ret=0
+        if [[ -n "${do_pt}" ]]; then
+          if [[ -n "${PTPAX}" ]]; then
+            ( cd "${TMPDIR}"/chain && chain_pt "${cflags}" "$f" ) || ret=1
+          else
+            ret=1
+          fi
+        fi
+        if [[ -n "${do_xt}" ]]; then
+          if [[ -n "${XTPAX}" ]]; then
+            ( cd "${TMPDIR}"/chain && chain_xt "${cflags}" "$f" ) || ret=1
+          else
+            ret=1
+          fi
+        fi
+        [[ ${ret} = 1 ]] && expected="${expected:+${expected} }$f"
+      done
+      [[ "${cflags//z}" && -n "${do_pt}${do_xt}" ]] && expected="${expected:+${expected} }${MISSING}"
+    fi
+
+    [[ "${failed}" != "${expected}" ]] && mismatch "${call}: the builtin failed on '${failed}', paxctl-ng on '${expected}'"
+
+    for f in ${FILES}; do
+      b=$(markings "${TMPDIR}"/builtin $f)
+      c=$(markings "${TMPDIR}"/chain $f)
+      [[ "${b}" != "${c}" ]] && mismatch "after ${call} $f is '${b}' by the builtin, '${c}' by paxctl-ng"
+    done
+  done
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
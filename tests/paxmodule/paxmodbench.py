@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+#
+#    paxmodbench.py: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Time one call of each of the per-file functions of the pax module.
+#
+# The object is a tiny ELF with a PT_PAX_FLAGS program header, which stays
+# in the page cache, so what is timed is the few syscalls of a call plus
+# the glue around them: parsing the arguments and building the result.
+# os.stat() of the same file is timed as well, as the cost of one syscall
+# and the least any call could take.
+#
+# With pyperf installed it runs the benchmarks, and takes its options, eg.
+# -o new.json, so two builds of the module can be set side by side with
+# "python -m pyperf compare_to old.json new.json".  Without it timeit
+# gives a rougher figure.
+#
+
+import os
+import shutil
+import struct
+import sys
+import tempfile
+import pax
+
+
+PT_PAX_FLAGS = 0x65041580
+
+# P-M-R- e
+FLAGS = (1 << 4) | (1 << 8) | (1 << 13) | (1 << 14)
+
+
+def tiny_elf(flags):
+    """ Return an ELF64 LSB shared object with nothing but its header
+    and one PT_PAX_FLAGS program header.
+    """
+    ident = b'\x7fELF' + struct.pack('BBBB', 2, 1, 1, 0) + b'\0' * 8
+    ehdr = ident + struct.pack('<HHIQQQIHHHHHH',
+                               3, 62, 1,        # ET_DYN, EM_X86_64, EV_CURRENT
+                               0, 64, 0,        # e_entry, e_phoff, e_shoff
+                               0, 64, 56, 1,    # e_flags, e_ehsize, e_phentsize, e_phnum
+                               64, 0, 0)        # e_shentsize, e_shnum, e_shstrndx
+    phdr = struct.pack('<IIQQQQQQ', PT_PAX_FLAGS, flags, 0, 0, 0, 0, 0, 4)
+    return ehdr + phdr
+
+
+def benchmarks(top):
+    """ Write the object below top and return [ ( name, func, args ) ] """
+    path = os.path.join(top, 'elf')
+    f = open(path, 'wb')
+    f.write(tiny_elf(FLAGS))
+    f.close()
+
+    # Mark it once, so the setstrflags() below has nothing to change
+    sflags = pax.getflags(path)[0]
+    pax.setstrflags(path, sflags)
+
+    fd = os.open(path, os.O_RDWR)
+    image = open(path, 'rb').read()
+
+    benches = [
+        ('os.stat', os.stat, (path,)),
+        ('getflags', pax.getflags, (path,)),
+        ('getflags fd', pax.getflags, (fd,)),
+        ('getptxtflags', pax.getptxtflags, (path,)),
+        ('setstrflags unchanged', pax.setstrflags, (path, sflags)),
+        ('getflags_from_buffer', pax.getflags_from_buffer, (image,)),
+    ]
+
+    # An older build of the module may not take an fd, leave those out
+    usable = []
+    for (name, func, args) in benches:
+        try:
+            func(*args)
+        except pax.PaxError:
+            sys.stderr.write('%s: not supported, skipped\n' % name)
+            continue
+        usable.append((name, func, args))
+
+    return usable
+
+
+def run_timeit(benches, loops=20000):
+    import timeit
+
+    print('%-24s %12s' % ('call', 'ns per call'))
+    for (name, func, args) in benches:
+        t = min(timeit.repeat(lambda: func(*args), number=loops, repeat=5))
+        print('%-24s %12.0f' % (name, t / loops * 1e9))
+
+
+def main():
+    top = tempfile.mkdtemp(prefix='paxmodbench.')
+    try:
+        benches = benchmarks(top)
+
+        try:
+            import pyperf
+        except ImportError:
+            run_timeit(benches)
+            return
+
+        runner = pyperf.Runner()
+        for (name, func, args) in benches:
+            runner.bench_func(name, func, *args)
+    finally:
+        shutil.rmtree(top, ignore_errors=True)
+
+
+if __name__ == '__main__':
+    main()
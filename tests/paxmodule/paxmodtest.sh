@@ -28,6 +28,7 @@ shift
 TESTFILE="$(pwd)/dummy"
 PAXCTLNG="$(pwd)/../../src/paxctl-ng"
 PYPAXCTL="$(pwd)/../../scripts/pypaxctl"
+MKELF="$(pwd)/../mkelf.py"
 
 unamem=$(uname -m)
 pythonversion=$(python --version 2>&1)
@@ -149,8 +150,108 @@ done
 
 if [[ "${verbose}" = 0 ]] ;then
   echo
-  echo
 fi
+
+# Patch a copy of the image in memory and check that the file and the
+# buffer calls read the same PT_PAX flags back from it.
+if [[ -n "${PTPAX}" ]]; then
+  bcount=$(python - "${TESTFILE}" "${TESTFILE}.buf" "${verbose}" <<'EOF'
+import sys
+import pax
+(elf, copy, verbose) = sys.argv[1:]
+image = bytearray(open(elf, 'rb').read())
+count = 0
+for sflags in ['pemrs', 'PEMRS', 'PeMRs', 'pEmRs', 'PpEeMmRrSs']:
+    pax.setstrflags_in_buffer(image, sflags)
+    f = open(copy, 'wb')
+    f.write(image)
+    f.close()
+    (bflags, ibflags) = pax.getflags_from_buffer(memoryview(image))
+    (pflags, xflags) = pax.getptxtflags(copy)
+    if bflags != pflags:
+        count += 1
+        if verbose != '0':
+            sys.stderr.write('Buffer mismatch: %s %s %s\n' % (sflags, bflags, pflags))
+print(count)
+EOF
+)
+  rm -f "${TESTFILE}.buf"
+  (( count = count + ${bcount:-1} ))
+fi
+
+# Walk the directory of the test file, which scan() must find with the
+# same markings as getptxtflags() reads, and nothing not there.
+scount=$(python - "${TESTFILE}" "${verbose}" <<'EOF'
+import os
+import sys
+import pax
+(elf, verbose) = sys.argv[1:]
+count = 0
+found = {}
+for batch in pax.scan([os.path.dirname(elf), elf + '.missing'], 2):
+    for r in batch:
+        found[r.path] = r
+if found.get(elf + '.missing', (0,) * 7)[6] == 0:
+    count += 1
+r = found.get(elf)
+if r is None or r.errno != 0 or (r.pt, r.xt) != pax.getptxtflags(elf):
+    count += 1
+    if verbose != '0':
+        sys.stderr.write('Scan mismatch: %s %s\n' % (r, pax.getptxtflags(elf)))
+print(count)
+EOF
+)
+(( count = count + ${scount:-1} ))
+
+# An ELF with PT_PAX and no XATTR_PAX, whose flags getflags() must read
+# from PT_PAX, by path, by fd and through pax.aio.  Without PTPAX there
+# are none to find.
+python "${MKELF}" -f PeMRs "${TESTFILE}.pt"
+pcount=$(python - "${TESTFILE}.pt" "${PTPAX}" "${verbose}" <<'EOF'
+import os
+import sys
+import pax
+(elf, ptpax, verbose) = sys.argv[1:]
+want = 'PeMRs' if ptpax else None
+count = 0
+
+def check(how, get):
+    global count
+    try:
+        got = get()[0]
+    except pax.PaxError:
+        got = None
+    if got != want:
+        count += 1
+        if verbose != '0':
+            sys.stderr.write('PT_PAX only, %s: expected %s, got %s\n' % (how, want, got))
+
+check('path', lambda: pax.getflags(elf))
+fd = os.open(elf, os.O_RDONLY)
+check('fd', lambda: pax.getflags(fd))
+os.close(fd)
+
+def aio_getflags(path):
+    # pax.aio wants a running loop, which a callback has
+    loop = asyncio.new_event_loop()
+    futures = []
+    loop.call_soon(lambda: futures.append(pax.aio.getflags(path)))
+    loop.run_until_complete(asyncio.sleep(0))
+    try:
+        return loop.run_until_complete(futures[0])
+    finally:
+        loop.close()
+
+if hasattr(pax, 'aio'):
+    import asyncio
+    check('aio', lambda: aio_getflags(elf))
+print(count)
+EOF
+)
+rm -f "${TESTFILE}.pt"
+(( count = count + ${pcount:-1} ))
+
+echo
 echo " Mismatches = ${count}"
 echo
 echo "================================================================================"
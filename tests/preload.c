@@ -0,0 +1,248 @@
+/*
+	preload.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* An LD_PRELOAD library for the tests, so paths only taken on older
+ * kernels and what a run does to the files are checked on any host.
+ *
+ *	PRELOAD_NOSYS	a list of openat2, getxattrat, setxattrat and
+ *			removexattrat, which syscall() then fails with ENOSYS
+ *	PRELOAD_DIR	count the open() and openat() of paths below it
+ *	PRELOAD_LOG	append the counts to this file at exit, one
+ *			"name count" per line
+ *	PRELOAD_SLOW	sleep this many ms before each fsetxattr() and
+ *			fremovexattr(), to hold a race open
+ */
+
+#define _GNU_SOURCE		/* RTLD_NEXT */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if !defined(SYS_getxattrat) && !defined(__alpha__)
+#define SYS_setxattrat		463
+#define SYS_getxattrat		464
+#define SYS_removexattrat	466
+#endif
+
+static struct
+{
+	const char *name;
+	long nr;
+	int xattr;		/* counted as xattr */
+	int off;		/* fails with ENOSYS */
+} nosys[] = {
+#ifdef SYS_openat2
+	{ "openat2", SYS_openat2, 0, 0 },
+#endif
+#ifdef SYS_getxattrat
+	{ "getxattrat", SYS_getxattrat, 1, 0 },
+	{ "setxattrat", SYS_setxattrat, 1, 0 },
+	{ "removexattrat", SYS_removexattrat, 1, 0 },
+#endif
+	{ NULL, 0, 0, 0 }
+};
+
+static struct
+{
+	const char *name;
+	int n;
+} counts[] = {
+	{ "open", 0 },		/* of a path below PRELOAD_DIR */
+	{ "flock", 0 },
+	{ "fxattr", 0 },	/* fgetxattr() and co */
+	{ "xattr", 0 },		/* getxattr() and co, and the *xattrat() syscalls */
+	{ "nosys", 0 },		/* syscalls failed with ENOSYS */
+	{ NULL, 0 }
+};
+
+enum { OPEN, FLOCK, FXATTR, XATTR, NOSYS };
+
+static const char *dir;
+static int slow;
+
+
+__attribute__((constructor))
+static void
+preload_start(void)
+{
+	const char *list = getenv("PRELOAD_NOSYS");
+	int i;
+
+	dir = getenv("PRELOAD_DIR");
+	if(getenv("PRELOAD_SLOW"))
+		slow = atoi(getenv("PRELOAD_SLOW"));
+
+	for(i = 0; list && nosys[i].name; i++)
+		if(strstr(list, nosys[i].name))
+			nosys[i].off = 1;
+}
+
+
+__attribute__((destructor))
+static void
+preload_end(void)
+{
+	const char *log = getenv("PRELOAD_LOG");
+	FILE *f;
+	int i;
+
+	if(log == NULL || (f = fopen(log, "a")) == NULL)
+		return;
+
+	for(i = 0; counts[i].name; i++)
+		fprintf(f, "%s %d\n", counts[i].name, counts[i].n);
+	fclose(f);
+}
+
+
+static void *
+next(const char *name)
+{
+	void *fn;
+
+	if((fn = dlsym(RTLD_NEXT, name)) == NULL)
+		abort();
+
+	return fn;
+}
+
+
+static void
+count_open(const char *path)
+{
+	if(dir && !strncmp(path, dir, strlen(dir)))
+		__atomic_add_fetch(&counts[OPEN].n, 1, __ATOMIC_RELAXED);
+}
+
+
+#define OPEN_MODE(flags, mode) \
+	do { \
+		va_list ap; \
+		mode = 0; \
+		if((flags) & (O_CREAT | O_TMPFILE)) \
+		{ \
+			va_start(ap, flags); \
+			mode = va_arg(ap, int); \
+			va_end(ap); \
+		} \
+	} while(0)
+
+int
+open(const char *path, int flags, ...)
+{
+	int mode;
+
+	OPEN_MODE(flags, mode);
+	count_open(path);
+	return ((int (*)(const char *, int, ...))next("open"))(path, flags, mode);
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+	int mode;
+
+	OPEN_MODE(flags, mode);
+	count_open(path);
+	return ((int (*)(const char *, int, ...))next("open64"))(path, flags, mode);
+}
+
+int
+openat(int fd, const char *path, int flags, ...)
+{
+	int mode;
+
+	OPEN_MODE(flags, mode);
+	count_open(path);
+	return ((int (*)(int, const char *, int, ...))next("openat"))(fd, path, flags, mode);
+}
+
+int
+openat64(int fd, const char *path, int flags, ...)
+{
+	int mode;
+
+	OPEN_MODE(flags, mode);
+	count_open(path);
+	return ((int (*)(int, const char *, int, ...))next("openat64"))(fd, path, flags, mode);
+}
+
+
+int
+flock(int fd, int op)
+{
+	__atomic_add_fetch(&counts[FLOCK].n, 1, __ATOMIC_RELAXED);
+	return ((int (*)(int, int))next("flock"))(fd, op);
+}
+
+
+#define COUNTED(counter, delay, ret, name, params, args) \
+	ret \
+	name params \
+	{ \
+		__atomic_add_fetch(&counts[counter].n, 1, __ATOMIC_RELAXED); \
+		if(delay && slow > 0) \
+			usleep(slow * 1000); \
+		return ((ret (*) params)next(#name)) args; \
+	}
+
+COUNTED(FXATTR, 0, ssize_t, fgetxattr, (int fd, const char *name, void *value, size_t size), (fd, name, value, size))
+COUNTED(FXATTR, 1, int, fsetxattr, (int fd, const char *name, const void *value, size_t size, int flags),
+	(fd, name, value, size, flags))
+COUNTED(FXATTR, 1, int, fremovexattr, (int fd, const char *name), (fd, name))
+COUNTED(XATTR, 0, ssize_t, getxattr, (const char *path, const char *name, void *value, size_t size),
+	(path, name, value, size))
+COUNTED(XATTR, 0, int, setxattr, (const char *path, const char *name, const void *value, size_t size, int flags),
+	(path, name, value, size, flags))
+COUNTED(XATTR, 0, int, removexattr, (const char *path, const char *name), (path, name))
+
+
+long
+syscall(long nr, ...)
+{
+	va_list ap;
+	long a[6];
+	int i;
+
+	va_start(ap, nr);
+	for(i = 0; i < 6; i++)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+
+	for(i = 0; nosys[i].name; i++)
+		if(nosys[i].nr == nr)
+		{
+			if(nosys[i].xattr)
+				__atomic_add_fetch(&counts[XATTR].n, 1, __ATOMIC_RELAXED);
+			if(nosys[i].off)
+			{
+				__atomic_add_fetch(&counts[NOSYS].n, 1, __ATOMIC_RELAXED);
+				errno = ENOSYS;
+				return -1;
+			}
+		}
+
+	return ((long (*)(long, ...))next("syscall"))(nr, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
@@ -0,0 +1,360 @@
+#!/usr/bin/env python
+#
+#    revdeppaxbench.py: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Time revdep-pax on a synthetic system, without portage and without root.
+#
+# A fake vdb is generated with one NEEDED.ELF.2 per package, and next to it
+# a tree of tiny ELF objects carrying a PT_PAX_FLAGS program header, so
+# pax.getflags() and pax.setbinflags() have something real to work on.
+# The objects are laid out in DEPTH layers per ABI: layer 0 holds the
+# executables, the deeper layers the libraries, and every object NEEDs
+# FANOUT sonames from the next layer down.  A stand-in portage module which
+# points revdep-pax at the fake vdb is put first on the python path.
+#
+# Each phase runs in a child process of its own so its peak memory can be
+# read from getrusage() without the other phases getting in the way.
+#
+
+import getopt
+import os
+import random
+import resource
+import shutil
+import struct
+import sys
+import tempfile
+import time
+import glob
+
+
+PT_PAX_FLAGS = 0x65041580
+
+# A few markings so that some links mismatch and some do not
+FLAGS = [
+    (1 << 4) | (1 << 8) | (1 << 13) | (1 << 14),    # P-M-R- e
+    (1 << 4) | (1 << 9) | (1 << 13) | (1 << 14),    # P-m-R- e
+    (1 << 5) | (1 << 9) | (1 << 13),                # p-m--- e
+    (1 << 13),                                      # -e---
+]
+
+ABIS = ['X86_64', 'X86_32', 'X32', 'ARM', 'AARCH64', 'PPC64', 'PPC', 'MIPS']
+
+PORTAGE_STANDIN = '''# Stand-in for the parts of portage used by revdep-pax
+root = '/'
+VDB_PATH = %r
+
+class _dbapi:
+    def __init__(self, vdb):
+        self.vdb = vdb
+
+    def cpv_all(self):
+        import os
+        cpvs = []
+        for cat in sorted(os.listdir(self.vdb)):
+            for pkg in sorted(os.listdir(os.path.join(self.vdb, cat))):
+                cpvs.append('%%s/%%s' %% (cat, pkg))
+        return cpvs
+
+    def aux_get(self, cpv, keys):
+        import os
+        values = []
+        for k in keys:
+            try:
+                f = open(os.path.join(self.vdb, cpv, k))
+                values.append(f.read())
+                f.close()
+            except IOError:
+                values.append('')
+        return values
+
+class _vartree:
+    def __init__(self, vdb):
+        self.dbapi = _dbapi(vdb)
+
+db = { root : { 'vartree' : _vartree(VDB_PATH) } }
+'''
+
+
+def tiny_elf(flags):
+    """ Return an ELF64 LSB shared object with nothing but its header
+    and one PT_PAX_FLAGS program header.
+    """
+    ident = b'\x7fELF' + struct.pack('BBBB', 2, 1, 1, 0) + b'\0' * 8
+    ehdr = ident + struct.pack('<HHIQQQIHHHHHH',
+                               3, 62, 1,        # ET_DYN, EM_X86_64, EV_CURRENT
+                               0, 64, 0,        # e_entry, e_phoff, e_shoff
+                               0, 64, 56, 1,    # e_flags, e_ehsize, e_phentsize, e_phnum
+                               64, 0, 0)        # e_shentsize, e_shnum, e_shstrndx
+    phdr = struct.pack('<IIQQQQQQ', PT_PAX_FLAGS, flags, 0, 0, 0, 0, 0, 4)
+    return ehdr + phdr
+
+
+def generate(top, packages, objects, depth, fanout, abis):
+    """ Write the fake vdb and the ELF objects below top and return the
+    path to the vdb and a list of ( abi, soname ) to mark.
+    """
+    rng = random.Random(0)
+    vdb = os.path.join(top, 'vdb')
+    root = os.path.join(top, 'root')
+
+    total = packages * objects
+    per_layer = max(1, total // depth)
+
+    needed = {}
+    sonames = []
+
+    for a in range(abis):
+        abi = ABIS[a] if a < len(ABIS) else 'ABI%d' % a
+        bindir = os.path.join(root, 'usr', 'bin-%s' % abi.lower())
+        libdir = os.path.join(root, 'usr', 'lib-%s' % abi.lower())
+        os.makedirs(bindir)
+        os.makedirs(libdir)
+
+        # Layer l holds objects [l*per_layer, (l+1)*per_layer), the last
+        # layer takes what is left over.
+        def layer_of(i):
+            return min(i // per_layer, depth - 1)
+
+        def layer_range(l):
+            lo = l * per_layer
+            hi = total if l == depth - 1 else (l + 1) * per_layer
+            return (lo, hi)
+
+        for i in range(total):
+            l = layer_of(i)
+            if l == 0:
+                path = os.path.join(bindir, 'bin%d' % i)
+                soname = ''
+            else:
+                soname = 'lib%d.so.1' % i
+                path = os.path.join(libdir, soname)
+                sonames.append((abi, soname))
+
+            links = []
+            if l < depth - 1:
+                (lo, hi) = layer_range(l + 1)
+                for n in range(min(fanout, hi - lo)):
+                    links.append('lib%d.so.1' % rng.randrange(lo, hi))
+
+            f = open(path, 'wb')
+            f.write(tiny_elf(rng.choice(FLAGS)))
+            f.close()
+
+            pkg = 'cat-%d/pkg%d-1' % (i // objects % 16, i // objects)
+            needed.setdefault(pkg, []).append('%s;%s;%s;;%s\n' % (
+                abi, path, soname, ','.join(sorted(set(links)))))
+
+    for pkg in needed:
+        d = os.path.join(vdb, pkg)
+        os.makedirs(d)
+        f = open(os.path.join(d, 'NEEDED.ELF.2'), 'w')
+        f.writelines(needed[pkg])
+        f.close()
+
+    return (vdb, sonames)
+
+
+def load_revdep_pax(path):
+    """ revdep-pax has no .py suffix, so load it by hand """
+    if sys.hexversion > 0x03000000:
+        import importlib.machinery
+        import types
+        loader = importlib.machinery.SourceFileLoader('revdep_pax', path)
+        module = types.ModuleType(loader.name)
+        loader.exec_module(module)
+        return module
+    else:
+        import imp
+        return imp.load_source('revdep_pax', path)
+
+
+def run_phase(name, func):
+    """ Run func in a child with stdout thrown away and return the
+    wall time and peak memory of the child.
+    """
+    (r, w) = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(r)
+        null = os.open(os.devnull, os.O_WRONLY)
+        os.dup2(null, 1)
+        start = time.time()
+        try:
+            func()
+        except BaseException:
+            import traceback
+            traceback.print_exc()
+            os._exit(1)
+        elapsed = time.time() - start
+        # ru_maxrss is in KiB on Linux
+        maxrss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        os.write(w, ('%f %d' % (elapsed, maxrss)).encode())
+        os._exit(0)
+
+    os.close(w)
+    data = b''
+    while True:
+        chunk = os.read(r, 64)
+        if not chunk:
+            break
+        data += chunk
+    os.close(r)
+    (pid, status) = os.waitpid(pid, 0)
+    if status != 0 or not data:
+        return (name, None, None)
+    (elapsed, maxrss) = data.decode().split()
+    return (name, float(elapsed), int(maxrss))
+
+
+def run_usage():
+    print('Usage        : revdeppaxbench.py [-n PACKAGES] [-o OBJECTS] [-d DEPTH] [-f FANOUT]')
+    print('                                 [-a ABIS] [-m MARKS] [-r REVDEP-PAX] [-t DIR] [-k]')
+    print('             : -n PACKAGES       number of packages in the vdb (default 100)')
+    print('             : -o OBJECTS        ELF objects per package and ABI (default 10)')
+    print('             : -d DEPTH          number of layers in the link chain (default 4)')
+    print('             : -f FANOUT         sonames NEEDED by each object (default 3)')
+    print('             : -a ABIS           number of ABIs (default 1)')
+    print('             : -m MARKS          number of sonames to mark with -s SONAME -m -y')
+    print('                                 and of libraries to query with -b OBJECT (default 10)')
+    print('             : -r REVDEP-PAX     the revdep-pax to time (default ../../scripts/revdep-pax)')
+    print('             : -t DIR            generate the synthetic system in DIR')
+    print('             : -k                keep the synthetic system when done')
+
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], 'n:o:d:f:a:m:r:t:kh')
+    except getopt.GetoptError as err:
+        print(str(err))
+        run_usage()
+        sys.exit(1)
+
+    here = os.path.dirname(os.path.abspath(sys.argv[0]))
+
+    packages = 100
+    objects = 10
+    depth = 4
+    fanout = 3
+    abis = 1
+    marks = 10
+    revdep_pax = os.path.join(here, '..', '..', 'scripts', 'revdep-pax')
+    tmpdir = None
+    keep = False
+
+    try:
+        for o, a in opts:
+            if o == '-n':
+                packages = int(a)
+            elif o == '-o':
+                objects = int(a)
+            elif o == '-d':
+                depth = int(a)
+            elif o == '-f':
+                fanout = int(a)
+            elif o == '-a':
+                abis = int(a)
+            elif o == '-m':
+                marks = int(a)
+            elif o == '-r':
+                revdep_pax = a
+            elif o == '-t':
+                tmpdir = a
+            elif o == '-k':
+                keep = True
+            elif o == '-h':
+                run_usage()
+                sys.exit(0)
+    except ValueError:
+        run_usage()
+        sys.exit(1)
+
+    if packages < 1 or objects < 1 or depth < 2 or fanout < 0 or abis < 1 or marks < 0:
+        run_usage()
+        sys.exit(1)
+
+    # Use the freshly built pax module if there is one
+    for build in glob.glob(os.path.join(here, '..', '..', 'scripts', 'build', 'lib*')):
+        sys.path.insert(0, build)
+
+    top = tempfile.mkdtemp(prefix='revdeppaxbench.', dir=tmpdir)
+
+    try:
+        start = time.time()
+        (vdb, sonames) = generate(top, packages, objects, depth, fanout, abis)
+        generated = time.time() - start
+
+        standin = os.path.join(top, 'python')
+        os.makedirs(standin)
+        f = open(os.path.join(standin, 'portage.py'), 'w')
+        f.write(PORTAGE_STANDIN % vdb)
+        f.close()
+        sys.path.insert(0, standin)
+
+        revdep = load_revdep_pax(revdep_pax)
+
+        rng = random.Random(1)
+        to_mark = rng.sample(sonames, min(marks, len(sonames)))
+
+        def build_graph():
+            revdep.LinkGraph().get_graph()
+
+        def mark():
+            for (abi, soname) in to_mark:
+                revdep.run_soname(soname, False, True, True, True, False)
+
+        def query():
+            for (abi, soname) in to_mark:
+                revdep.run_elf(os.path.join(top, 'root', 'usr', 'lib-%s' % abi.lower(), soname),
+                               False, False, False)
+
+        phases = [
+            ('graph', build_graph),
+            ('forward', lambda: revdep.run_forward(False)),
+            ('reverse', lambda: revdep.run_reverse(False, False)),
+            ('solve', lambda: revdep.run_solve(False, False, False)),
+            ('mark x%d' % len(to_mark), mark),
+            ('query x%d' % len(to_mark), query),
+        ]
+
+        print('packages %d, objects %d, depth %d, fanout %d, abis %d' % (
+            packages, packages * objects * abis, depth, fanout, abis))
+        print('generated in %.2fs below %s\n' % (generated, top))
+        print('%-12s %10s %12s' % ('phase', 'wall (s)', 'peak (MiB)'))
+
+        failed = False
+        for (name, func) in phases:
+            (name, elapsed, maxrss) = run_phase(name, func)
+            if elapsed is None:
+                print('%-12s %10s %12s' % (name, 'FAILED', '-'))
+                failed = True
+            else:
+                print('%-12s %10.3f %12.1f' % (name, elapsed, maxrss / 1024.0))
+            sys.stdout.flush()
+
+    finally:
+        if not keep:
+            shutil.rmtree(top, ignore_errors=True)
+
+    if failed:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,214 @@
+#!/bin/bash
+#
+#    revdepservetest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Serve the link graph of a vdb made up in a temporary directory, which a
+# stand-in portage module points revdep-pax at, and check the records of a
+# query over the socket against the flags pax reads, also after they were
+# changed, then add a package to the vdb and check that the graph is
+# rebuilt with it.  On SIGTERM the server must remove its socket.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+REVDEPPAX="${PWD}"/../../scripts/revdep-pax
+MKELF="${PWD}"/../mkelf.py
+
+unamem=$(uname -m)
+pythonversion=$(python --version 2>&1)
+pythonversion=$(echo ${pythonversion} | awk '{ print $2 }')
+pythonversion=${pythonversion%\.*}
+PAXMODULE="${PWD}/../../scripts/build/lib.linux-${unamem}-${pythonversion}"
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+export XTPAX
+export PTPAX
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/revdepservetest.XXXXXX)
+VDB="${TMPDIR}"/vdb
+SOCK="${TMPDIR}"/sock
+SERVER=
+trap '[[ -n "${SERVER}" ]] && kill ${SERVER} 2>/dev/null; rm -rf "${TMPDIR}"' EXIT
+
+mismatch() {
+  (( count = count + 1 ))
+  [[ "${verbose}" != 0 ]] && echo " $*"
+}
+
+# A package of one ELF object: category/package, object, soname, needed
+package() {
+  mkdir -p "${VDB}"/$1
+  echo "X86_64;${TMPDIR}/$2;$3;;$4" > "${VDB}"/$1/NEEDED.ELF.2
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING REVDEP-PAX SERVE TEST"
+echo
+
+if [[ $(id -u) != 0 ]]; then
+  echo " Not root, skipped"
+else
+  if [[ ! -d "${PAXMODULE}" ]]; then
+    ( cd ../../scripts; exec ./setup.py build ) >/dev/null
+  fi
+
+  # Only get_vdb() needs portage
+  mkdir -p "${TMPDIR}"/python
+  cat << EOF > "${TMPDIR}"/python/portage.py
+root = '/'
+VDB_PATH = '${VDB}'
+EOF
+  export PYTHONPATH="${TMPDIR}/python:${PAXMODULE}"
+
+  python "${MKELF}" -f PEMRS "${TMPDIR}"/bin "${TMPDIR}"/bin2
+  python "${MKELF}" -f pemrs "${TMPDIR}"/libfoo.so.1
+  package zzz/bin-1 bin "" libfoo.so.1
+  package zzz/foo-1 libfoo.so.1 libfoo.so.1 ""
+
+  python "${REVDEPPAX}" --serve "${SOCK}" --refresh 0.2 >/dev/null 2>&1 &
+  SERVER=$!
+  for (( i = 0; i < 100; i++ )); do
+    [[ -S "${SOCK}" ]] && break
+    sleep 0.1
+  done
+
+  # The client adds zzz/bin2-1 itself, once it has the stamp of the graph
+  scount=$(python - "${SOCK}" "${TMPDIR}" "${verbose}" <<'EOF'
+import json
+import os
+import socket
+import sys
+import time
+import pax
+(sock, tmpdir, verbose) = sys.argv[1:]
+count = 0
+
+def fail(msg):
+    global count
+    count += 1
+    if verbose != '0':
+        sys.stderr.write(' %s\n' % msg)
+
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.connect(sock)
+f = s.makefile('rb')
+rid = 0
+
+def query(request):
+    """ The records and the status line of one request """
+    global rid
+    rid += 1
+    request['id'] = rid
+    s.sendall((json.dumps(request) + '\n').encode())
+    records = []
+    while True:
+        record = json.loads(f.readline().decode())
+        if 'id' in record:
+            if record['id'] != rid:
+                fail('%s: the reply is for request %s' % (request, record['id']))
+            return (records, record)
+        records.append(record)
+
+def flags(elf):
+    try:
+        return pax.getflags(elf)[0]
+    except pax.PaxError:
+        return '****'
+
+def check_elf(elf, library):
+    (records, status) = query({'query': 'elf', 'object': elf, 'verbose': True})
+    if status.get('records') != 1 or len(records) != 1:
+        fail('elf %s: %s records, status %s' % (elf, len(records), status))
+        return
+    r = records[0]
+    expected = {'object': elf, 'soname': 'libfoo.so.1', 'library': library,
+                'object_flags': flags(elf), 'library_flags': flags(library),
+                'mismatch': flags(elf) != flags(library)}
+    for key in expected:
+        if r.get(key) != expected[key]:
+            fail('elf %s: %s is %s, expected %s' % (elf, key, r.get(key), expected[key]))
+
+def objects(soname):
+    (records, status) = query({'query': 'soname', 'soname': soname, 'verbose': True})
+    return sorted(r['object'] for r in records)
+
+bin = os.path.join(tmpdir, 'bin')
+bin2 = os.path.join(tmpdir, 'bin2')
+library = os.path.join(tmpdir, 'libfoo.so.1')
+
+check_elf(bin, library)
+if objects('libfoo.so.1') != [bin]:
+    fail('libfoo.so.1 is needed by %s' % objects('libfoo.so.1'))
+(records, status) = query({'query': 'nosuchquery'})
+if 'error' not in status:
+    fail('a bad query got %s' % status)
+
+# A marking changed under the server must be seen on the next query
+try:
+    pax.setstrflags(bin, flags(library))
+except pax.PaxError:
+    pass
+check_elf(bin, library)
+
+(records, status) = query({'query': 'stats'})
+built = records[0]['built'] if records else None
+
+os.makedirs(os.path.join(tmpdir, 'vdb', 'zzz', 'bin2-1'))
+n = open(os.path.join(tmpdir, 'vdb', 'zzz', 'bin2-1', 'NEEDED.ELF.2'), 'w')
+n.write('X86_64;%s;;;libfoo.so.1\n' % bin2)
+n.close()
+
+for i in range(100):
+    (records, status) = query({'query': 'stats'})
+    if records and records[0]['built'] != built:
+        break
+    time.sleep(0.1)
+else:
+    fail('the graph was not rebuilt after the vdb changed')
+
+if objects('libfoo.so.1') != [bin, bin2]:
+    fail('after the rebuild libfoo.so.1 is needed by %s' % objects('libfoo.so.1'))
+check_elf(bin2, library)
+
+f.close()
+s.close()
+print(count)
+EOF
+)
+  (( count = count + ${scount:-1} ))
+
+  kill ${SERVER}
+  wait ${SERVER}
+  SERVER=
+  [[ -e "${SOCK}" ]] && mismatch "the socket was left behind on SIGTERM"
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
@@ -0,0 +1,327 @@
+#!/bin/bash
+#
+#    servetest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Run paxctl-ng --serve on a socket in a scratch directory and check that
+# --connect marks two copies of the same ELFs just as paxctl-ng does on
+# its own, over several batches.  Then talk the protocol directly to check
+# the framing, pipelined requests, SRV_EINVAL, a malformed request and that
+# a client which does not read its replies is held back, and play the
+# server to check that the client files replies which come back out of
+# order.  Last, how the socket is created and taken over.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+MKELF="${PWD}"/../mkelf.py
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/servetest.XXXXXX)
+SOCK="${TMPDIR}"/sock
+SERVER=
+trap '[[ -n "${SERVER}" ]] && kill ${SERVER}; rm -rf "${TMPDIR}"' EXIT
+
+NFILES=150			# three batches of SRV_BATCH
+FLAGS=(PeMRs pemrs PEMRS pEmRs)
+
+mkdir -p "${TMPDIR}"/direct "${TMPDIR}"/served
+for (( i = 0; i < NFILES; i++ )); do
+  f=$(printf "f%03d" $i)
+  FILES="${FILES} $f"
+  GROUP[i % 4]="${GROUP[i % 4]} ${TMPDIR}/direct/$f ${TMPDIR}/served/$f"
+done
+for (( i = 0; i < 4; i++ )); do
+  python "${MKELF}" -f ${FLAGS[i]} ${GROUP[i]}
+done
+
+mismatch() {
+  (( count = count + 1 ))
+  [[ "${verbose}" != 0 ]] && echo " $*"
+}
+
+# start_server SOCKET, sets SERVER
+start_server() {
+  local i
+  ${PAXCTLNG} --serve "$1" &
+  SERVER=$!
+  # The socket of the last server may still be there, so wait for an answer
+  for (( i = 0; i < 50; i++ )); do
+    ${PAXCTLNG} --connect "$1" -v /dev/null >/dev/null 2>&1 && return 0
+    sleep 0.1
+  done
+  mismatch "server did not come up on $1"
+  return 1
+}
+
+stop_server() {
+  kill -9 ${SERVER}
+  wait ${SERVER} 2>/dev/null
+  SERVER=
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING SERVE TEST"
+echo
+
+start_server "${SOCK}"
+
+if [[ "$(stat -c %a "${SOCK}")" != 600 ]]; then
+  mismatch "socket mode is $(stat -c %a "${SOCK}"), not 600"
+fi
+
+# The same operations directly and through the server, on relative paths
+OPS=("-m" "-PEmRs" "-z" "-n -z")
+[[ -n "${XTPAX}" ]] && OPS+=("-C" "-C" "-d" "-c" "-pe")
+[[ -n "${PTPAX}" && -n "${XTPAX}" ]] && OPS+=("-L -s" "-l -R" "-F" "-f")
+
+for op in "${OPS[@]}"; do
+  direct=$(cd "${TMPDIR}"/direct && ${PAXCTLNG} -v ${op} ${FILES}; echo "exit $?")
+  served=$(cd "${TMPDIR}"/served && ${PAXCTLNG} --connect "${SOCK}" -v ${op} ${FILES}; echo "exit $?")
+  [[ "${direct}" != "${served}" ]] && mismatch "-v ${op} differs through the server"
+
+  direct=$(cd "${TMPDIR}"/direct && ${PAXCTLNG} --json ${op} f000 missing; echo "exit $?")
+  served=$(cd "${TMPDIR}"/served && ${PAXCTLNG} --connect "${SOCK}" --json ${op} f000 missing; echo "exit $?")
+  [[ "${direct}" != "${served}" ]] && mismatch "--json ${op} differs through the server"
+done
+
+pcount=$(python - "${SOCK}" "${TMPDIR}"/served "${PAXCTLNG}" "${verbose}" <<'EOF'
+import json
+import os
+import socket
+import struct
+import subprocess
+import sys
+import threading
+
+(sock, served, paxctlng, verbose) = sys.argv[1:]
+
+# struct srv_req, srv_reply and srv_result in host byte order
+REQ = '=IIHBBI'
+REPLY = '=IIII'
+RESULT = '=HHBBH'
+SRV_OK, SRV_EOPEN, SRV_EUPDATE, SRV_EINVAL = range(4)
+
+count = 0
+
+def mismatch(what):
+    global count
+    count += 1
+    if verbose != '0':
+        sys.stderr.write(' %s\n' % what)
+
+def request(id, paths, cp_flags=0, npaths=None):
+    data = b''.join([p.encode() + b'\0' for p in paths])
+    if npaths is None:
+        npaths = len(paths)
+    return struct.pack(REQ, struct.calcsize(REQ) - 4 + len(data), id, 0, cp_flags, 0, npaths) + data
+
+def recv_full(s, n):
+    buf = b''
+    while len(buf) < n:
+        b = s.recv(n - len(buf))
+        if not b:
+            return None
+        buf += b
+    return buf
+
+def reply(s):
+    head = recv_full(s, struct.calcsize(REPLY))
+    if head is None:
+        return None
+    (length, id, nresults, pad) = struct.unpack(REPLY, head)
+    if length != struct.calcsize(REPLY) - 4 + nresults * struct.calcsize(RESULT):
+        mismatch('reply %d has length %d for %d results' % (id, length, nresults))
+        return None
+    body = recv_full(s, nresults * struct.calcsize(RESULT))
+    return (id, [struct.unpack_from(RESULT, body, i * struct.calcsize(RESULT)) for i in range(nresults)])
+
+def connect(path):
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect(path)
+    return s
+
+# Pipeline requests of 0 to 5 paths, one of them missing, before reading
+# any reply, and check every reply turns up once and fits its request
+s = connect(sock)
+sent = {}
+for id in range(20):
+    paths = [os.path.join(served, 'f%03d' % (id * 5 + i)) for i in range(id % 6)]
+    if id == 9:
+        paths[1] = os.path.join(served, 'missing')
+    sent[id] = paths
+    s.sendall(request(id, paths))
+for n in range(20):
+    r = reply(s)
+    if r is None or r[0] not in sent:
+        mismatch('reply %d is missing or unknown: %r' % (n, r))
+        break
+    (id, results) = r
+    paths = sent.pop(id)
+    if len(results) != len(paths):
+        mismatch('reply %d has %d results for %d paths' % (id, len(results), len(paths)))
+        continue
+    for (p, (pt, xt, status, changed, pad)) in zip(paths, results):
+        want = SRV_EOPEN if p.endswith('missing') else SRV_OK
+        if status != want or changed != 0:
+            mismatch('%s: status %d changed %d' % (p, status, changed))
+
+# An operation the server does not know
+s.sendall(request(100, [os.path.join(served, 'f000'), os.path.join(served, 'f001')], cp_flags=99))
+r = reply(s)
+if r is None or r[0] != 100 or [res[2] for res in r[1]] != [SRV_EINVAL, SRV_EINVAL]:
+    mismatch('unknown operation got %r' % (r,))
+
+# A request whose paths do not add up ends the connection, and only it
+s.sendall(request(101, [os.path.join(served, 'f000')], npaths=2))
+if reply(s) is not None:
+    mismatch('malformed request got a reply')
+s.close()
+
+s = connect(sock)
+s.sendall(request(102, [os.path.join(served, 'f000')]))
+r = reply(s)
+if r is None or r[0] != 102 or r[1][0][2] != SRV_OK:
+    mismatch('a new connection after a malformed request got %r' % (r,))
+s.close()
+
+# Flood a connection with three times the SRV_QUEUED_MAX bytes of requests
+# the server queues for one, without reading the replies.  The server has
+# to stop reading them rather than buffer them all, and once the replies
+# are read, every request has to be answered.
+NFLOOD = 24
+flood = [os.path.join(served, 'missing%06d' % i) for i in range(1024 * 1024 // (len(served) + 16))]
+s = connect(sock)
+t = threading.Thread(target=lambda: [s.sendall(request(200 + id, flood)) for id in range(NFLOOD)])
+t.daemon = True
+t.start()
+t.join(3)
+if not t.is_alive():
+    mismatch('the server read %d requests of 1MB without a reply being read' % NFLOOD)
+answered = set()
+for n in range(NFLOOD):
+    r = reply(s)
+    if r is None or len(r[1]) != len(flood) or any(res[2] != SRV_EOPEN for res in r[1]):
+        mismatch('flood reply %d is missing or wrong' % n)
+        break
+    answered.add(r[0])
+t.join()
+s.close()
+if answered != set(range(200, 200 + NFLOOD)):
+    mismatch('%d of %d flood requests were answered' % (len(answered), NFLOOD))
+
+# Play the server and answer the batches of a client last first.  Each
+# result carries flags made from the number of its file, which the client
+# has to print against the right file.
+PAIRS = [('P', 1 << 4, 'p', 1 << 5), ('E', 1 << 12, 'e', 1 << 13), ('M', 1 << 8, 'm', 1 << 9),
+         ('R', 1 << 14, 'r', 1 << 15), ('S', 1 << 6, 's', 1 << 7)]
+
+def encode(n):
+    """ Flags and how they print, different for each n below 243 """
+    (flags, shown) = (0, '')
+    for (up, upbit, lo, lobit) in PAIRS:
+        (n, d) = divmod(n, 3)
+        flags |= [0, upbit, lobit][d]
+        shown += ['-', up, lo][d]
+    return (flags, shown)
+
+fake = os.path.join(os.path.dirname(sock), 'fake')
+l = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+l.bind(fake)
+l.listen(1)
+
+def fake_server():
+    c = l.accept()[0]
+    reqs = []
+    while len(reqs) < 3:
+        head = recv_full(c, struct.calcsize(REQ))
+        (length, id, pax_flags, cp_flags, limit, npaths) = struct.unpack(REQ, head)
+        paths = recv_full(c, length - (struct.calcsize(REQ) - 4)).split(b'\0')[:npaths]
+        reqs.append((id, paths))
+    for (id, paths) in reversed(reqs):
+        results = b''
+        for p in paths:
+            n = int(os.path.basename(p)[1:])
+            results += struct.pack(RESULT, encode(n)[0], 0xffff, SRV_OK, 0, 0)
+        c.sendall(struct.pack(REPLY, struct.calcsize(REPLY) - 4 + len(results), id, len(paths), 0) + results)
+    c.close()
+
+t = threading.Thread(target=fake_server)
+t.start()
+files = ['f%03d' % i for i in range(150)]
+p = subprocess.Popen([paxctlng, '--connect', fake, '--json'] + files,
+                     cwd=served, stdout=subprocess.PIPE)
+out = p.communicate()[0].decode().splitlines()
+t.join()
+l.close()
+
+if p.returncode != 0 or len(out) != len(files):
+    mismatch('client of the fake server exited with %d after %d lines' % (p.returncode, len(out)))
+else:
+    for (f, line) in zip(files, out):
+        o = json.loads(line)
+        if o['path'] != f or o['pt'] != encode(int(f[1:]))[1] or o['xt'] is not None:
+            mismatch('%s got %r' % (f, o))
+
+print(count)
+EOF
+)
+(( count = count + ${pcount:-1} ))
+
+# Only a socket is ever replaced, and only if no server answers on it
+echo "not a socket" > "${TMPDIR}"/file
+if timeout 5 ${PAXCTLNG} --serve "${TMPDIR}"/file 2>/dev/null; then
+  mismatch "--serve took over a regular file"
+fi
+[[ "$(cat "${TMPDIR}"/file)" != "not a socket" ]] && mismatch "--serve changed a regular file"
+
+if timeout 5 ${PAXCTLNG} --serve "${SOCK}" 2>/dev/null; then
+  mismatch "--serve took over the socket of a running server"
+fi
+
+stop_server
+[[ -S "${SOCK}" ]] || mismatch "the socket of a killed server is gone"
+start_server "${SOCK}"
+out=$(cd "${TMPDIR}"/served && ${PAXCTLNG} --connect "${SOCK}" -v f000 | grep -c "^f000:")
+[[ "${out}" != 1 ]] && mismatch "a server which took over a stale socket did not answer"
+
+# Other users are refused even where the socket's mode would let them in
+if [[ $(id -u) = 0 ]] && which setpriv >/dev/null 2>&1; then
+  chmod 0666 "${SOCK}"
+  chmod 0755 "${TMPDIR}"
+  if setpriv --reuid=65534 --regid=65534 --clear-groups \
+      ${PAXCTLNG} --connect "${SOCK}" -v "${TMPDIR}"/served/f000 >/dev/null 2>&1; then
+    mismatch "another user was served"
+  fi
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
@@ -0,0 +1,139 @@
+#!/bin/bash
+#
+#    sysroottest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Mark an image with --sysroot whose symlinks, absolute and with more ".."
+# than there are directories, would lead out of it on the host, and check
+# that only ELFs inside it are marked, as from a chroot into it.  The run
+# is made once with openat2() and once with it failing with ENOSYS, which
+# the LD_PRELOAD helper ../preload.c arranges, so walk_in_root() is tested
+# whatever the kernel.  Some of the ELFs are big endian, so PT_PAX is also
+# written to an ELF of the other byte order than the host's, whichever that
+# is, one of them with its phdrs at the end of the file, and checked byte
+# for byte by mkelf.py.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+MKELF="${PWD}"/../mkelf.py
+PRELOAD="${PWD}"/../.libs/libpreload.so
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/sysroottest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+mismatch() {
+  (( count = count + 1 ))
+  [[ "${verbose}" != 0 ]] && echo " $*"
+}
+
+# The markings paxctl-ng finds on a host path, one per line
+markings() {
+  ${PAXCTLNG} -v "$1" | grep "PAX" | grep -v "not found" | sed -n 's/.*: //p'
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING SYSROOT TEST"
+echo
+
+if [[ ! -f "${PRELOAD}" ]]; then
+  mismatch "${PRELOAD} is missing, run make check in tests"
+fi
+
+for resolve in openat2 walk; do
+  TOP="${TMPDIR}"/${resolve}
+  ROOT="${TOP}"/root
+  mkdir -p "${ROOT}"/bin "${ROOT}"/lib "${ROOT}"/usr "${TOP}"/bin
+
+  # What is inside the image, and what is next to it on the host
+  python "${MKELF}" -f pemrs "${ROOT}"/bin/prog "${ROOT}"/bin/prog2 "${ROOT}"/outside \
+    "${TOP}"/bin/prog "${TOP}"/outside
+  python "${MKELF}" -b -f pemrs "${ROOT}"/lib/libbe.so
+  python "${MKELF}" -b -3 -f pemrs "${ROOT}"/lib/libbe32.so
+  python "${MKELF}" -b -p -s 1048576 -f pemrs "${ROOT}"/lib/libbefar.so
+  cp "${ROOT}"/lib/libbe.so "${ROOT}"/lib/libbefar.so "${TMPDIR}"
+
+  ln -s /lib "${ROOT}"/usr/lib			# absolute
+  ln -s ../../outside "${ROOT}"/escape		# more ".." than directories
+  ln -s "${TOP}"/outside "${ROOT}"/abs		# a host path
+  ln -s ../../../../bin "${ROOT}"/lib/up		# both, then down again
+
+  before=$(markings "${TOP}"/bin/prog; markings "${TOP}"/outside)
+
+  rm -f "${TMPDIR}"/log
+  if [[ ${resolve} = walk ]]; then
+    PRELOAD_NOSYS=openat2 PRELOAD_LOG="${TMPDIR}"/log LD_PRELOAD="${PRELOAD}" \
+      ${PAXCTLNG} --sysroot "${ROOT}" -Z /bin/prog /usr/lib/libbe.so /lib/libbe32.so /lib/libbefar.so \
+        /escape /abs ../bin/prog /lib/up/prog2 >/dev/null
+    grep -q "^nosys [1-9]" "${TMPDIR}"/log 2>/dev/null || mismatch "${resolve}: openat2() was not stopped"
+  else
+    ${PAXCTLNG} --sysroot "${ROOT}" -Z /bin/prog /usr/lib/libbe.so /lib/libbe32.so /lib/libbefar.so \
+      /escape /abs ../bin/prog /lib/up/prog2 >/dev/null
+  fi
+
+  # Everything in the image was reached, through whichever link
+  for f in bin/prog bin/prog2 lib/libbe.so lib/libbe32.so lib/libbefar.so outside; do
+    got=$(markings "${ROOT}"/$f | sort -u)
+    [[ "${got}" != "PeMRS" ]] && mismatch "${resolve}: ${f} is '${got}', not PeMRS"
+  done
+
+  # and nothing outside it
+  after=$(markings "${TOP}"/bin/prog; markings "${TOP}"/outside)
+  [[ "${before}" != "${after}" ]] && mismatch "${resolve}: a file outside the image was marked"
+
+  # The big endian ELFs have the new PT_PAX flags and are otherwise as they
+  # were, also when the phdrs are at the end
+  for f in libbe.so libbefar.so; do
+    got=$(python - "${MKELF}" "${TMPDIR}"/$f "${ROOT}"/lib/$f "${PTPAX}" <<'EOF'
+import os
+import struct
+import sys
+(mkelf, orig, new, ptpax) = sys.argv[1:]
+sys.path.insert(0, os.path.dirname(mkelf))
+from mkelf import pt_flags
+(orig, new) = (open(orig, 'rb').read(), open(new, 'rb').read())
+(phoff,) = struct.unpack_from('>Q', orig, 32)
+(phentsize, phnum) = struct.unpack_from('>HH', orig, 54)
+phend = phoff + phentsize * phnum
+want = 'PeMRS' if ptpax else 'pemrs'
+if pt_flags(new) != want:
+    print('PT_PAX is %s, not %s' % (pt_flags(new), want))
+elif len(new) != len(orig) or new[:phoff] != orig[:phoff] or new[phend:] != orig[phend:]:
+    print('more than the program headers changed')
+EOF
+)
+    [[ -n "${got}" ]] && mismatch "${resolve}: lib/$f: ${got}"
+  done
+done
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
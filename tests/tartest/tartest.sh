@@ -0,0 +1,195 @@
+#!/bin/bash
+#
+#    tartest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Pipe tar streams made up with python's tarfile through paxctl-ng --tar
+# and read them back.  The ELF members come from mkelf.py and are checked
+# for their PT_PAX flags and their SCHILY.xattr.user.pax.flags records,
+# both new and replaced, whatever else is around them: ustar, pax and GNU
+# long name and long link headers.  Members no rule marks must come out
+# byte for byte as they went in.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+MKELF="${PWD}"/../mkelf.py
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+export XTPAX
+export PTPAX
+
+TMPDIR=$(mktemp -d "${PWD}"/tartest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+echo "================================================================================"
+echo
+echo " RUNNING TAR TEST"
+echo
+
+cat << RULES > "${TMPDIR}"/rules
+# The first match wins
+pm bin/a
+mR usr/lib/*
+E */long*
+PEMRS notes.txt
+RULES
+
+count=$(python - "${PAXCTLNG}" "${MKELF}" "${TMPDIR}" "${verbose}" <<'EOF'
+import io
+import os
+import subprocess
+import sys
+import tarfile
+
+(paxctlng, mkelf, tmpdir, verbose) = sys.argv[1:]
+sys.path.insert(0, os.path.dirname(mkelf))
+from mkelf import elf, pt_flags
+
+PTPAX = bool(os.environ.get('PTPAX'))
+XTPAX = bool(os.environ.get('XTPAX'))
+KEY = 'SCHILY.xattr.user.pax.flags'
+LONGDIR = 'd' * 120
+
+count = 0
+
+def mismatch(what, want, got):
+    global count
+    count += 1
+    if verbose != '0':
+        sys.stderr.write('%s: expected %r, got %r\n' % (what, want, got))
+
+def member(name, data=b'', fmt=tarfile.USTAR_FORMAT, pax=None, link=None):
+    """ The header blocks and data of one member, as tarfile writes them """
+    ti = tarfile.TarInfo(name)
+    ti.mtime = 1000000000
+    if link is not None:
+        ti.type = tarfile.SYMTYPE
+        ti.linkname = link
+    else:
+        ti.size = len(data)
+    if pax:
+        ti.pax_headers = pax
+    out = ti.tobuf(fmt, 'utf-8', 'strict')
+    out += data + b'\0' * (-len(data) % 512)
+    return out
+
+def paxctl(tar, *opts):
+    p = subprocess.Popen([paxctlng] + list(opts) + ['--tar', os.path.join(tmpdir, 'rules')],
+                         stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    out = p.communicate(tar)[0]
+    if p.returncode != 0:
+        mismatch('paxctl-ng %s --tar exit status' % ' '.join(opts), 0, p.returncode)
+    return out
+
+def members(tar):
+    t = tarfile.open(fileobj=io.BytesIO(tar))
+    found = {}
+    for ti in t.getmembers():
+        data = t.extractfile(ti).read() if ti.isreg() else None
+        found[ti.name] = (ti, data)
+    return found
+
+# ( name, PT_PAX of the input, PT_PAX then, XATTR_PAX of the input, XATTR_PAX then )
+elfs = [
+    ('bin/a', elf('PEMRS'), 'pEmRS', None, 'pem'),
+    ('usr/lib/libb.so', elf('pemrs'), 'pemRs', 'PeMRS', 'PemRS'),
+    ('usr/lib/libbe.so', elf('PEMRS', msb=True, bits=32), 'PEmRS', None, 'emR'),
+    (LONGDIR + '/longelf', elf('pemrs'), 'pEmrs', None, 'E'),
+]
+untouched = [
+    ('bin/c', elf('PeMRs')),
+    ('notes.txt', b'PEMRS but no ELF\n'),
+]
+
+tar = member('bin/a', elfs[0][1])
+tar += member('usr/lib/libb.so', elfs[1][1], tarfile.PAX_FORMAT,
+              { KEY : 'PeMRS', 'SCHILY.xattr.user.other' : 'keep' })
+tar += member('usr/lib/libbe.so', elfs[2][1], tarfile.PAX_FORMAT, { 'comment' : 'keep' })
+tar += member(LONGDIR + '/longelf', elfs[3][1], tarfile.GNU_FORMAT)
+tar += member('lnk', link=LONGDIR + '/longelf', fmt=tarfile.GNU_FORMAT)
+for (name, data) in untouched:
+    tar += member(name, data)
+tar += b'\0' * 1024
+
+got = members(paxctl(tar))
+
+if sorted(got.keys()) != sorted([e[0] for e in elfs] + [u[0] for u in untouched] + ['lnk']):
+    mismatch('members', None, sorted(got.keys()))
+
+for (name, image, pt, xt_in, xt) in elfs:
+    if name not in got:
+        continue
+    (ti, data) = got[name]
+    want = pt if PTPAX else pt_flags(image)
+    if pt_flags(data) != want:
+        mismatch('%s PT_PAX' % name, want, pt_flags(data))
+    # Nothing but the program headers may change
+    if len(data) != len(image) or data[256:] != image[256:]:
+        mismatch('%s data' % name, len(image), len(data))
+    want = xt if XTPAX else xt_in
+    if ti.pax_headers.get(KEY) != want:
+        mismatch('%s XATTR_PAX' % name, want, ti.pax_headers.get(KEY))
+
+for (name, key) in [('usr/lib/libb.so', 'SCHILY.xattr.user.other'), ('usr/lib/libbe.so', 'comment')]:
+    if name in got and got[name][0].pax_headers.get(key) != 'keep':
+        mismatch('%s %s' % (name, key), 'keep', got[name][0].pax_headers.get(key))
+
+if 'lnk' in got and got['lnk'][0].linkname != LONGDIR + '/longelf':
+    mismatch('lnk linkname', LONGDIR + '/longelf', got['lnk'][0].linkname)
+
+for (name, data) in untouched:
+    if name in got and (got[name][1] != data or KEY in got[name][0].pax_headers):
+        mismatch('%s untouched' % name, data, got[name][1])
+
+# -L leaves the extended headers alone
+if PTPAX and XTPAX:
+    got = members(paxctl(tar, '-L'))
+    if 'bin/a' in got:
+        (ti, data) = got['bin/a']
+        if pt_flags(data) != 'pEmRS' or KEY in ti.pax_headers:
+            mismatch('bin/a -L', 'pEmRS', (pt_flags(data), ti.pax_headers.get(KEY)))
+
+# A stream of nothing to mark comes out as it went in
+tar = b''
+for (name, data) in untouched:
+    tar += member(name, data)
+tar += member('lnk', link=LONGDIR + '/longelf', fmt=tarfile.GNU_FORMAT)
+tar += member(LONGDIR + '/notes', b'no ELF either\n', tarfile.GNU_FORMAT)
+tar += member('usr/share/doc', b'', tarfile.PAX_FORMAT, { KEY : 'pemrs' })
+tar += b'\0' * 10240
+out = paxctl(tar)
+if out != tar:
+    mismatch('unmarked stream', len(tar), len(out))
+
+print(count)
+EOF
+)
+count=${count:-1}
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
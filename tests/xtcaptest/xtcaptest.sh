@@ -0,0 +1,157 @@
+#!/bin/bash
+#
+#    xtcaptest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# What XATTR_PAX can do is remembered for each st_dev, but a read-only
+# bind mount shares st_dev with the mount it is of, and a remount makes
+# it writable again.  Mount a tmpfs twice, once read-only, and check that
+# a write failing on the read-only mount does not stop writes on the other
+# in the same paxctl-ng run, nor in a --serve or the pax module after the
+# remount.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+MKELF="${PWD}"/../mkelf.py
+
+unamem=$(uname -m)
+pythonversion=$(python --version 2>&1)
+pythonversion=$(echo ${pythonversion} | awk '{ print $2 }')
+pythonversion=${pythonversion%\.*}
+export PYTHONPATH="${PWD}/../../scripts/build/lib.linux-${unamem}-${pythonversion}"
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+export XTPAX
+export PTPAX
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/xtcaptest.XXXXXX)
+RW="${TMPDIR}"/rw
+RO="${TMPDIR}"/ro
+SERVER=
+trap '[[ -n "${SERVER}" ]] && kill ${SERVER}; umount "${RO}" "${RW}" 2>/dev/null; rm -rf "${TMPDIR}"' EXIT
+
+mismatch() {
+  (( count = count + 1 ))
+  [[ "${verbose}" != 0 ]] && echo " $*"
+}
+
+# The XATTR_PAX paxctl-ng finds on a path
+xattr_pax() {
+  ${PAXCTLNG} -v "$1" | sed -n 's/.*XATTR_PAX : //p'
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING XTCAP TEST"
+echo
+
+mkdir -p "${RW}" "${RO}"
+if [[ -z "${XTPAX}" ]]; then
+  echo " No XATTR_PAX, skipped"
+elif [[ $(id -u) != 0 ]] || ! mount -t tmpfs tmpfs "${RW}" 2>/dev/null; then
+  echo " Cannot mount a tmpfs, skipped"
+else
+  mount --bind "${RW}" "${RO}"
+  mount -o remount,bind,ro "${RO}"
+
+  # The files are only marked in XATTR_PAX, so nothing else can be written
+  python "${MKELF}" -n "${RW}"/a "${RW}"/b "${RW}"/c "${RW}"/d
+  ${PAXCTLNG} -C "${RW}"/a "${RW}"/b "${RW}"/c "${RW}"/d
+
+  if [[ "$(xattr_pax "${RW}"/a)" != PeMRS ]]; then
+    echo " No user.* xattrs on tmpfs, skipped"
+  else
+    # One run, the read-only mount first
+    ${PAXCTLNG} -E "${RO}"/a "${RW}"/b >/dev/null && mismatch "-E on a read-only mount did not fail"
+    [[ "$(xattr_pax "${RW}"/a)" != PeMRS ]] && mismatch "a was marked through the read-only mount"
+    [[ "$(xattr_pax "${RW}"/b)" != PEMRS ]] && mismatch "b was not marked after a failure on the read-only mount"
+
+    # A server, and the pax module, from before the remount to after it
+    SOCK="${TMPDIR}"/sock
+    ${PAXCTLNG} --serve "${SOCK}" &
+    SERVER=$!
+    for (( i = 0; i < 50; i++ )); do
+      ${PAXCTLNG} --connect "${SOCK}" -v /dev/null >/dev/null 2>&1 && break
+      sleep 0.1
+    done
+
+    ${PAXCTLNG} --connect "${SOCK}" -E "${RO}"/c >/dev/null && mismatch "--serve: -E on a read-only mount did not fail"
+
+    if [[ ! -d "${PYTHONPATH}" ]]; then
+      ( cd ../../scripts; exec ./setup.py build ) >/dev/null
+    fi
+    python - "${RO}"/d "${TMPDIR}" "${verbose}" <<'EOF' &
+import os
+import sys
+import time
+import pax
+(elf, tmpdir, verbose) = sys.argv[1:]
+count = 0
+try:
+    pax.setstrflags(elf, 'E')
+    count += 1
+    if verbose != '0':
+        sys.stderr.write(' pax: setstrflags() on a read-only mount did not fail\n')
+except pax.PaxError:
+    pass
+# Wait for the remount
+open(os.path.join(tmpdir, 'module'), 'w').close()
+while not os.path.exists(os.path.join(tmpdir, 'go')):
+    time.sleep(0.05)
+try:
+    pax.setstrflags(elf, 'E')
+except pax.PaxError:
+    pass
+if pax.getptxtflags(elf)[1] != 'PEMRS':
+    count += 1
+    if verbose != '0':
+        sys.stderr.write(' pax: d is %s after the remount\n' % pax.getptxtflags(elf)[1])
+open(os.path.join(tmpdir, 'module.count'), 'w').write('%d\n' % count)
+EOF
+    MODULE=$!
+
+    for (( i = 0; i < 100; i++ )); do
+      [[ -e "${TMPDIR}"/module ]] && break
+      sleep 0.1
+    done
+    mount -o remount,bind,rw "${RO}"
+    touch "${TMPDIR}"/go
+
+    ${PAXCTLNG} --connect "${SOCK}" -E "${RO}"/c >/dev/null || mismatch "--serve: -E failed after the remount"
+    [[ "$(xattr_pax "${RW}"/c)" != PEMRS ]] && mismatch "--serve: c was not marked after the remount"
+
+    wait ${MODULE}
+    mcount=$(cat "${TMPDIR}"/module.count 2>/dev/null)
+    (( count = count + ${mcount:-1} ))
+  fi
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count
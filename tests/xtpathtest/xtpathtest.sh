@@ -0,0 +1,149 @@
+#!/bin/bash
+#
+#    xtpathtest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Without -v, -d, -C, -c and -l go to XATTR_PAX by path and only open the
+# file to merge into a different XATTR_PAX.  Run the same operations on two
+# copies of some files, once so and once with -v, which always opens them
+# as paxctl-ng did before, and check the markings and exit codes agree.
+# The LD_PRELOAD helper ../preload.c counts the opens and flocks of the
+# path runs, which should only be there for a merge, and the whole is run
+# again with getxattrat() and co failing with ENOSYS, as on older kernels.
+
+verbose=${1-0}
+shift
+
+PWD=$(pwd)
+PAXCTLNG="${PWD}"/../../src/paxctl-ng
+MKELF="${PWD}"/../mkelf.py
+PRELOAD="${PWD}"/../.libs/libpreload.so
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+done
+
+count=0
+
+TMPDIR=$(mktemp -d "${PWD}"/xtpathtest.XXXXXX)
+trap 'rm -rf "${TMPDIR}"' EXIT
+
+mismatch() {
+  (( count = count + 1 ))
+  [[ "${verbose}" != 0 ]] && echo " $*"
+}
+
+# The markings of a file as paxctl-ng -v shows them
+markings() {
+  ( cd "$1" && ${PAXCTLNG} -v "$2" | grep "PAX" | tr -d '\t' | tr '\n' ' ' )
+}
+
+echo "================================================================================"
+echo
+echo " RUNNING XTPATH TEST"
+echo
+
+if [[ ! -f "${PRELOAD}" ]]; then
+  mismatch "${PRELOAD} is missing, run make check in tests"
+fi
+
+# With PT_PAX too, -l keeps it out of the way
+LIMIT=
+[[ -n "${PTPAX}" ]] && LIMIT=-l
+
+# An operation, and whether the path run may open the files for it
+OPS=(
+  "-C" 0
+  "-C" 0
+  "${LIMIT} -E" 1
+  "${LIMIT} -E" 0
+  "-d" 0
+  "-d" 0
+  "${LIMIT} -m" 0
+  "-c" 0
+  "-d" 0
+  "-c" 0
+  "${LIMIT} -PEMRS" 1
+  "${LIMIT} -PEMRS" 0
+  "-P" 1
+  "-d" 0
+)
+
+# A missing file has to be opened to be reported, so it is kept apart
+FILES="elf noheader text link"
+MISSING="${TMPDIR}"/gone/missing
+
+if [[ -z "${XTPAX}" ]]; then
+  echo " No XATTR_PAX, skipped"
+else
+  for nosys in "" "getxattrat,setxattrat,removexattrat"; do
+    how=${nosys:+"without *xattrat()"}
+    how=${how:-"with *xattrat()"}
+
+    for d in path fd; do
+      mkdir -p "${TMPDIR}"/$d
+      python "${MKELF}" -f pemrs "${TMPDIR}"/$d/elf
+      python "${MKELF}" -n "${TMPDIR}"/$d/noheader
+      echo "not an ELF" > "${TMPDIR}"/$d/text
+      ln -sf elf "${TMPDIR}"/$d/link
+    done
+
+    nosyscalls=0
+    for (( i = 0; i < ${#OPS[@]}; i += 2 )); do
+      op=${OPS[i]}
+
+      rm -f "${TMPDIR}"/log
+      ( PRELOAD_NOSYS="${nosys}" PRELOAD_DIR="${TMPDIR}"/path \
+        PRELOAD_LOG="${TMPDIR}"/log LD_PRELOAD="${PRELOAD}" ${PAXCTLNG} ${op} \
+          $(for f in ${FILES}; do echo "${TMPDIR}"/path/$f; done) "${MISSING}" >/dev/null 2>&1 )
+      pret=$?
+      ( cd "${TMPDIR}"/fd && ${PAXCTLNG} -v ${op} ${FILES} "${MISSING}" >/dev/null 2>&1 )
+      fret=$?
+      [[ ${pret} != ${fret} ]] && mismatch "${how}: ${op} exits ${pret} by path, ${fret} opened"
+
+      for f in ${FILES}; do
+        p=$(markings "${TMPDIR}"/path $f)
+        o=$(markings "${TMPDIR}"/fd $f)
+        [[ "${p}" != "${o}" ]] && mismatch "${how}: after ${op} $f is '${p}' by path, '${o}' opened"
+      done
+
+      if [[ ${OPS[i+1]} = 0 ]]; then
+        for call in open flock; do
+          n=$(sed -n "s/^${call} //p" "${TMPDIR}"/log 2>/dev/null)
+          [[ "${n}" != 0 ]] && mismatch "${how}: ${op} made '${n}' ${call}() calls by path"
+        done
+      fi
+      n=$(sed -n "s/^nosys //p" "${TMPDIR}"/log 2>/dev/null)
+      (( nosyscalls = nosyscalls + ${n:-0} ))
+    done
+
+    if [[ -n "${nosys}" && ${nosyscalls} = 0 ]]; then
+      mismatch "${how}: the *xattrat() syscalls were never stopped"
+    fi
+
+    rm -rf "${TMPDIR}"/path "${TMPDIR}"/fd
+  done
+fi
+
+echo " Mismatches = ${count}"
+echo
+echo "================================================================================"
+
+exit $count